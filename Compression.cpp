@@ -0,0 +1,138 @@
+#include "Compression.hpp"
+#include "DataStructures.hpp"
+#include "Diff.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// BLOCK CODEC
+static constexpr size_t MIN_MATCH = 4;
+static constexpr size_t LAST_LITERALS = 5;//the block always ends with this many literals
+static constexpr size_t MATCH_SEARCH_END = 12;//no match starts this close to the end
+static constexpr size_t MAX_OFFSET = 65535;
+static constexpr int HASH_BITS = 14;
+static constexpr uint32_t NO_POSITION = 0xFFFFFFFF;
+
+static uint32_t read32(const char* p){
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+static uint32_t hash4(uint32_t sequence){
+    return (sequence*2654435761u)>>(32-HASH_BITS);
+}
+//Remainder of a length whose nibble was 15: bytes of 255, then the rest
+static void writeLength(string& out, size_t length){
+    length-=15;
+    for(; length>=255; length-=255) out+=(char)255;
+    out+=(char)length;
+}
+static bool readLength(const uint8_t*& in, const uint8_t* end, size_t& length){
+    uint8_t byte;
+    do {
+        if(in==end) return false;
+        byte=*in++;
+        length+=byte;
+    } while(byte==255);
+    return true;
+}
+static void writeSequence(string& out, const char* literals, size_t literal_count, size_t offset, size_t match_length){
+    size_t match_code=match_length-MIN_MATCH;
+    out+=(char)((min(literal_count, (size_t)15)<<4) | min(match_code, (size_t)15));
+    if(literal_count>=15) writeLength(out, literal_count);
+    out.append(literals, literal_count);
+    out+=(char)(offset & 0xFF);
+    out+=(char)(offset>>8);
+    if(match_code>=15) writeLength(out, match_code);
+}
+
+string compressBlock(string_view input){
+    const char* src=input.data();
+    size_t n=input.size();
+    string out;
+    out.reserve(n/2+16);
+    size_t anchor=0;
+    if(n>MATCH_SEARCH_END){
+        vector<uint32_t> table(size_t(1)<<HASH_BITS, NO_POSITION);
+        size_t search_end=n-MATCH_SEARCH_END, match_end=n-LAST_LITERALS;
+        size_t i=0;
+        while(i<=search_end){
+            uint32_t sequence=read32(src+i);
+            uint32_t& slot=table[hash4(sequence)];
+            size_t ref=slot;
+            slot=i;
+            if(ref==NO_POSITION || i-ref>MAX_OFFSET || read32(src+ref)!=sequence){
+                i+=1+((i-anchor)>>6);//step further the longer nothing matched
+                continue;
+            }
+            while(i>anchor && ref>0 && src[i-1]==src[ref-1]){ i--; ref--; }
+            size_t length=commonPrefixLength(src+ref, src+i, match_end-i);
+            writeSequence(out, src+anchor, i-anchor, i-ref, length);
+            i+=length;
+            anchor=i;
+            if(i<=search_end) table[hash4(read32(src+i-2))]=i-2;
+        }
+    }
+    size_t literal_count=n-anchor;
+    out+=(char)(min(literal_count, (size_t)15)<<4);
+    if(literal_count>=15) writeLength(out, literal_count);
+    out.append(src+anchor, literal_count);
+    return out;
+}
+
+bool decompressBlock(string_view input, char* output, size_t output_size){
+    const uint8_t* in=reinterpret_cast<const uint8_t*>(input.data());
+    const uint8_t* end=in+input.size();
+    size_t pos=0;
+    while(in<end){
+        uint8_t token=*in++;
+        size_t literal_count=token>>4;
+        if(literal_count==15 && !readLength(in, end, literal_count)) return false;
+        if(literal_count>(size_t)(end-in) || literal_count>output_size-pos) return false;
+        memcpy(output+pos, in, literal_count);
+        in+=literal_count;
+        pos+=literal_count;
+        if(in==end) break;//the last sequence has no match
+        if(end-in<2) return false;
+        size_t offset=in[0] | (in[1]<<8);
+        in+=2;
+        size_t length=token & 15;
+        if(length==15 && !readLength(in, end, length)) return false;
+        length+=MIN_MATCH;
+        if(offset==0 || offset>pos || length>output_size-pos) return false;
+        //Overlapping matches repeat the last offset bytes. Copying from the match start
+        //in chunks that double keeps source and destination apart.
+        char* dst=output+pos;
+        const char* from=dst-offset;
+        for(size_t copied=0; copied<length;){
+            size_t chunk=min(length-copied, copied+offset);
+            memcpy(dst+copied, from, chunk);
+            copied+=chunk;
+        }
+        pos+=length;
+    }
+    return pos==output_size;
+}
+
+// COLD TIER
+ColdTier::ColdTier(chrono::milliseconds window) : stopping(false), window(window) {
+    worker=thread(&ColdTier::run, this);
+}
+ColdTier::~ColdTier(){
+    {
+        lock_guard<mutex> guard(lock);
+        stopping=true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+void ColdTier::run(){
+    unique_lock<mutex> guard(lock);
+    while(!wake.wait_for(guard, window, [this]{ return stopping; })){
+        guard.unlock();
+        BlobStore::instance().compressCold();
+        guard.lock();
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+using namespace std;
+
+// LZ77 block codec in the LZ4 block format: a sequence is a token byte (literal count
+// in the high nibble, match length - 4 in the low one, 15 meaning more length bytes
+// follow), the literals, then a 2-byte little-endian match offset. The last sequence
+// has literals only. Matches are found through a hash table of 4-byte prefixes, so
+// compression is a single pass and decompression is a loop of memcpy's.
+string compressBlock(string_view input);
+// Decodes input into exactly output_size bytes; false if input is malformed.
+bool decompressBlock(string_view input, char* output, size_t output_size);
+
+// Cold tiering: runs BlobStore::compressCold() once per window on a background thread,
+// so content not read for a whole window is compressed until it is next read.
+class ColdTier {
+private:
+    mutex lock;
+    condition_variable wake;
+    bool stopping;
+    chrono::milliseconds window;
+    thread worker;
+    void run();
+public:
+    explicit ColdTier(chrono::milliseconds window);
+    ~ColdTier();
+    ColdTier(const ColdTier&) = delete;
+    ColdTier& operator=(const ColdTier&) = delete;
+};
+#endif
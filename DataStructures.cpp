@@ -1,310 +1,1810 @@
-#include "DataStructures.hpp"
-#include <iostream>
-
-using namespace std;
-
-//TREENODE Implementation
-TreeNode::TreeNode(int id, const string& msg){
-    version_id = id;
-    content = "";
-    message = msg;
-    created_timestamp = time(nullptr);//Sets the created timestamp to the current time
-    snapshot_timestamp = time(nullptr);//Sets the snapshot timestamp to the current time
-    parent = nullptr;
-}
-
-TreeNode::TreeNode(int id, TreeNode* p){//
-    version_id = id;
-    parent = nullptr;
-    message = "";
-    created_timestamp = time(nullptr);
-    snapshot_timestamp = 0;//Snapshot time=0 indicates that it's not a snapshot
-    parent = p;//set the parent to p
-}
-
-TreeNode::~TreeNode() {
-    for (TreeNode* child : children) {
-        delete child;
-    }
-}
-
-bool TreeNode::isSnapshot() {
-    return snapshot_timestamp != 0;
-}
-
-// VERSION MAP(HASH MAP) Implementation
-VersionMap::VersionMap(unsigned int capacity) : capacity(capacity) {
-    entries.resize(capacity, {0, nullptr, true});//Initialize all entries as empty and set Total no. of entries to capacity
-}
-
-VersionMap::~VersionMap(){}
-
-unsigned int VersionMap::hashFunction(int key) {
-    //Simple hashing function: used modulo to map
-        return key % capacity;
-}
-
-void VersionMap::insert(int key, TreeNode* val) {
-    unsigned int index=hashFunction(key);//Index is never negative
-    while(!entries[index].is_empty && entries[index].key!=key) {
-        index=(index+1)%capacity;
-    }
-    entries[index]={key, val, false};
-}
-//get function to retrieve a TreeNode* by its version ID key
-TreeNode* VersionMap::get(int key) {
-    unsigned int index = hashFunction(key);
-    unsigned int start_index = index;
-    while (!entries[index].is_empty) {
-        if (entries[index].key == key) {
-            return entries[index].value;
-        }
-        index = (index + 1) % capacity;
-        if (index == start_index) break;
-    }
-    return nullptr;
-}
-
-// FILE
-File::File(string initial_message){
-    total_versions=1;
-    root=new TreeNode(0, initial_message);
-    active_version=root;
-    version_map.insert(0, root);
-}
-File::~File() {
-    delete root;
-}
-void File::createNewVersion(){
-    TreeNode* new_node=new TreeNode(total_versions, active_version);
-    active_version->children.push_back(new_node);
-    active_version=new_node;
-    version_map.insert(new_node->version_id, new_node);
-    total_versions++;
-}
-void File::updateTime(){
-    if(active_version){
-        active_version->created_timestamp=time(nullptr);
-    }
-}
-void File::read() {
-    if(active_version) {
-        cout<<"Content of file (version "<<active_version->version_id<<"):"<<endl;
-        cout<<active_version->content<<endl;
-    } else {
-        cerr<<"Error: No active version to read."<< endl;
-    }
-}
-void File::insert(const string& content) {
-    if(!active_version){
-        cerr<<"Error: No active version to modify."<<endl;
-        return;
-    }
-    if(active_version->isSnapshot()){
-        createNewVersion();
-    }
-    active_version->content+=content; // allow empty content
-    updateTime();
-}
-void File::update(const string& content) {
-    if(!active_version) {
-        cerr<<"Error: No active version to modify."<<endl;
-        return;
-    }
-    if(active_version->isSnapshot()) {
-        createNewVersion();
-    }
-    active_version->content=content; // allow empty content
-    updateTime();
-}
-void File::snapshot(const string& msg) {
-    if(!active_version) {
-        cerr<<"Error: No active version to snapshot."<<endl;
-        return;
-    }
-    if(active_version->isSnapshot()) {
-        cout<<"Version ID "<<active_version->version_id<<" is already a snapshot."<<endl;
-    } else {
-        active_version->snapshot_timestamp=time(nullptr);
-        active_version->message=msg; // allow empty message
-        cout<<"Snapshot created for version ID "<<active_version->version_id<<endl;
-    }
-    updateTime();
-}
-void File::rollback(int version_id) {
-    TreeNode* target_version = version_map.get(version_id);
-    if(target_version){
-        active_version=target_version;
-        cout<<"Successfully rolled back to version ID "<<version_id<<"."<<endl;
-    } else {
-        cerr<<"Error: Version ID "<<version_id<<" not found."<<endl;
-    }
-}
-void File::rollbackToParent() {
-    if (active_version && active_version->parent){
-        active_version=active_version->parent;
-        cout<<"Rolled back to parent version ID "<<active_version->version_id<<"."<<endl;
-    } else {
-        cerr<<"Error: Cannot roll back. No parent version found."<<endl;
-    }
-}
-void File::history() {
-    TreeNode* current=active_version;
-    cout<<"Snapshot history for file:"<<endl;
-    vector<TreeNode*> snapshots;
-    while(current){
-        if(current->isSnapshot()){
-            snapshots.push_back(current);
-        }
-        current=current->parent;
-    }
-    for(int i = snapshots.size() - 1; i >= 0; --i){
-        TreeNode* snapshot=snapshots[i];
-        char time_str[100];
-        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&snapshot->snapshot_timestamp));
-        cout <<"  - ID: "<< snapshot->version_id 
-             <<", Time: "<< time_str
-             <<", Message: \""<< snapshot->message << "\"" << endl;
-    }
-}
-
-// FILEMAP (HASH MAP FOR FILENAMES) Implementation
-FileMap::FileMap(unsigned int capacity){
-    this->capacity=capacity;
-    entries.resize(capacity, {"", nullptr, true, false});
-}
-FileMap::~FileMap() {}
-
-int FileMap::hashFunction(const string& key){
-    int hash=0;
-    for (int i=0; i<key.size(); i++) {
-        hash=(hash*31+key[i])%capacity;
-    }
-    return hash;
-}
-void FileMap::insert(const string& key, File* value) {
-    if(key.empty() || value==nullptr) return;
-    int index= hashFunction(key);
-    int first_deleted=-1;
-    int start_index=index;
-    while(!entries[index].is_empty || entries[index].is_deleted) {
-        if(entries[index].key==key && !entries[index].is_empty && !entries[index].is_deleted) {
-            entries[index].value=value;
-            return;
-        }
-        if(entries[index].is_deleted && first_deleted==-1) {
-            first_deleted=index;
-        }
-        index=(index+1)%capacity;
-        if(index==start_index) break;
-    }
-    if(first_deleted!=-1) {
-        entries[first_deleted]={key, value, false, false};
-    } else {
-        entries[index]={key, value, false, false};
-    }
-}
-File* FileMap::get(const string& key) {//similar logic to versionMap get function
-    if(key.empty()) return nullptr;
-    int index=hashFunction(key);
-    int start_index=index;
-    while(!entries[index].is_empty || entries[index].is_deleted){
-        if(!entries[index].is_empty && !entries[index].is_deleted && entries[index].key==key){
-            return entries[index].value;
-        }
-        index=(index+1)%capacity;
-        if (index==start_index) break;
-    }
-    return nullptr;
-}
-bool FileMap::contains(const string& key) {
-    return get(key)!=nullptr;
-}
-void FileMap::erase(const string& key) {
-    if(key.empty()) return;
-    int index=hashFunction(key);
-    int start_index=index;
-    while(!entries[index].is_empty || entries[index].is_deleted){
-        if(!entries[index].is_empty && !entries[index].is_deleted && entries[index].key==key) {
-            entries[index].is_empty=false;
-            entries[index].is_deleted=true;
-            entries[index].value=nullptr;
-            entries[index].key="";
-            return;
-        }
-        index=(index+1)%capacity;
-        if (index==start_index) break;
-    }
-}
-vector<string> FileMap::keys() {
-    vector<string> result;
-    for (int i=0; i<(int)entries.size(); i++){
-        if(!entries[i].is_empty && !entries[i].is_deleted){
-            result.push_back(entries[i].key);
-        }
-    }
-    return result;
-}
-
-//FILEHEAP
-FileHeap::FileHeap(bool sort_by_recent){
-    this->sort_by_recent=sort_by_recent;
-}
-FileHeap::~FileHeap(){};
-bool FileHeap::compare(Fileppt& a, Fileppt& b){
-    if(sort_by_recent){
-        return a.last_modified>b.last_modified;
-    } else {
-        return a.total_versions>b.total_versions;
-    }
-}
-void FileHeap::push(const Fileppt& value){
-    heap.push_back(value);
-    heapifyUp(heap.size()-1);
-}
-
-Fileppt FileHeap::pop(){
-    if(empty()){
-        cout<<"Heap is empty. Returning a default Fileppt.\n";
-        return Fileppt{};
-    }
-    Fileppt root=heap.front();
-    heap[0]=heap.back();
-    heap.pop_back();
-    heapifyDown(0);
-    return root;
-}
-
-bool FileHeap::empty(){
-    return heap.empty();
-}
-
-void FileHeap::heapifyUp(unsigned int idx){
-    while(idx>0){
-        unsigned int parent_index=(idx-1)/2;
-        if(compare(heap[idx], heap[parent_index])){
-            swap(heap[idx], heap[parent_index]);
-            idx=parent_index;
-        } else {
-            break;
-        }
-    }
-}
-
-void FileHeap::heapifyDown(unsigned int index) {
-    unsigned int l_child = 2 * index + 1;//index of left child
-    unsigned int r_child = 2 * index + 2;//index of right child
-    unsigned int best_index = index;
-
-    if(l_child<heap.size() && compare(heap[l_child], heap[best_index])){
-        best_index=l_child;
-    }
-    if(r_child<heap.size() && compare(heap[r_child], heap[best_index])){
-        best_index=r_child;
-    }
-
-    if(best_index!=index){
-        swap(heap[index], heap[best_index]);
-        heapifyDown(best_index);
-    }
-}
+#include "DataStructures.hpp"
+#include "Compression.hpp"
+#include "Diff.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+//CLOCK
+static atomic<Stamp> last_stamp{0};
+static thread_local Stamp time_override=0;
+Stamp currentTime(){
+    if(time_override) return time_override;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    Stamp wall=(Stamp)now.tv_sec*STAMPS_PER_SECOND+now.tv_nsec;
+    Stamp last=last_stamp.load(memory_order_relaxed);
+    while(wall>last){//first stamp since the clock ticked
+        if(last_stamp.compare_exchange_weak(last, wall, memory_order_relaxed)) return wall;
+    }
+    return last_stamp.fetch_add(1, memory_order_relaxed)+1;
+}
+static void advanceClock(Stamp t){
+    Stamp last=last_stamp.load(memory_order_relaxed);
+    while(t>last && !last_stamp.compare_exchange_weak(last, t, memory_order_relaxed)){}
+}
+//Under an override the range starts at it, as replay needs, and the clock skips past it.
+Stamp reserveTimes(Stamp count){
+    if(time_override){
+        advanceClock(time_override+count-1);
+        return time_override;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    Stamp wall=(Stamp)now.tv_sec*STAMPS_PER_SECOND+now.tv_nsec;
+    Stamp last=last_stamp.load(memory_order_relaxed);
+    while(true){
+        Stamp first=max(wall, last+1);
+        if(last_stamp.compare_exchange_weak(last, first+count-1, memory_order_relaxed)) return first;
+    }
+}
+void setTimeOverride(Stamp t){
+    time_override=t;
+    advanceClock(t);//later stamps must follow replayed ones
+}
+string formatTime(Stamp t){
+    char time_str[100];
+    time_t seconds=t/STAMPS_PER_SECOND;
+    struct tm local;
+    localtime_r(&seconds, &local);//localtime's buffer is shared between threads
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &local);
+    return time_str;
+}
+
+//EPOCHS
+namespace {
+struct EpochThread {
+    void* participant=nullptr;
+    int depth=0;
+    atomic<bool>* in_use=nullptr;
+    ~EpochThread(){ if(in_use) in_use->store(false, memory_order_release); }
+};
+thread_local EpochThread epoch_thread;
+}
+
+EpochManager::EpochManager() : global_epoch(1), participants(nullptr) {}
+EpochManager::~EpochManager(){//process exit: no readers are left
+    for(Retired& r : limbo) r.destroy(r.object);
+    Participant* p=participants.load();
+    while(p){
+        Participant* next=p->next;
+        delete p;
+        p=next;
+    }
+}
+EpochManager& EpochManager::instance(){
+    static EpochManager manager;
+    return manager;
+}
+EpochManager::Participant* EpochManager::participant(){
+    if(epoch_thread.participant) return static_cast<Participant*>(epoch_thread.participant);
+    Participant* p=participants.load(memory_order_acquire);
+    for(; p; p=p->next){//reuse the entry of an exited thread
+        bool expected=false;
+        if(p->in_use.compare_exchange_strong(expected, true)) break;
+    }
+    if(!p){
+        p=new Participant();
+        p->epoch.store(0);
+        p->in_use.store(true);
+        p->next=participants.load();
+        while(!participants.compare_exchange_weak(p->next, p)){}
+    }
+    epoch_thread.participant=p;
+    epoch_thread.in_use=&p->in_use;
+    return p;
+}
+void EpochManager::enter(){
+    Participant* p=participant();
+    if(epoch_thread.depth++>0) return;
+    p->epoch.store(global_epoch.load());
+    atomic_thread_fence(memory_order_seq_cst);//the pin is visible before any shared pointer is read
+}
+void EpochManager::exit(){
+    if(--epoch_thread.depth>0) return;
+    static_cast<Participant*>(epoch_thread.participant)->epoch.store(0, memory_order_release);
+}
+// The object is already unreachable for new readers, so any reader that pins after the
+// epoch advances past e cannot see it; it is freed once no pin is e or older.
+void EpochManager::retire(void* object, void (*destroy)(void*)){
+    uint64_t e=global_epoch.fetch_add(1);
+    lock_guard<mutex> guard(retire_lock);
+    limbo.push_back({e, object, destroy});
+    if(limbo.size()>=COLLECT_THRESHOLD) collect();
+}
+uint64_t EpochManager::oldestPinned(){
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t oldest=UINT64_MAX;
+    for(Participant* p=participants.load(memory_order_acquire); p; p=p->next){
+        uint64_t pinned=p->epoch.load();
+        if(pinned!=0 && pinned<oldest) oldest=pinned;
+    }
+    return oldest;
+}
+void EpochManager::collect(){
+    uint64_t oldest=oldestPinned();
+    size_t kept=0;
+    for(size_t i=0; i<limbo.size(); i++){
+        if(limbo[i].epoch<oldest) limbo[i].destroy(limbo[i].object);
+        else limbo[kept++]=limbo[i];
+    }
+    limbo.resize(kept);
+}
+uint64_t EpochManager::barrier(){
+    return global_epoch.fetch_add(1);
+}
+bool EpochManager::passed(uint64_t e){
+    return oldestPinned()>e;
+}
+
+//PUBLISHED VERSIONS
+PublishedVersions::PublishedVersions(){
+    for(size_t i=0; i<SEGMENTS; i++) segments[i].store(nullptr, memory_order_relaxed);
+}
+PublishedVersions::~PublishedVersions(){
+    for(size_t i=0; i<SEGMENTS; i++) delete[] segments[i].load(memory_order_relaxed);
+}
+size_t PublishedVersions::segmentOf(size_t id, size_t& offset){
+    size_t block=id/FIRST_SEGMENT+1;
+    size_t segment=63-__builtin_clzll(block);
+    offset=id-FIRST_SEGMENT*((size_t(1)<<segment)-1);
+    return segment;
+}
+void PublishedVersions::publish(TreeNode* node){
+    size_t offset;
+    size_t segment=segmentOf(node->version_id, offset);
+    atomic<TreeNode*>* slots=segments[segment].load(memory_order_relaxed);//only writers store
+    if(!slots){
+        size_t size=FIRST_SEGMENT<<segment;
+        slots=new atomic<TreeNode*>[size];
+        for(size_t i=0; i<size; i++) slots[i].store(nullptr, memory_order_relaxed);
+        segments[segment].store(slots, memory_order_release);
+    }
+    slots[offset].store(node, memory_order_release);
+}
+void PublishedVersions::unpublish(int version_id){
+    size_t offset;
+    size_t segment=segmentOf(version_id, offset);
+    atomic<TreeNode*>* slots=segments[segment].load(memory_order_relaxed);
+    if(slots) slots[offset].store(nullptr, memory_order_release);
+}
+TreeNode* PublishedVersions::get(int version_id) const {
+    if(version_id<0) return nullptr;
+    size_t offset;
+    size_t segment=segmentOf(version_id, offset);
+    atomic<TreeNode*>* slots=segments[segment].load(memory_order_acquire);
+    return slots ? slots[offset].load(memory_order_acquire) : nullptr;
+}
+
+//TREENODE Implementation
+TreeNode::TreeNode(int id, const string& msg){
+    version_id = id;
+    is_keyframe = true;//the root always stores its content in full
+    prefix_len = 0;
+    suffix_len = 0;
+    length = 0;
+    message = msg;
+    created_timestamp = currentTime();//Sets the created timestamp to the current time
+    snapshot_timestamp = created_timestamp;//the root is a snapshot from the start
+    parent = nullptr;
+    first_child = nullptr;
+    next_sibling = nullptr;
+    depth = 0;
+    jump = this;
+}
+
+TreeNode::TreeNode(int id, TreeNode* p){//
+    version_id = id;
+    parent = nullptr;
+    //A new version starts as an empty delta: all of the parent's content, nothing added
+    is_keyframe = false;
+    prefix_len = p->length;
+    suffix_len = 0;
+    length = p->length;
+    message = "";
+    created_timestamp = currentTime();
+    snapshot_timestamp = 0;//Snapshot time=0 indicates that it's not a snapshot
+    first_child = nullptr;
+    next_sibling = nullptr;
+    attachTo(p);
+}
+
+TreeNode::~TreeNode() {}//children are owned by the File's NodeArena, not by their parent
+
+bool TreeNode::isSnapshot() {
+    return snapshot_timestamp != 0;
+}
+
+void TreeNode::attachTo(TreeNode* p) {
+    parent = p;
+    depth = p->depth + 1;
+    //Skip two equal-length jumps with one, otherwise start over from the parent
+    TreeNode* j=p->jump;
+    jump = (p->depth - j->depth == j->depth - j->jump->depth) ? j->jump : p;
+}
+
+void TreeNode::addChild(TreeNode* child) {
+    child->next_sibling = first_child;
+    first_child = child;
+}
+
+TreeNode* TreeNode::ancestorAtDepth(int target_depth) {
+    if(target_depth<0 || target_depth>depth) return nullptr;
+    TreeNode* current=this;
+    while(current->depth>target_depth){
+        current = current->jump->depth>=target_depth ? current->jump : current->parent;
+    }
+    return current;
+}
+
+bool TreeNode::isAncestorOf(TreeNode* other) {
+    return other->ancestorAtDepth(depth)==this;
+}
+
+TreeNode* TreeNode::lowestCommonAncestor(TreeNode* a, TreeNode* b) {
+    if(a->depth>b->depth) a=a->ancestorAtDepth(b->depth);
+    else b=b->ancestorAtDepth(a->depth);
+    //Equal depths mean equal jump depths, so both sides can take the same steps
+    while(a!=b){
+        if(a->jump!=b->jump){
+            a=a->jump;
+            b=b->jump;
+        } else {
+            a=a->parent;
+            b=b->parent;
+        }
+    }
+    return a;
+}
+
+// NODE ARENA
+NodeArena::NodeArena(){}
+NodeArena::~NodeArena(){
+    FS_STAT(int64_t live=-(int64_t)free_nodes.size());
+    for(TreeNode* node : free_nodes) new (node) TreeNode(-1, string());//so every slot below is live
+    for(size_t i=0; i<slabs.size(); i++){
+        FS_STAT(live+=slabs[i].used);
+        for(size_t j=0; j<slabs[i].used; j++) slabs[i].nodes[j].~TreeNode();
+        ::operator delete(slabs[i].nodes);
+    }
+    FS_STAT(Stats::addNodes(-live));
+}
+TreeNode* NodeArena::allocate(){
+    FS_STAT(Stats::addNodes(1));
+    if(!free_nodes.empty()){
+        TreeNode* node=free_nodes.back();
+        free_nodes.pop_back();
+        return node;
+    }
+    if(slabs.empty() || slabs.back().used==slabs.back().capacity){
+        size_t capacity=slabs.empty() ? FIRST_SLAB : min(slabs.back().capacity*2, MAX_SLAB);
+        slabs.push_back({static_cast<TreeNode*>(::operator new(capacity*sizeof(TreeNode))), 0, capacity});
+    }
+    Slab& slab=slabs.back();
+    return &slab.nodes[slab.used++];
+}
+void NodeArena::destroy(TreeNode* node){
+    FS_STAT(Stats::addNodes(-1));
+    node->~TreeNode();
+    free_nodes.push_back(node);
+}
+
+// HASHING
+//Reads 8 bytes at a time and folds each word in with a 64x64->128 bit multiply, which
+//mixes far better than the old (hash*31+c)%capacity.
+static inline uint64_t foldMultiply(uint64_t a, uint64_t b){
+    __uint128_t product=(__uint128_t)a*b;
+    return (uint64_t)product^(uint64_t)(product>>64);
+}
+uint64_t hashBytes(const char* data, size_t len, uint64_t seed){
+    const uint64_t K1=0xa0761d6478bd642fULL, K2=0xe7037ed1a0b428dbULL;
+    uint64_t h=seed^K1^len;
+    size_t i=0;
+    for(; i+8<=len; i+=8){
+        uint64_t word;
+        memcpy(&word, data+i, 8);
+        h=foldMultiply(h^word, K2);
+    }
+    if(i<len){
+        uint64_t word=0;
+        memcpy(&word, data+i, len-i);
+        h=foldMultiply(h^word, K2);
+    }
+    return mixHash(h);
+}
+
+Hash128 hashBytes128(const char* data, size_t len){
+    //Two independent lanes over the same pass
+    const uint64_t K1=0xa0761d6478bd642fULL, K2=0xe7037ed1a0b428dbULL, K3=0x8ebc6af09c88c6e3ULL;
+    uint64_t a=K1^len, b=K3^(len*K2);
+    size_t i=0;
+    for(; i+8<=len; i+=8){
+        uint64_t word;
+        memcpy(&word, data+i, 8);
+        a=foldMultiply(a^word, K2);
+        b=foldMultiply(b^word, K1)+a;
+    }
+    if(i<len){
+        uint64_t word=0;
+        memcpy(&word, data+i, len-i);
+        a=foldMultiply(a^word, K2);
+        b=foldMultiply(b^word, K1)+a;
+    }
+    return Hash128{mixHash(a^b), mixHash(b+K3)};
+}
+
+// BLOBS
+Blob::Blob(string bytes, const Hash128& hash, bool interned)
+    : data(std::move(bytes)), hash(hash), refs(1), interned(interned), incompressible(false),
+      mapped(nullptr), length(data.size()), resident(data.data()), packed(nullptr),
+      last_used(BlobStore::instance().generation.load(memory_order_relaxed)) {}
+Blob::Blob(const char* mapped, size_t length, const Hash128& hash)
+    : hash(hash), refs(1), interned(true), incompressible(false), mapped(mapped), length(length),
+      resident(mapped), packed(nullptr), last_used(0) {}
+Blob::~Blob(){
+    const string* compressed=packed.load();
+    if(compressed){
+        delete[] resident.load();//a decompressed copy, if any
+        delete compressed;
+    }
+}
+string_view Blob::bytes(){
+    const char* bytes=resident.load(memory_order_acquire);
+    if(!bytes) bytes=BlobStore::instance().unpack(this);
+    return string_view(bytes, length);
+}
+
+BlobRef::BlobRef(Blob* b) : blob(b) {}
+BlobRef::BlobRef(const BlobRef& other) : blob(other.blob) {
+    if(blob){
+        BlobStore& store=BlobStore::instance();
+        lock_guard<mutex> guard(store.lock);
+        blob->refs++;
+        store.logical_bytes+=blob->size();
+    }
+}
+BlobRef& BlobRef::operator=(BlobRef other){
+    swap(blob, other.blob);
+    return *this;//the old blob is released by other's destructor
+}
+BlobRef::~BlobRef(){
+    if(!blob) return;
+    BlobStore& store=BlobStore::instance();
+    {
+        //Dropping the last reference and unlinking happen under one lock, so no other
+        //thread can find the blob in between.
+        lock_guard<mutex> guard(store.lock);
+        store.logical_bytes-=blob->size();
+        if(--blob->refs>0) return;
+        if(blob->interned) store.unlink(blob);
+        if(blob->mapped) store.mapped_bytes-=blob->size();
+        else store.physical_bytes-=blob->size();
+        if(const string* packed=blob->packed.load()){
+            store.compressed_bytes-=packed->size();
+            store.cold_bytes-=blob->size();
+            store.cold_blobs--;
+            if(blob->resident.load()) store.unpacked_bytes-=blob->size();
+        }
+    }
+    delete blob;
+}
+string_view BlobRef::view() const {
+    if(!blob) return string_view();
+    uint32_t now=BlobStore::instance().generation.load(memory_order_relaxed);
+    if(blob->last_used.load(memory_order_relaxed)!=now) blob->last_used.store(now, memory_order_relaxed);//keeps the blob hot
+    return blob->bytes();
+}
+void BlobRef::append(string_view content){
+    if(content.empty()) return;
+    BlobStore& store=BlobStore::instance();
+    Blob* grown;
+    {
+        lock_guard<mutex> guard(store.lock);
+        if(blob && blob->refs==1 && !blob->mapped && !blob->packed.load()){//sole owner: take it out of the store and grow it in place
+            if(blob->interned){
+                store.unlink(blob);
+                blob->interned=false;
+            }
+            blob->data.append(content.data(), content.size());
+            blob->length=blob->data.size();
+            blob->resident.store(blob->data.data());
+            store.logical_bytes+=content.size();
+            store.physical_bytes+=content.size();
+            return;
+        }
+        grown=new Blob(string(view()).append(content.data(), content.size()), Hash128{0, 0}, false);
+        store.logical_bytes+=grown->size();
+        store.physical_bytes+=grown->size();
+    }
+    *this=BlobRef(grown);//outside the lock: releasing the old blob takes it again
+}
+
+BlobStore::BlobStore()
+    : logical_bytes(0), physical_bytes(0), mapped_bytes(0), lookups(0), hits(0), generation(1),
+      compressed_bytes(0), cold_bytes(0), cold_blobs(0), unpacked_bytes(0) {}
+BlobStore::~BlobStore(){}
+BlobStore& BlobStore::instance(){
+    static BlobStore store;
+    return store;
+}
+Blob* BlobStore::find(const Hash128& hash, string_view content){
+    lookups++;
+    Blob* found=blobs.get(hash);
+    if(found && found->bytes()==content){//verify, so a hash collision can only cost a missed dedup
+        hits++;
+        return found;
+    }
+    return nullptr;
+}
+void BlobStore::unlink(Blob* blob){
+    if(blobs.get(blob->hash)==blob) blobs.erase(blob->hash);
+}
+BlobRef BlobStore::intern(string_view content){
+    if(content.empty()) return BlobRef();
+    Hash128 hash=hashBytes128(content.data(), content.size());
+    lock_guard<mutex> guard(lock);
+    Blob* blob=find(hash, content);
+    if(blob){
+        blob->refs++;
+    } else {
+        blob=new Blob(string(content), hash, !blobs.contains(hash));
+        if(blob->interned) blobs.insert(hash, blob);
+        physical_bytes+=content.size();
+    }
+    logical_bytes+=content.size();
+    return BlobRef(blob);
+}
+BlobRef BlobStore::lookup(string_view content){
+    if(content.empty()) return BlobRef();
+    Hash128 hash=hashBytes128(content.data(), content.size());
+    lock_guard<mutex> guard(lock);
+    Blob* blob=find(hash, content);
+    if(!blob) return BlobRef();
+    blob->refs++;
+    logical_bytes+=content.size();
+    return BlobRef(blob);
+}
+void BlobStore::freeze(BlobRef& ref){
+    Blob* blob=ref.get();
+    if(!blob || blob->interned) return;
+    string_view bytes=blob->bytes();//still private to ref, so never packed
+    blob->hash=hashBytes128(bytes.data(), bytes.size());
+    BlobRef existing_ref;
+    {
+        lock_guard<mutex> guard(lock);
+        Blob* existing=find(blob->hash, bytes);
+        if(existing){
+            existing->refs++;
+            logical_bytes+=existing->size();
+            existing_ref=BlobRef(existing);
+        } else if(!blobs.contains(blob->hash)){
+            blob->interned=true;
+            blobs.insert(blob->hash, blob);
+        }
+    }
+    if(existing_ref.get()) ref=std::move(existing_ref);//releases the private copy
+}
+double BlobStore::dedupRatio(){
+    size_t held=physical_bytes+mapped_bytes;
+    return held ? (double)logical_bytes/held : 1.0;
+}
+BlobRef BlobStore::adopt(const char* bytes, size_t size, const Hash128& hash){
+    if(size==0) return BlobRef();
+    //The hash was recorded when the content was saved, so the bytes are not touched
+    //here; a 128-bit match is taken as equality.
+    lock_guard<mutex> guard(lock);
+    Blob* blob=blobs.get(hash);
+    if(blob){
+        blob->refs++;
+    } else {
+        blob=new Blob(bytes, size, hash);
+        blobs.insert(hash, blob);
+        mapped_bytes+=size;
+    }
+    logical_bytes+=size;
+    return BlobRef(blob);
+}
+void BlobStore::printStats(){
+    lock_guard<mutex> guard(lock);
+    cout<<"Content store:"<<'\n';
+    cout<<"  Unique blobs: "<<blobs.size()<<'\n';
+    cout<<"  Logical bytes: "<<logical_bytes<<'\n';
+    cout<<"  Physical bytes: "<<physical_bytes<<'\n';
+    cout<<"  Mapped bytes: "<<mapped_bytes<<'\n';
+    cout<<"  Resident bytes: "<<physical_bytes-cold_bytes+unpacked_bytes<<'\n';
+    cout<<"  Compressed bytes: "<<compressed_bytes<<" ("<<cold_blobs<<" cold blobs holding "<<cold_bytes<<" bytes)"<<'\n';
+    cout<<"  Dedup ratio: "<<dedupRatio()<<'\n';
+    cout<<"  Dedup hits: "<<hits<<" of "<<lookups<<" lookups"<<'\n';
+}
+
+// COLD TIER
+const char* BlobStore::unpack(Blob* blob){
+    char* copy=new char[blob->length];
+    if(!decompressBlock(*blob->packed.load(), copy, blob->length)){
+        cerr<<"Error: compressed blob is corrupt."<<'\n';
+        abort();
+    }
+    const char* expected=nullptr;
+    if(!blob->resident.compare_exchange_strong(expected, copy)){
+        delete[] copy;//another reader unpacked it first
+        return expected;
+    }
+    unpacked_bytes+=blob->length;
+    return copy;
+}
+// A blob is cold when no read has stamped it since the previous pass, i.e. for a whole
+// window. Packing runs outside the store lock on blobs pinned by a reference; the
+// result is installed only if the blob is still cold, and only if it saves an eighth.
+size_t BlobStore::compressCold(){
+    lock_guard<mutex> pass(tier_lock);
+    uint32_t g=generation.fetch_add(1);
+    vector<Blob*> pinned;
+    vector<const char*> dropped;
+    {
+        lock_guard<mutex> guard(lock);
+        for(const Hash128& hash : blobs.keys()){
+            Blob* blob=blobs.get(hash);
+            if(blob->last_used.load(memory_order_relaxed)>=g) continue;
+            if(blob->packed.load()){
+                const char* copy=blob->resident.exchange(nullptr);
+                if(copy){
+                    unpacked_bytes-=blob->length;
+                    dropped.push_back(copy);
+                }
+            } else if(!blob->mapped && !blob->incompressible && blob->length>=MIN_COLD_BLOB && blob->refs>=2){
+                //A single holder may still be appending to it in place
+                blob->refs++;
+                logical_bytes+=blob->length;
+                pinned.push_back(blob);
+            }
+        }
+    }
+    //Wrapped and retired outside the store lock, which BlobRef copies and retire() may need
+    vector<BlobRef> candidates;
+    candidates.reserve(pinned.size());
+    for(Blob* blob : pinned) candidates.emplace_back(blob);
+    EpochManager& epochs=EpochManager::instance();
+    for(const char* copy : dropped) epochs.retire((void*)copy, [](void* p){ delete[] static_cast<char*>(p); });
+
+    vector<string> packed(candidates.size());
+    {
+        EpochGuard pin;
+        for(size_t i=0; i<candidates.size(); i++) packed[i]=compressBlock(candidates[i].get()->bytes());
+    }
+    size_t count=0;
+    vector<string*> released;
+    {
+        lock_guard<mutex> guard(lock);
+        for(size_t i=0; i<candidates.size(); i++){
+            Blob* blob=candidates[i].get();
+            if(blob->last_used.load(memory_order_relaxed)>=g) continue;//read in the meantime
+            if(packed[i].size()>blob->length-blob->length/8){
+                blob->incompressible=true;
+                continue;
+            }
+            compressed_bytes+=packed[i].size();
+            cold_bytes+=blob->length;
+            cold_blobs++;
+            blob->packed.store(new string(std::move(packed[i])));
+            blob->resident.store(nullptr);
+            released.push_back(new string(std::move(blob->data)));
+            count++;
+        }
+    }
+    for(string* bytes : released) epochs.retire(bytes);
+    return count;
+}
+size_t BlobStore::residentBytes(){
+    lock_guard<mutex> guard(lock);
+    return physical_bytes-cold_bytes+unpacked_bytes;
+}
+size_t BlobStore::compressedBytes(){
+    lock_guard<mutex> guard(lock);
+    return compressed_bytes;
+}
+
+// ROPES
+Rope::Rope(const BlobRef& blob) : root(makeLeaf(blob, 0, blob.size())) {}
+void Rope::release(RopeNode* node){
+    if(!node || --node->refs>0) return;
+    release(node->left);//recursion is bounded by the height, O(log n)
+    release(node->right);
+    delete node;
+}
+RopeNode* Rope::makeLeaf(const BlobRef& blob, size_t offset, size_t length){
+    if(length==0) return nullptr;
+    return new RopeNode{nullptr, nullptr, blob, offset, length, 0, 1};
+}
+RopeNode* Rope::makeBranch(RopeNode* left, RopeNode* right){
+    retain(left);
+    retain(right);
+    return new RopeNode{left, right, BlobRef(), 0, left->length+right->length, max(left->height, right->height)+1, 1};
+}
+//One single or double rotation, as in AVL insertion
+RopeNode* Rope::balance(RopeNode* left, RopeNode* right){
+    RopeNode *a, *b, *result;
+    if(height(right)>height(left)+1){
+        if(height(right->right)>=height(right->left)){
+            a=makeBranch(left, right->left);
+            result=makeBranch(a, right->right);
+            release(a);
+            return result;
+        }
+        a=makeBranch(left, right->left->left);
+        b=makeBranch(right->left->right, right->right);
+    } else if(height(left)>height(right)+1){
+        if(height(left->left)>=height(left->right)){
+            a=makeBranch(left->right, right);
+            result=makeBranch(left->left, a);
+            release(a);
+            return result;
+        }
+        a=makeBranch(left->left, left->right->left);
+        b=makeBranch(left->right->right, right);
+    } else {
+        return makeBranch(left, right);
+    }
+    result=makeBranch(a, b);
+    release(a);
+    release(b);
+    return result;
+}
+//Descends the taller side until the heights are within one, so the cost is the height
+//difference and only that spine is copied.
+RopeNode* Rope::join(RopeNode* left, RopeNode* right){
+    if(!left || !right){
+        RopeNode* only=left ? left : right;
+        retain(only);
+        return only;
+    }
+    RopeNode *inner, *result;
+    if(left->height>right->height+1){
+        inner=join(left->right, right);
+        result=balance(left->left, inner);
+    } else if(right->height>left->height+1){
+        inner=join(left, right->left);
+        result=balance(inner, right->right);
+    } else {
+        return makeBranch(left, right);
+    }
+    release(inner);
+    return result;
+}
+RopeNode* Rope::slice(RopeNode* node, size_t start, size_t length){
+    if(length==0) return nullptr;
+    if(start==0 && length==node->length){
+        retain(node);
+        return node;
+    }
+    if(!node->left) return makeLeaf(node->blob, node->offset+start, length);
+    size_t left_length=node->left->length;
+    if(start+length<=left_length) return slice(node->left, start, length);
+    if(start>=left_length) return slice(node->right, start-left_length, length);
+    RopeNode* left=slice(node->left, start, left_length-start);
+    RopeNode* right=slice(node->right, 0, start+length-left_length);
+    RopeNode* result=join(left, right);
+    release(left);
+    release(right);
+    return result;
+}
+Rope Rope::substr(size_t start, size_t length) const {
+    if(start>=size()) return Rope();
+    return Rope(slice(root, start, min(length, size()-start)));
+}
+//Two short leaves meeting at the seam are copied into one, so a history of small
+//appends does not leave a rope of one tiny leaf per version.
+Rope Rope::concat(const Rope& left, const Rope& right){
+    RopeNode* last=left.root;
+    while(last && last->right) last=last->right;
+    RopeNode* first=right.root;
+    while(first && first->left) first=first->left;
+    if(!last || !first || last->length+first->length>SMALL_LEAF){
+        return Rope(join(left.root, right.root));
+    }
+    BlobRef bytes;
+    EpochGuard pin;
+    bytes.append(last->blob.view().substr(last->offset, last->length));
+    bytes.append(first->blob.view().substr(first->offset, first->length));
+    RopeNode* head=slice(left.root, 0, left.size()-last->length);
+    RopeNode* merged=makeLeaf(bytes, 0, bytes.size());
+    RopeNode* tail=slice(right.root, first->length, right.size()-first->length);
+    RopeNode* joined=join(head, merged);
+    RopeNode* result=join(joined, tail);
+    release(head);
+    release(merged);
+    release(tail);
+    release(joined);
+    return Rope(result);
+}
+string Rope::flatten() const {
+    string result;
+    result.reserve(size());
+    forEachPiece([&](string_view piece){
+        result.append(piece.data(), piece.size());
+        return true;
+    });
+    return result;
+}
+
+// FILE
+File::File(FileLayout layout, TreeSource* source, size_t index, int total_versions) : layout(layout) {
+    this->total_versions=total_versions;
+    changes=0;
+    id=-1;
+    slot=-1;
+    committed_version=0;
+    tree_source=source;
+    source_index=index;
+    root=nullptr;
+    active_version=nullptr;
+}
+File::~File() {}//arena frees every node
+template <typename Policies>
+BasicFile<Policies>::BasicFile(string initial_message) : File(LAYOUT, nullptr, 0, 1) {
+    root=arena.create(0, initial_message);
+    active_version=root;
+    version_map.insert(0, root);
+    published.publish(root);
+    if constexpr(Times::INDEXED) snapshot_times.add(root->snapshot_timestamp, 0);
+}
+template <typename Policies>
+BasicFile<Policies>::BasicFile(TreeSource* source, size_t index, int total_versions)
+    : File(LAYOUT, source, index, total_versions) {}
+template <typename Policies>
+void BasicFile<Policies>::loadTree(ostream& err){
+    TreeSource* source=tree_source;
+    tree_source=nullptr;
+    source->buildTree(*this, source_index, err);
+    for(int id=0; id<total_versions; id++){//a parent's id is always smaller than its children's
+        TreeNode* node=version_map.get(id);
+        if(node && node->isSnapshot()){
+            node->content=buildContent(node);
+            published.publish(node);
+            if constexpr(Times::INDEXED) snapshot_times.add(node->snapshot_timestamp, id);
+        }
+    }
+}
+template <typename Policies>
+TreeNode* BasicFile<Policies>::addVersion(int version_id, TreeNode* parent, string message){
+    TreeNode* node;
+    if(parent){
+        node=arena.create(version_id, parent);
+        parent->addChild(node);
+        node->message=std::move(message);
+    } else {
+        node=arena.create(version_id, message);
+        root=node;
+    }
+    version_map.insert(version_id, node);
+    return node;
+}
+template <typename Policies>
+void BasicFile<Policies>::createNewVersion(){
+    TreeNode* new_node=arena.create(total_versions, active_version);
+    active_version->addChild(new_node);
+    active_version=new_node;
+    version_map.insert(new_node->version_id, new_node);
+    total_versions++;
+    changes++;
+}
+template <typename Policies>
+void BasicFile<Policies>::updateTime(){
+    changes++;
+    if(active_version){
+        active_version->created_timestamp=currentTime();
+    }
+}
+template <typename Policies>
+Rope BasicFile<Policies>::buildContent(TreeNode* node){
+    Rope edit(node->data);
+    if(node->is_keyframe) return edit;
+    const Rope& base=node->parent->content;//parents are snapshots, so theirs is built
+    return Rope::concat(Rope::concat(base.substr(0, node->prefix_len), edit),
+                        base.substr(base.size()-node->suffix_len, node->suffix_len));
+}
+template <typename Policies>
+Rope BasicFile<Policies>::contentOf(TreeNode* node){
+    return node->isSnapshot() ? node->content : buildContent(node);
+}
+//Length of the common prefix of a rope and text, compared piece by piece.
+static size_t commonPrefixLength(const Rope& rope, string_view text){
+    size_t matched=0;
+    rope.forEachPiece([&](string_view piece){
+        size_t n=min(piece.size(), text.size()-matched);
+        size_t same=commonPrefixLength(piece.data(), text.data()+matched, n);
+        matched+=same;
+        return same==piece.size() && matched<text.size();
+    });
+    return matched;
+}
+static size_t commonSuffixLength(const Rope& rope, string_view text, size_t limit){
+    size_t matched=0;
+    rope.forEachPieceReverse([&](string_view piece){
+        size_t n=min(piece.size(), limit-matched);
+        size_t same=commonSuffixLength(piece.data()+piece.size(), text.data()+text.size()-matched, n);
+        matched+=same;
+        return same==piece.size() && matched<limit;
+    });
+    return matched;
+}
+//Stores content for a (non-snapshot) node. With DeltaContent, content already in the blob
+//store is referenced as a keyframe for free; otherwise only the part that differs from the
+//parent is stored, and the rest is shared with the parent's rope. The other policies
+//always store a keyframe.
+template <typename Policies>
+void BasicFile<Policies>::setContent(TreeNode* node, string_view content){
+    BlobStore& store=BlobStore::instance();
+    node->length=content.size();
+    if constexpr(!Content::DELTAS){
+        node->is_keyframe=true;
+        node->prefix_len=0;
+        node->suffix_len=0;
+        if constexpr(Content::SHARED){
+            node->data=store.intern(content);
+        } else {
+            node->data=BlobRef();
+            node->data.append(content);
+        }
+        search_index.mark(node->version_id, 0, content.size());
+        return;
+    }
+    BlobRef existing=store.lookup(content);
+    if(!existing.empty() || !node->parent){
+        node->is_keyframe=true;
+        node->prefix_len=0;
+        node->suffix_len=0;
+        node->data=existing.empty() ? store.intern(content) : existing;
+        search_index.mark(node->version_id, 0, content.size());
+        return;
+    }
+    const Rope& base=node->parent->content;
+    size_t prefix=commonPrefixLength(base, content);
+    size_t suffix=commonSuffixLength(base, content, min(base.size(), content.size())-prefix);
+    node->is_keyframe=false;
+    node->prefix_len=prefix;
+    node->suffix_len=suffix;
+    node->data=store.intern(content.substr(prefix, content.size()-prefix-suffix));
+    search_index.mark(node->version_id, prefix-min(prefix, (size_t)2), content.size()-suffix+min(suffix, (size_t)2));
+}
+//Small pieces are gathered into a buffer, so a rope of many short appends costs a few
+//stream writes rather than one per piece.
+void File::printContent(ostream& out, int version_id, const Rope& content){
+    out<<"Content of file (version "<<version_id<<"):"<<'\n';
+    char buffer[16384];
+    size_t used=0;
+    content.forEachPiece([&](string_view piece){
+        bool large=piece.size()>sizeof(buffer)/4;
+        if(large || used+piece.size()>sizeof(buffer)){
+            out.write(buffer, used);
+            used=0;
+        }
+        if(large){
+            out.write(piece.data(), piece.size());
+        } else {
+            memcpy(buffer+used, piece.data(), piece.size());
+            used+=piece.size();
+        }
+        return true;
+    });
+    out.write(buffer, used);
+    out<<'\n';
+}
+void File::ensureLoaded() {
+    ensureLoaded(cerr);
+}
+void File::read() {
+    read(cout, cerr);
+}
+template <typename Policies>
+void BasicFile<Policies>::read(ostream& out, ostream& err) {
+    ensureLoaded(err);
+    if(active_version) {
+        printContent(out, active_version->version_id, contentOf(active_version));
+    } else {
+        err<<"Error: No active version to read."<<'\n';
+    }
+}
+template <typename Policies>
+void BasicFile<Policies>::read(int version_id) {
+    ensureLoaded();
+    TreeNode* node=version_map.get(version_id);
+    if(node) {
+        printContent(cout, version_id, contentOf(node));
+    } else {
+        cerr<<"Error: Version ID "<<version_id<<" not found."<<'\n';
+    }
+}
+bool File::readSnapshot(int version_id) {
+    EpochGuard guard;//before the lookup: PRUNE frees unpublished nodes once no pin predates it
+    TreeNode* node=published.get(version_id);
+    if(!node) return false;
+    printContent(cout, version_id, node->content);//by reference: readers never touch reference counts
+    return true;
+}
+template <typename Policies>
+void BasicFile<Policies>::insert(string_view content) {
+    ensureLoaded();
+    if(!active_version){
+        cerr<<"Error: No active version to modify."<<'\n';
+        return;
+    }
+    if(active_version->isSnapshot()){
+        createNewVersion();
+    }
+    TreeNode* node=active_version;
+    if(!Content::DELTAS && !node->is_keyframe){//a new version starts as a delta: write out its whole content
+        string whole=buildContent(node).flatten();
+        node->data=BlobRef();
+        node->data.append(whole);
+        node->is_keyframe=true;
+        node->prefix_len=0;
+        node->suffix_len=0;
+        search_index.mark(node->version_id, 0, node->length);
+    }
+    if(node->suffix_len>0){//the edit ends inside the parent's content: take that tail into it
+        string middle;
+        {
+            EpochGuard pin;
+            middle=node->data.view();
+        }
+        middle+=node->parent->content.substr(node->parent->length-node->suffix_len, node->suffix_len).flatten();
+        node->data=BlobRef();
+        node->data.append(middle);
+        node->suffix_len=0;
+    }
+    search_index.mark(node->version_id, node->length-min(node->length, (size_t)2), node->length+content.size());
+    node->data.append(content); // allow empty content; grows in place while nothing else holds it
+    node->length+=content.size();
+    updateTime();
+}
+template <typename Policies>
+void BasicFile<Policies>::update(string_view content) {
+    ensureLoaded();
+    if(!active_version) {
+        cerr<<"Error: No active version to modify."<<'\n';
+        return;
+    }
+    if(active_version->isSnapshot()) {
+        createNewVersion();
+    }
+    setContent(active_version, content); // allow empty content
+    updateTime();
+}
+void File::snapshot(string_view msg) {
+    snapshot(msg, cout, cerr);
+}
+template <typename Policies>
+void BasicFile<Policies>::snapshot(string_view msg, ostream& out, ostream& err) {
+    ensureLoaded(err);
+    if(!active_version) {
+        err<<"Error: No active version to snapshot."<<'\n';
+        return;
+    }
+    if(active_version->isSnapshot()) {
+        out<<"Version ID "<<active_version->version_id<<" is already a snapshot."<<'\n';
+    } else {
+        active_version->snapshot_timestamp=currentTime();
+        if constexpr(Content::SHARED) BlobStore::instance().freeze(active_version->data);//content is immutable from here on
+        active_version->content=buildContent(active_version);
+        active_version->message.assign(msg.data(), msg.size()); // allow empty message
+        published.publish(active_version);//after every content field is final
+        if constexpr(Times::INDEXED) snapshot_times.add(active_version->snapshot_timestamp, active_version->version_id);
+        out<<"Snapshot created for version ID "<<active_version->version_id<<'\n';
+    }
+    updateTime();
+}
+template <typename Policies>
+bool BasicFile<Policies>::setActive(int version_id){
+    ensureLoaded();
+    TreeNode* target_version = version_map.get(version_id);
+    if(!target_version) return false;
+    active_version=target_version;
+    changes++;
+    if(BlobStore::instance().anyCold()){//unpack it now rather than in the next command
+        contentOf(target_version).forEachPiece([](string_view){ return true; });
+    }
+    return true;
+}
+void File::rollback(int version_id) {
+    if(setActive(version_id)){
+        cout<<"Successfully rolled back to version ID "<<version_id<<"."<<'\n';
+    } else {
+        cerr<<"Error: Version ID "<<version_id<<" not found."<<'\n';
+    }
+}
+void File::rollbackToParent() {
+    ensureLoaded();
+    if (active_version && active_version->parent){
+        active_version=active_version->parent;
+        changes++;
+        cout<<"Rolled back to parent version ID "<<active_version->version_id<<"."<<'\n';
+    } else {
+        cerr<<"Error: Cannot roll back. No parent version found."<<'\n';
+    }
+}
+//Every proper ancestor of a node is a snapshot (only snapshots have children), so the
+//i-th snapshot on the path to the active version is simply its ancestor at depth i.
+static void printSnapshots(TreeNode* last, int count) {
+    vector<TreeNode*> snapshots;
+    snapshots.reserve(count);
+    for(TreeNode* current=last; (int)snapshots.size()<count; current=current->parent){
+        snapshots.push_back(current);
+    }
+    for(int i = snapshots.size() - 1; i >= 0; --i){
+        TreeNode* snapshot=snapshots[i];
+        cout <<"  - ID: "<< snapshot->version_id 
+             <<", Time: "<< formatTime(snapshot->snapshot_timestamp)
+             <<", Message: \""<< snapshot->message << "\""<<'\n';
+    }
+}
+void File::history() {
+    ensureLoaded();
+    cout<<"Snapshot history for file:"<<'\n';
+    if(!active_version) return;
+    int total=active_version->depth+(active_version->isSnapshot() ? 1 : 0);
+    if(total>0) printSnapshots(active_version->ancestorAtDepth(total-1), total);
+}
+void File::history(int offset, int count) {
+    ensureLoaded();
+    cout<<"Snapshot history for file:"<<'\n';
+    if(!active_version) return;
+    int total=active_version->depth+(active_version->isSnapshot() ? 1 : 0);
+    int first=min(offset, total);
+    int last=(int)min((long long)total, (long long)first+count);
+    if(last<=first){
+        cout<<"No snapshots from "<<first+1<<" on; there are "<<total<<"."<<'\n';
+        return;
+    }
+    printSnapshots(active_version->ancestorAtDepth(last-1), last-first);
+    cout<<"Showing snapshots "<<first+1<<"-"<<last<<" of "<<total<<"."<<'\n';
+}
+template <typename Policies>
+void BasicFile<Policies>::ancestor(int version_id, int k) {
+    ensureLoaded();
+    TreeNode* node=version_map.get(version_id);
+    if(!node){
+        cerr<<"Error: Version ID "<<version_id<<" not found."<<'\n';
+        return;
+    }
+    TreeNode* found=node->ancestorAtDepth(node->depth-k);
+    if(found) cout<<"Ancestor "<<k<<" of version ID "<<version_id<<" is version ID "<<found->version_id<<"."<<'\n';
+    else cerr<<"Error: Version ID "<<version_id<<" has only "<<node->depth<<" ancestors."<<'\n';
+}
+template <typename Policies>
+void BasicFile<Policies>::lowestCommonAncestor(int version1, int version2) {
+    ensureLoaded();
+    TreeNode* a=version_map.get(version1);
+    TreeNode* b=version_map.get(version2);
+    if(!a || !b){
+        cerr<<"Error: Version ID "<<(a ? version2 : version1)<<" not found."<<'\n';
+        return;
+    }
+    cout<<"Lowest common ancestor of version IDs "<<version1<<" and "<<version2<<" is version ID "
+        <<TreeNode::lowestCommonAncestor(a, b)->version_id<<"."<<'\n';
+}
+template <typename Policies>
+void BasicFile<Policies>::isAncestor(int version1, int version2) {
+    ensureLoaded();
+    TreeNode* a=version_map.get(version1);
+    TreeNode* b=version_map.get(version2);
+    if(!a || !b){
+        cerr<<"Error: Version ID "<<(a ? version2 : version1)<<" not found."<<'\n';
+        return;
+    }
+    cout<<"Version ID "<<version1<<(a->isAncestorOf(b) ? " is" : " is not")<<" an ancestor of version ID "<<version2<<"."<<'\n';
+}
+template <typename Policies>
+TreeNode* BasicFile<Policies>::snapshotAt(Stamp time) {
+    ensureLoaded();
+    if constexpr(!Times::INDEXED){
+        TreeNode* best=nullptr;
+        for(int id=0; id<total_versions; id++){
+            TreeNode* node=version_map.get(id);
+            if(node && node->isSnapshot() && node->snapshot_timestamp<=time
+               && (!best || node->snapshot_timestamp>=best->snapshot_timestamp)) best=node;
+        }
+        return best;
+    }
+    int version_id=snapshot_times.atOrBefore(time);
+    return version_id<0 ? nullptr : version_map.get(version_id);
+}
+void File::readAt(Stamp time) {
+    TreeNode* node=snapshotAt(time);
+    if(node) {
+        printContent(cout, node->version_id, node->content);
+    } else {
+        cerr<<"Error: File has no snapshot at or before "<<formatTime(time)<<"."<<'\n';
+    }
+}
+
+//CONTENT SEARCH
+template <typename Policies>
+void BasicFile<Policies>::postRange(int version_id, const Rope& content, size_t start, size_t end){
+    end=min(end, content.size());
+    if(start>=end) return;
+    string carry;//the last two bytes of the previous piece, for trigrams across the seam
+    content.substr(start, end-start).forEachPiece([&](string_view piece){
+        if(!carry.empty()) search_index.post(version_id, carry+string(piece.substr(0, 2)));
+        search_index.post(version_id, piece);
+        if(piece.size()>=2){
+            carry.assign(piece.substr(piece.size()-2));
+        } else {
+            carry.append(piece);
+            if(carry.size()>2) carry.erase(0, carry.size()-2);
+        }
+        return true;
+    });
+}
+template <typename Policies>
+void BasicFile<Policies>::catchUpSearchIndex(){
+    if(!search_index.isBuilt()){
+        for(int id=0; id<total_versions; id++){
+            TreeNode* node=version_map.get(id);
+            if(!node) continue;
+            size_t before=min(node->prefix_len, (size_t)2), after=min(node->suffix_len, (size_t)2);
+            postRange(id, contentOf(node), node->prefix_len-before, node->length-node->suffix_len+after);
+        }
+        search_index.markBuilt();
+        return;
+    }
+    for(const TrigramIndex::Range& range : search_index.takePending()){
+        TreeNode* node=version_map.get(range.version_id);
+        if(node) postRange(range.version_id, contentOf(node), range.start, range.end);
+    }
+}
+void TrigramIndex::post(int version_id, string_view text){
+    int last_trigram=-1;
+    for(size_t i=0; i+3<=text.size(); i++){
+        int t=trigram(text.data()+i);
+        if(t==last_trigram) continue;//runs of one byte
+        vector<int>* list=postings.find(t);
+        if(!list){
+            postings.insert(t, vector<int>());
+            list=postings.find(t);
+        }
+        if(list->empty() || list->back()!=version_id) list->push_back(version_id);
+        last_trigram=t;
+    }
+}
+// First occurrence of pattern in content, or npos. Matches across piece seams are found
+// by searching the last pattern-1 bytes of the text so far joined to the next piece's start.
+static size_t findInRope(const Rope& content, string_view pattern){
+    size_t found=string_view::npos, offset=0;
+    string carry;
+    content.forEachPiece([&](string_view piece){
+        if(!carry.empty()){
+            string joint=carry+string(piece.substr(0, pattern.size()-1));
+            size_t at=findSubstring(joint, pattern);
+            if(at!=string_view::npos){
+                found=offset-carry.size()+at;
+                return false;
+            }
+        }
+        size_t at=findSubstring(piece, pattern);
+        if(at!=string_view::npos){
+            found=offset+at;
+            return false;
+        }
+        carry+=piece.substr(piece.size()-min(piece.size(), pattern.size()-1));
+        if(carry.size()>pattern.size()-1) carry.erase(0, carry.size()-(pattern.size()-1));
+        offset+=piece.size();
+        return true;
+    });
+    return found;
+}
+// The line around content[start, start+length), cut to LINE_CONTEXT bytes either side.
+static string lineAround(const Rope& content, size_t start, size_t length){
+    static constexpr size_t LINE_CONTEXT = 80;
+    size_t from=start-min(start, LINE_CONTEXT);
+    string text=content.substr(from, start-from+length+LINE_CONTEXT).flatten();
+    size_t match=start-from;
+    size_t begin=text.rfind('\n', match==0 ? 0 : match-1);
+    begin=(begin==string::npos || begin>=match) ? 0 : begin+1;
+    size_t end=text.find('\n', match+length);
+    string line=text.substr(begin, end==string::npos ? string::npos : end-begin);
+    if(begin==0 && from>0) line="..."+line;
+    if(end==string::npos && from+text.size()<content.size()) line+="...";
+    return line;
+}
+template <typename Policies>
+size_t BasicFile<Policies>::grep(string_view pattern, vector<GrepMatch>& matches){
+    ensureLoaded();
+    catchUpSearchIndex();
+    vector<uint64_t> covered(total_versions, 0);//bit j: some version on the path posts trigram j
+    uint64_t wanted=0;
+    if(pattern.size()>=3){
+        vector<pair<size_t, const vector<int>*>> lists;
+        for(size_t i=0; i+3<=pattern.size(); i++){
+            const vector<int>* list=search_index.find(TrigramIndex::trigram(pattern.data()+i));
+            if(!list) return 0;//no version has this trigram
+            lists.emplace_back(list->size(), list);
+        }
+        sort(lists.begin(), lists.end());
+        lists.erase(unique(lists.begin(), lists.end()), lists.end());
+        if(lists.size()>64) lists.resize(64);//the rarest; the rest is left to verification
+        for(size_t j=0; j<lists.size(); j++){
+            for(int id : *lists[j].second){
+                if(id<total_versions) covered[id]|=uint64_t(1)<<j;
+            }
+        }
+        wanted=lists.size()==64 ? ~uint64_t(0) : (uint64_t(1)<<lists.size())-1;
+    }
+    vector<size_t> first_end(total_versions, 0);//end of the first match, 0 if none
+    size_t scanned=0;
+    for(int id=0; id<total_versions; id++){
+        TreeNode* node=version_map.get(id);
+        if(!node) continue;
+        TreeNode* parent=node->parent;
+        if(parent) covered[id]|=covered[parent->version_id];
+        if((covered[id] & wanted)!=wanted) continue;
+        Rope content=contentOf(node);
+        size_t inherited=parent && !node->is_keyframe ? first_end[parent->version_id] : 0;
+        if(inherited>0 && inherited<=node->prefix_len){
+            first_end[id]=inherited;
+        } else {
+            scanned++;
+            size_t at=findInRope(content, pattern);
+            if(at==string_view::npos) continue;
+            first_end[id]=at+pattern.size();
+        }
+        matches.push_back({id, lineAround(content, first_end[id]-pattern.size(), pattern.size())});
+    }
+    return scanned;
+}
+
+template <typename Policies>
+void BasicFile<Policies>::diff(int version1, int version2) {
+    ensureLoaded();
+    TreeNode* a=version_map.get(version1);
+    TreeNode* b=version_map.get(version2);
+    if(!a || !b){
+        cerr<<"Error: Version ID "<<(a ? version2 : version1)<<" not found."<<'\n';
+        return;
+    }
+    string old_content=contentOf(a).flatten();
+    string new_content=contentOf(b).flatten();
+    vector<DiffHunk> hunks=diffLines(old_content, new_content);
+    vector<string_view> old_lines=splitLines(old_content), new_lines=splitLines(new_content);
+    auto text=[](string_view line){ return line.substr(0, line.size()-(line.back()=='\n')); };
+    size_t removed=0, added=0;
+    cout<<"Diff from version ID "<<version1<<" to version ID "<<version2<<":"<<'\n';
+    for(const DiffHunk& hunk : hunks){
+        cout<<"@@ -"<<hunk.old_start+1<<","<<hunk.old_count<<" +"<<hunk.new_start+1<<","<<hunk.new_count<<" @@"<<'\n';
+        for(size_t i=0; i<hunk.old_count; i++) cout<<"-"<<text(old_lines[hunk.old_start+i])<<'\n';
+        for(size_t i=0; i<hunk.new_count; i++) cout<<"+"<<text(new_lines[hunk.new_start+i])<<'\n';
+        removed+=hunk.old_count;
+        added+=hunk.new_count;
+    }
+    cout<<hunks.size()<<" hunks, "<<removed<<" lines removed, "<<added<<" lines added."<<'\n';
+}
+
+template <typename Policies>
+void BasicFile<Policies>::merge(int version1, int version2) {
+    ensureLoaded();
+    TreeNode* ours=version_map.get(version1);
+    TreeNode* theirs=version_map.get(version2);
+    if(!ours || !theirs){
+        cerr<<"Error: Version ID "<<(ours ? version2 : version1)<<" not found."<<'\n';
+        return;
+    }
+    if(!ours->isSnapshot()){
+        cerr<<"Error: Version ID "<<version1<<" is not a snapshot; only snapshots can have children."<<'\n';
+        return;
+    }
+    TreeNode* base=TreeNode::lowestCommonAncestor(ours, theirs);
+    MergeResult merged=mergeLines(contentOf(base).flatten(), contentOf(ours).flatten(), contentOf(theirs).flatten(),
+                                  "version "+to_string(version1), "version "+to_string(version2));
+    active_version=ours;
+    createNewVersion();
+    setContent(active_version, merged.content);
+    cout<<"Merged version ID "<<version2<<" into version ID "<<version1<<" (base version ID "<<base->version_id
+        <<") as version ID "<<active_version->version_id;
+    if(merged.conflicts>0) cout<<", "<<merged.conflicts<<" conflict(s) marked";
+    cout<<"."<<'\n';
+}
+
+//Marks what to keep, newest id first so KEEP_LAST counts back from the newest snapshot.
+//Then, oldest first (parents have smaller ids), finds each node's nearest kept ancestor
+//and composes edits along the dropped nodes: a prefix shared with the parent and the
+//parent's with the grandparent is shared with the grandparent, up to the shorter one.
+//Only the kept nodes whose parent is dropped need new edit data. Nothing visible
+//changes here; a plan the file changed under is started over.
+template <typename Policies>
+bool BasicFile<Policies>::prunePlan(PruneJob& job, chrono::steady_clock::time_point deadline){
+    ensureLoaded();
+    if(job.stage!=PruneJob::START && job.changes!=changes){
+        job.stage=PruneJob::START;
+        job.attempts++;
+    }
+    bool bounded=job.attempts<PRUNE_ATTEMPTS;//rather than starve under a steady stream of writes
+    size_t steps=0;
+    auto expired=[&](){ return bounded && (++steps & 63)==0 && chrono::steady_clock::now()>=deadline; };
+    if(job.stage==PruneJob::START){
+        job.changes=changes;
+        job.links.clear();
+        job.links.reserve(total_versions);
+        job.kept.clear();
+        job.dropped.clear();
+        job.relinks.clear();
+        job.snapshots_seen=0;
+        job.cursor=total_versions-1;
+        job.stage=PruneJob::MARK;
+    }
+    if(job.stage==PruneJob::MARK){
+        for(; job.cursor>=0; job.cursor--){
+            if(expired()) return false;
+            TreeNode* node=version_map.get(job.cursor);
+            job.links.push_back(PruneJob::Link{false, nullptr, 0, 0});
+            if(!node) continue;
+            bool keep=node==root || node==active_version || binary_search(job.pinned.begin(), job.pinned.end(), job.cursor);
+            if(job.policy.kind==PrunePolicy::KEEP_LAST){
+                if(node->isSnapshot() && node!=root && ++job.snapshots_seen<=job.policy.value) keep=true;
+            } else if((node->isSnapshot() ? node->snapshot_timestamp : node->created_timestamp)>=job.policy.value){
+                keep=true;
+            }
+            job.links.back().keep=keep;
+        }
+        job.cursor=0;
+        job.stage=PruneJob::LINK;
+    }
+    if(job.stage==PruneJob::LINK){
+        BlobStore& store=BlobStore::instance();
+        for(; job.cursor<(int)job.links.size(); job.cursor++){
+            if(expired()) return false;
+            TreeNode* node=version_map.get(job.cursor);
+            if(!node) continue;
+            if(!node->parent){
+                job.kept.push_back(node);
+                continue;
+            }
+            PruneJob::Link& link=job.linkOf(job.cursor);
+            const PruneJob::Link& up=job.linkOf(node->parent->version_id);
+            if(up.keep){
+                link.anchor=node->parent;
+                link.prefix_len=node->prefix_len;
+                link.suffix_len=node->suffix_len;
+            } else {
+                link.anchor=up.anchor;
+                link.prefix_len=min(node->prefix_len, up.prefix_len);
+                link.suffix_len=min(node->suffix_len, up.suffix_len);
+            }
+            if(!link.keep){
+                job.dropped.push_back(node);
+                continue;
+            }
+            job.kept.push_back(node);
+            if(up.keep) continue;
+            PruneJob::Relink relink{node, link.anchor, link.prefix_len, link.suffix_len, node->data};
+            if(link.prefix_len!=node->prefix_len || link.suffix_len!=node->suffix_len){
+                size_t middle=node->length-link.prefix_len-link.suffix_len;
+                relink.data=store.intern(contentOf(node).substr(link.prefix_len, middle).flatten());
+            }
+            job.relinks.push_back(std::move(relink));
+        }
+        job.links=vector<PruneJob::Link>();
+        job.stage=PruneJob::COMMIT;
+    }
+    return true;
+}
+//Kept nodes keep their content ropes, which never depended on the parent; only their
+//links, ancestry index and (if reattached) edit change. Dropped nodes are unreachable
+//from here on but are freed only by pruneFree, once lock-free readers are done.
+template <typename Policies>
+void BasicFile<Policies>::pruneCommit(PruneJob& job){
+    for(TreeNode* node : job.kept) node->first_child=nullptr;
+    for(PruneJob::Relink& relink : job.relinks){
+        TreeNode* node=relink.node;
+        node->parent=relink.parent;
+        if(node->prefix_len!=relink.prefix_len || node->suffix_len!=relink.suffix_len){
+            node->is_keyframe=relink.prefix_len==0 && relink.suffix_len==0;
+            node->prefix_len=relink.prefix_len;
+            node->suffix_len=relink.suffix_len;
+            node->data=std::move(relink.data);
+            search_index.mark(node->version_id, node->prefix_len-min(node->prefix_len, (size_t)2),
+                              node->length-node->suffix_len+min(node->suffix_len, (size_t)2));
+        }
+    }
+    job.relinks=vector<PruneJob::Relink>();
+    for(TreeNode* node : job.kept){//ascending ids, so each parent is attached before its children
+        if(!node->parent) continue;
+        node->attachTo(node->parent);
+        node->parent->addChild(node);
+    }
+    if(job.dropped.size()>job.kept.size()){//rebuilding the index from what is kept is cheaper
+        typename Policies::Index::Map kept_map(job.kept.size());
+        for(TreeNode* node : job.kept) kept_map.insert(node->version_id, node);
+        version_map=kept_map;
+    } else {
+        for(TreeNode* node : job.dropped) version_map.erase(node->version_id);
+    }
+    for(TreeNode* node : job.dropped) published.unpublish(node->version_id);
+    if constexpr(Times::INDEXED) snapshot_times.retain([&](int version_id){ return version_map.contains(version_id); });
+    changes++;
+    cout<<"Pruned "<<job.dropped.size()<<" versions, "<<job.kept.size()<<" remain."<<'\n';
+    job.kept=vector<TreeNode*>();
+    job.epoch=EpochManager::instance().barrier();
+    job.stage=PruneJob::FREE;
+}
+bool File::pruneFree(PruneJob& job, chrono::steady_clock::time_point deadline){
+    if(!EpochManager::instance().passed(job.epoch)) return false;//a lock-free READ may still hold one
+    size_t steps=0;
+    while(!job.dropped.empty()){
+        if((++steps & 15)==0 && chrono::steady_clock::now()>=deadline) return false;
+        arena.destroy(job.dropped.back());
+        job.dropped.pop_back();
+    }
+    job.dropped.shrink_to_fit();
+    job.stage=PruneJob::DONE;
+    return true;
+}
+
+size_t File::contentBytes() {
+    ensureLoaded();
+    size_t total=0;
+    vector<TreeNode*> stack{root};//iterative, version trees can be very deep
+    while(!stack.empty()){
+        TreeNode* node=stack.back();
+        stack.pop_back();
+        total+=node->data.size();
+        for(TreeNode* child=node->first_child; child; child=child->next_sibling) stack.push_back(child);
+    }
+    return total;
+}
+
+// Picks the BasicFile of a layout one policy at a time; make gets a null pointer of that type.
+template <typename Content, typename Index, typename Make>
+static File* makeWithTimes(FileLayout layout, Make make){
+    if(layout.times==FileLayout::SCANNED) return make((BasicFile<FilePolicies<Content, Index, ScannedTimes>>*)nullptr);
+    return make((BasicFile<FilePolicies<Content, Index, IndexedTimes>>*)nullptr);
+}
+template <typename Content, typename Make>
+static File* makeWithIndex(FileLayout layout, Make make){
+    if(layout.index==FileLayout::DENSE) return makeWithTimes<Content, DenseIndex>(layout, make);
+    return makeWithTimes<Content, HashIndex>(layout, make);
+}
+template <typename Make>
+static File* makeWithLayout(FileLayout layout, Make make){
+    if(layout.content==FileLayout::WHOLE) return makeWithIndex<WholeContent>(layout, make);
+    if(layout.content==FileLayout::PRIVATE) return makeWithIndex<PrivateContent>(layout, make);
+    return makeWithIndex<DeltaContent>(layout, make);
+}
+File* makeFile(FileLayout layout, string initial_message){
+    return makeWithLayout(layout, [&](auto* type) -> File* {
+        return new remove_pointer_t<decltype(type)>(std::move(initial_message));
+    });
+}
+File* makeFile(FileLayout layout, TreeSource* source, size_t index, int total_versions){
+    return makeWithLayout(layout, [&](auto* type) -> File* {
+        return new remove_pointer_t<decltype(type)>(source, index, total_versions);
+    });
+}
+template class BasicFile<FilePolicies<DeltaContent, HashIndex, IndexedTimes>>;//DefaultFile, also built directly
+template class BasicFile<FilePolicies<DeltaContent, HashIndex, ScannedTimes>>;
+template class BasicFile<FilePolicies<DeltaContent, DenseIndex, IndexedTimes>>;
+template class BasicFile<FilePolicies<DeltaContent, DenseIndex, ScannedTimes>>;
+template class BasicFile<FilePolicies<WholeContent, HashIndex, IndexedTimes>>;
+template class BasicFile<FilePolicies<WholeContent, HashIndex, ScannedTimes>>;
+template class BasicFile<FilePolicies<WholeContent, DenseIndex, IndexedTimes>>;
+template class BasicFile<FilePolicies<WholeContent, DenseIndex, ScannedTimes>>;
+template class BasicFile<FilePolicies<PrivateContent, HashIndex, IndexedTimes>>;
+template class BasicFile<FilePolicies<PrivateContent, HashIndex, ScannedTimes>>;
+template class BasicFile<FilePolicies<PrivateContent, DenseIndex, IndexedTimes>>;
+template class BasicFile<FilePolicies<PrivateContent, DenseIndex, ScannedTimes>>;
+
+//TIME INDEX
+static vector<pair<Stamp, int>>::const_iterator pastTime(const vector<pair<Stamp, int>>& entries, Stamp time){
+    return upper_bound(entries.begin(), entries.end(), time, [](Stamp t, const pair<Stamp, int>& entry){
+        return t<entry.first;
+    });
+}
+void TimeIndex::add(Stamp time, int value){
+    if(entries.empty() || entries.back().first<=time) entries.emplace_back(time, value);
+    else entries.insert(pastTime(entries, time), {time, value});//out of order, as when loading a repository
+}
+void TimeIndex::addAll(vector<pair<Stamp, int>> added){
+    stable_sort(added.begin(), added.end(), [](const pair<Stamp, int>& a, const pair<Stamp, int>& b){
+        return a.first<b.first;
+    });
+    size_t old_size=entries.size();
+    entries.insert(entries.end(), added.begin(), added.end());
+    inplace_merge(entries.begin(), entries.begin()+old_size, entries.end(), [](const pair<Stamp, int>& a, const pair<Stamp, int>& b){
+        return a.first<b.first;
+    });
+}
+int TimeIndex::atOrBefore(Stamp time) const {
+    auto end=pastTime(entries, time);
+    return end==entries.begin() ? -1 : prev(end)->second;
+}
+vector<int> TimeIndex::upTo(Stamp time) const {
+    vector<int> values;
+    for(auto it=entries.cbegin(), end=pastTime(entries, time); it!=end; ++it) values.push_back(it->second);
+    return values;
+}
+
+//FILEHEAP
+FileHeap::FileHeap(bool sort_by_recent){
+    this->sort_by_recent=sort_by_recent;
+}
+FileHeap::~FileHeap(){};
+bool FileHeap::compare(Fileppt& a, Fileppt& b){
+    if(sort_by_recent){
+        if(a.last_modified!=b.last_modified) return a.last_modified>b.last_modified;
+    } else {
+        if(a.total_versions!=b.total_versions) return a.total_versions>b.total_versions;
+    }
+    return a.filename<b.filename;
+}
+void FileHeap::swapEntries(unsigned int a, unsigned int b){
+    swap(heap[a], heap[b]);
+    position[heap[a].id]=a;
+    position[heap[b].id]=b;
+}
+void FileHeap::push(const Fileppt& value){
+    if(value.id>=(int)position.size()) position.resize(value.id+1, -1);
+    if(position[value.id]!=-1){
+        update(value.id, value.last_modified, value.total_versions);
+        return;
+    }
+    heap.push_back(value);
+    position[value.id]=heap.size()-1;
+    heapifyUp(heap.size()-1);
+}
+
+void FileHeap::build(vector<Fileppt> values){
+    heap.swap(values);
+    position.assign(0, -1);
+    for(unsigned int i=0; i<heap.size(); i++){
+        if(heap[i].id>=(int)position.size()) position.resize(heap[i].id+1, -1);
+        position[heap[i].id]=i;
+    }
+    for(int i=(int)heap.size()/2-1; i>=0; i--) heapifyDown(i);
+}
+
+Fileppt FileHeap::pop(){
+    if(empty()){
+        cout<<"Heap is empty. Returning a default Fileppt.\n";
+        return Fileppt{};
+    }
+    Fileppt root=heap.front();
+    swapEntries(0, heap.size()-1);
+    heap.pop_back();
+    position[root.id]=-1;
+    if(!heap.empty()) heapifyDown(0);
+    return root;
+}
+
+bool FileHeap::empty(){
+    return heap.empty();
+}
+
+bool FileHeap::contains(int id){
+    return id>=0 && id<(int)position.size() && position[id]!=-1;
+}
+
+void FileHeap::update(int id, Stamp last_modified, int total_versions){
+    if(!contains(id)) return;
+    unsigned int index=position[id];
+    Fileppt& entry=heap[index];
+    if(entry.last_modified==last_modified && entry.total_versions==total_versions) return;
+    entry.last_modified=last_modified;
+    entry.total_versions=total_versions;
+    heapifyUp(index);
+    heapifyDown(position[id]);
+}
+
+//Walks the heap from the root, always expanding the best frontier entry next; only
+//the k winners and their children are ever looked at.
+vector<Fileppt> FileHeap::top(int k){
+    vector<Fileppt> result;
+    vector<unsigned int> frontier;
+    auto worse=[this](unsigned int a, unsigned int b){ return compare(heap[b], heap[a]); };
+    if(!heap.empty()) frontier.push_back(0);
+    while((int)result.size()<k && !frontier.empty()){
+        pop_heap(frontier.begin(), frontier.end(), worse);
+        unsigned int index=frontier.back();
+        frontier.pop_back();
+        result.push_back(heap[index]);
+        for(unsigned int child=2*index+1; child<=2*index+2 && child<heap.size(); child++){
+            frontier.push_back(child);
+            push_heap(frontier.begin(), frontier.end(), worse);
+        }
+    }
+    return result;
+}
+
+void FileHeap::heapifyUp(unsigned int idx){
+    while(idx>0){
+        unsigned int parent_index=(idx-1)/2;
+        if(compare(heap[idx], heap[parent_index])){
+            swapEntries(idx, parent_index);
+            idx=parent_index;
+        } else {
+            break;
+        }
+    }
+}
+
+void FileHeap::heapifyDown(unsigned int index) {
+    while(true){
+        unsigned int l_child = 2 * index + 1;//index of left child
+        unsigned int r_child = 2 * index + 2;//index of right child
+        unsigned int best_index = index;
+
+        if(l_child<heap.size() && compare(heap[l_child], heap[best_index])){
+            best_index=l_child;
+        }
+        if(r_child<heap.size() && compare(heap[r_child], heap[best_index])){
+            best_index=r_child;
+        }
+        if(best_index==index) break;
+        swapEntries(index, best_index);
+        index=best_index;
+    }
+}
+//PERSISTENT MAP
+struct TrieEntry {
+    uint64_t hash;
+    string key;
+    int value;
+};
+
+// Below the last level (shift 64 and on) a node is a bucket of keys whose whole hashes
+// collide: entries are unordered there and the bitmaps unused.
+struct TrieNode {
+    atomic<int> refs;
+    uint32_t entry_map;//slots holding a key
+    uint32_t child_map;//slots holding a subtrie
+    vector<TrieEntry> entries;//in slot order
+    vector<TrieNode*> children;//in slot order
+    TrieNode() : refs(1), entry_map(0), child_map(0) {}
+    TrieNode(const TrieNode& other)
+        : refs(1), entry_map(other.entry_map), child_map(other.child_map), entries(other.entries),
+          children(other.children) {
+        for(TrieNode* child : children) child->refs.fetch_add(1, memory_order_relaxed);
+    }
+};
+
+static constexpr int TRIE_BITS = 5;
+
+static int slotIndex(uint32_t map, uint32_t bit){
+    return __builtin_popcount(map&(bit-1));
+}
+
+static void releaseTrie(TrieNode* node){
+    if(node && node->refs.fetch_sub(1, memory_order_acq_rel)==1){
+        for(TrieNode* child : node->children) releaseTrie(child);
+        delete node;
+    }
+}
+
+static const TrieEntry* trieFind(const TrieNode* node, uint64_t hash, int shift, string_view key){
+    for(; node; shift+=TRIE_BITS){
+        if(shift>=64){
+            for(const TrieEntry& e : node->entries){
+                if(e.key==key) return &e;
+            }
+            return nullptr;
+        }
+        uint32_t bit=1u<<((hash>>shift)&31);
+        if(node->entry_map & bit){
+            const TrieEntry& e=node->entries[slotIndex(node->entry_map, bit)];
+            return e.hash==hash && e.key==key ? &e : nullptr;
+        }
+        if(!(node->child_map & bit)) return nullptr;
+        node=node->children[slotIndex(node->child_map, bit)];
+    }
+    return nullptr;
+}
+
+// Returns what the parent should hold instead of node: node itself, changed in place,
+// when this is its only reference, otherwise a changed copy. Copying a node adds a
+// reference to each of its children, so below a copy every node is copied too, and a
+// node held once is only ever reachable through the path being changed.
+static TrieNode* trieSet(TrieNode* node, int shift, TrieEntry&& entry, bool& added){
+    if(!node) node=new TrieNode();
+    else if(node->refs.load(memory_order_acquire)!=1) node=new TrieNode(*node);
+    if(shift>=64){
+        for(TrieEntry& e : node->entries){
+            if(e.key==entry.key){
+                e.value=entry.value;
+                return node;
+            }
+        }
+        node->entries.push_back(std::move(entry));
+        added=true;
+        return node;
+    }
+    uint32_t bit=1u<<((entry.hash>>shift)&31);
+    int entry_index=slotIndex(node->entry_map, bit), child_index=slotIndex(node->child_map, bit);
+    if(node->child_map & bit){
+        TrieNode* child=node->children[child_index];
+        TrieNode* updated=trieSet(child, shift+TRIE_BITS, std::move(entry), added);
+        if(updated!=child){
+            releaseTrie(child);
+            node->children[child_index]=updated;
+        }
+    } else if(node->entry_map & bit){
+        TrieEntry& existing=node->entries[entry_index];
+        if(existing.hash==entry.hash && existing.key==entry.key){
+            existing.value=entry.value;
+            return node;
+        }
+        bool moved=false;//the existing key is not new
+        TrieNode* child=trieSet(nullptr, shift+TRIE_BITS, std::move(existing), moved);
+        child=trieSet(child, shift+TRIE_BITS, std::move(entry), added);
+        node->entries.erase(node->entries.begin()+entry_index);
+        node->entry_map&=~bit;
+        node->children.insert(node->children.begin()+child_index, child);
+        node->child_map|=bit;
+    } else {
+        node->entries.insert(node->entries.begin()+entry_index, std::move(entry));
+        node->entry_map|=bit;
+        added=true;
+    }
+    return node;
+}
+
+template <typename Visit>
+static void trieEntries(const TrieNode* node, Visit& visit){
+    for(const TrieEntry& e : node->entries) visit(e);
+    for(const TrieNode* child : node->children) trieEntries(child, visit);
+}
+
+// mine and base sit at the same level (shift) of their tries.
+static void trieChanges(const TrieNode* mine, const TrieNode* base, int shift,
+                        const function<void(const string&, int)>& visit){
+    if(mine==base || !mine) return;
+    auto changed=[&](const TrieEntry& e){
+        const TrieEntry* old=trieFind(base, e.hash, shift, e.key);
+        if(!old || old->value!=e.value) visit(e.key, e.value);
+    };
+    if(!base || shift>=64){
+        trieEntries(mine, changed);
+        return;
+    }
+    for(uint32_t slots=mine->entry_map|mine->child_map; slots; slots&=slots-1){
+        uint32_t bit=slots&(~slots+1);
+        if(mine->entry_map & bit){
+            changed(mine->entries[slotIndex(mine->entry_map, bit)]);
+        } else if(base->child_map & bit){
+            trieChanges(mine->children[slotIndex(mine->child_map, bit)], base->children[slotIndex(base->child_map, bit)],
+                        shift+TRIE_BITS, visit);
+        } else {
+            trieEntries(mine->children[slotIndex(mine->child_map, bit)], changed);
+        }
+    }
+}
+
+PersistentMap::PersistentMap(const PersistentMap& other) : root(other.root), count(other.count) {
+    if(root) root->refs.fetch_add(1, memory_order_relaxed);
+}
+
+PersistentMap::~PersistentMap(){
+    releaseTrie(root);
+}
+
+int PersistentMap::get(string_view key) const {
+    const TrieEntry* e=trieFind(root, hashBytes(key.data(), key.size()), 0, key);
+    return e ? e->value : -1;
+}
+
+void PersistentMap::set(string_view key, int value){
+    bool added=false;
+    TrieNode* updated=trieSet(root, 0, TrieEntry{hashBytes(key.data(), key.size()), string(key), value}, added);
+    if(updated!=root){
+        releaseTrie(root);
+        root=updated;
+    }
+    count+=added;
+}
+
+void PersistentMap::forEachChange(const PersistentMap& base, const function<void(const string&, int)>& visit) const {
+    trieChanges(root, base.root, 0, visit);
+}
+
+void PersistentMap::forEach(const function<void(const string&, int)>& visit) const {
+    auto all=[&](const TrieEntry& e){ visit(e.key, e.value); };
+    if(root) trieEntries(root, all);
+}
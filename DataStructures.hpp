@@ -1,114 +1,925 @@
-#ifndef DATASTRUCTURES_H
-#define DATASTRUCTURES_H//Creating a header file
-
-#include <string>
-#include <vector>
-#include <ctime>//The ctime library is included to handle time-related functions
-using namespace std;
-
-// A node in the version history tree.
-class TreeNode {
-public:
-    int version_id;
-    string content;
-    string message;
-    time_t created_timestamp;
-    time_t snapshot_timestamp;
-    TreeNode* parent;
-    vector<TreeNode*> children;
-
-    TreeNode(int id, const string& msg);//Constructor for creating a snapshot node with a message
-    TreeNode(int id, TreeNode* p);//Constructor overloading for creating a new version node with a parent
-    ~TreeNode();
-
-    bool isSnapshot();//function to check if the node is a snapshot
-};
-
-// A HashMap specificaly for version IDs to TreeNodes
-class VersionMap {
-public:
-    struct Entry {
-        int key;
-        TreeNode* value;
-        bool is_empty;
-        bool is_deleted;
-    };
-private:
-    vector<Entry> entries;
-    unsigned int capacity;
-    unsigned int hashFunction(int key);
-public:
-    VersionMap(unsigned int capacity = 101);
-    ~VersionMap();
-    void insert(int key, TreeNode* value);
-    TreeNode* get(int key);
-};
-
-//File class
-class File {
-private:
-    void createNewVersion();
-    void updateTime();
-public:
-    TreeNode* root;
-    TreeNode* active_version;
-    VersionMap version_map;
-    int total_versions;
-    File(string initial_message);
-    ~File();
-    void read();
-    void insert(const string& content);
-    void update(const string& content);
-    void snapshot(const string& msg);
-    void rollback(int version_id);
-    void rollbackToParent();
-    void history();
-};
-
-// A struct to hold the file properties for heap operations.
-struct Fileppt {
-    string filename;
-    time_t last_modified;
-    int total_versions;
-};
-
-// Custom hash map for string keys (filenames) to File*
-class FileMap{
-public:
-    struct Entry {
-        string key;
-        File* value;
-        bool is_empty;
-        bool is_deleted;
-    };
-private:
-    vector<Entry> entries;
-    int capacity;
-    int hashFunction(const string& key);
-public:
-    FileMap(unsigned int capacity = 101);
-    ~FileMap();
-    void insert(const string& key, File* value);
-    File* get(const string& key);
-    bool contains(const string& key);
-    void erase(const string& key);
-    vector<string> keys(); //for ordered listing
-};
-
-// The Heap data structure, specifically for fileproperties.
-class FileHeap {
-public:
-    FileHeap(bool sort_by_recent);
-    ~FileHeap();
-
-    void push(const Fileppt& value);
-    Fileppt pop();
-    bool empty();
-    vector<Fileppt> heap;
-    bool sort_by_recent;
-
-    void heapifyUp(unsigned int index);//unsigned int handles negative values if given by mistake. Heapify up to maintain heap property
-    void heapifyDown(unsigned int index);//heapify down to maintain heap property
-    bool compare(Fileppt& a, Fileppt& b);//Comparison function to determine heap order
-};
-#endif
\ No newline at end of file
+#ifndef DATASTRUCTURES_H
+#define DATASTRUCTURES_H//Creating a header file
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <functional>
+#include <iosfwd>
+#include <ctime>//The ctime library is included to handle time-related functions
+#include "Stats.hpp"
+using namespace std;
+
+class File;
+
+// Time source for version timestamps: a hybrid logical clock. A stamp is nanoseconds
+// since the epoch, read from the kernel's coarse wall clock (cached and refreshed every
+// tick, so no syscall), raised to one past the last stamp handed out when the clock has
+// not moved on. Stamps are unique and ordered the way the modifications happened.
+// Log replay pins the clock to each record's original stamp so recovered versions keep
+// the stamps they were created with.
+typedef int64_t Stamp;
+constexpr Stamp STAMPS_PER_SECOND = 1000000000;
+Stamp currentTime();
+Stamp reserveTimes(Stamp count);//the first of count consecutive stamps no other call returns
+void setTimeOverride(Stamp t);//per thread; 0 goes back to the clock
+inline Stamp endOfSecond(time_t t){ return (Stamp)(t+1)*STAMPS_PER_SECOND-1; }//last stamp within unix time t
+string formatTime(Stamp t);//local time, "YYYY-MM-DD HH:MM:SS"
+
+// Hash functions used by HashTable. Both finish with a 64-bit mixer so that
+// sequential keys (version IDs, "file1", "file2"...) spread over all buckets.
+inline uint64_t mixHash(uint64_t x){
+    x^=x>>33; x*=0xff51afd7ed558ccdULL;
+    x^=x>>33; x*=0xc4ceb9fe1a85ec53ULL;
+    x^=x>>33;
+    return x;
+}
+uint64_t hashBytes(const char* data, size_t len, uint64_t seed = 0);//8 bytes at a time, defined in DataStructures.cpp
+
+// 128-bit content hash, wide enough to identify content by hash alone.
+struct Hash128 {
+    uint64_t lo;
+    uint64_t hi;
+    bool operator==(const Hash128& other) const { return lo==other.lo && hi==other.hi; }
+};
+Hash128 hashBytes128(const char* data, size_t len);
+
+struct IntHash {
+    uint64_t operator()(int key) const { return mixHash((uint64_t)(unsigned int)key); }
+};
+struct StringHash {
+    uint64_t operator()(string_view key) const { return hashBytes(key.data(), key.size()); }//also serves const string& lookups
+};
+struct Hash128Hash {
+    uint64_t operator()(const Hash128& key) const { return key.lo; }//already uniformly mixed
+};
+
+// Open-addressing hash table with a separate control-byte array (one byte per slot).
+// A control byte is EMPTY, DELETED (tombstone) or the low 7 bits of the key's hash, so
+// a probe compares 8 slots at once on a single 64-bit word and only touches a slot
+// when its 7-bit tag matches. Grows at 7/8 load and compacts tombstones on rehash.
+template <typename K, typename V, typename Hash, int PROBE_SITE = PROBE_NONE>
+class HashTable {
+public:
+    struct Entry {
+        K key;
+        V value;
+    };
+private:
+    static constexpr uint8_t EMPTY = 0x80;
+    static constexpr uint8_t DELETED = 0xFE;
+    static constexpr size_t GROUP = 8;//slots compared per probe step
+    static constexpr uint64_t LSBS = 0x0101010101010101ULL;
+    static constexpr uint64_t MSBS = 0x8080808080808080ULL;
+
+    vector<uint8_t> ctrl;
+    vector<Entry> entries;
+    size_t capacity;//always a power of two and a multiple of GROUP
+    size_t count;//live entries
+    size_t tombstones;
+    Hash hasher;
+
+    uint64_t loadGroup(size_t pos) const {
+        uint64_t word;
+        memcpy(&word, &ctrl[pos], sizeof(word));
+        return word;
+    }
+    static uint64_t matchTag(uint64_t word, uint8_t tag){//bytes equal to tag (may report false positives, keys are verified)
+        uint64_t x=word^(LSBS*tag);
+        return (x-LSBS) & ~x & MSBS;
+    }
+    static uint64_t matchEmpty(uint64_t word){//EMPTY is the only control byte with bits 7 set and 1 clear
+        return word & ~(word<<6) & MSBS;
+    }
+    static uint64_t matchFree(uint64_t word){//EMPTY or DELETED
+        return word & MSBS;
+    }
+    static size_t lowestByte(uint64_t mask){
+        return __builtin_ctzll(mask)>>3;
+    }
+    template <typename Q>//any type Hash accepts and K compares equal to, e.g. string_view for string keys
+    size_t findIndex(const Q& key) const {
+        if(capacity==0) return 0;
+        uint64_t h=hasher(key);
+        uint8_t tag=h & 0x7F;
+        size_t mask=capacity-1;
+        size_t pos=(h>>7) & mask & ~(GROUP-1);
+        for(size_t step=GROUP;; step+=GROUP){//triangular probing over groups visits every group once
+            uint64_t word=loadGroup(pos);
+            for(uint64_t m=matchTag(word, tag); m; m&=m-1){
+                size_t i=pos+lowestByte(m);
+                if(ctrl[i]==tag && entries[i].key==key){
+                    recordProbe(step);
+                    return i;
+                }
+            }
+            if(matchEmpty(word)){
+                recordProbe(step);
+                return capacity;
+            }
+            pos=(pos+step) & mask;
+        }
+    }
+    void recordProbe([[maybe_unused]] size_t step) const {//groups scanned by one lookup
+        FS_STAT(if constexpr(PROBE_SITE!=PROBE_NONE) Stats::local().probes[PROBE_SITE].record(step/GROUP);)
+    }
+    size_t findFree(uint64_t h) const {
+        size_t mask=capacity-1;
+        size_t pos=(h>>7) & mask & ~(GROUP-1);
+        for(size_t step=GROUP;; step+=GROUP){
+            uint64_t m=matchFree(loadGroup(pos));
+            if(m) return pos+lowestByte(m);
+            pos=(pos+step) & mask;
+        }
+    }
+    void rehash(size_t new_capacity){
+        vector<uint8_t> old_ctrl;
+        vector<Entry> old_entries;
+        old_ctrl.swap(ctrl);
+        old_entries.swap(entries);
+        capacity=new_capacity;
+        ctrl.assign(capacity, EMPTY);
+        entries.resize(capacity);
+        tombstones=0;
+        for(size_t i=0; i<old_ctrl.size(); i++){
+            if(old_ctrl[i]<0x80){
+                uint64_t h=hasher(old_entries[i].key);
+                size_t j=findFree(h);
+                ctrl[j]=h & 0x7F;
+                entries[j]=std::move(old_entries[i]);
+            }
+        }
+    }
+    static size_t capacityFor(size_t n){//smallest power of two holding n entries under 7/8 load
+        size_t cap=GROUP;
+        while(cap-cap/8<n+1) cap*=2;
+        return cap;
+    }
+public:
+    HashTable(size_t expected = 0) : capacity(0), count(0), tombstones(0) {
+        if(expected>0) rehash(capacityFor(expected));//otherwise nothing is allocated until the first insert
+    }
+    ~HashTable(){}
+
+    void reserve(size_t n){
+        if(capacityFor(n)>capacity) rehash(capacityFor(n));
+    }
+    void insert(const K& key, const V& value){//inserts or overwrites
+        size_t i=findIndex(key);
+        if(i!=capacity){
+            entries[i].value=value;
+            return;
+        }
+        if(count+tombstones+1>capacity-capacity/8){
+            //Mostly tombstones: compact in place. Otherwise grow.
+            rehash(capacity==0 ? GROUP : tombstones>count/2 ? capacity : capacity*2);
+        }
+        uint64_t h=hasher(key);
+        i=findFree(h);
+        if(ctrl[i]==DELETED) tombstones--;
+        ctrl[i]=h & 0x7F;
+        entries[i].key=key;
+        entries[i].value=value;
+        count++;
+    }
+    template <typename Q>
+    V* find(const Q& key){
+        size_t i=findIndex(key);
+        return i==capacity ? nullptr : &entries[i].value;
+    }
+    template <typename Q>
+    V get(const Q& key){//returns V() (nullptr for pointer values) when missing
+        V* v=find(key);
+        return v ? *v : V();
+    }
+    template <typename Q>
+    bool contains(const Q& key){
+        return findIndex(key)!=capacity;
+    }
+    template <typename Q>
+    bool erase(const Q& key){
+        size_t i=findIndex(key);
+        if(i==capacity) return false;
+        //A slot can go straight back to EMPTY if its group never filled up, since
+        //no probe sequence can have continued past it.
+        size_t group=i & ~(GROUP-1);
+        ctrl[i]=matchEmpty(loadGroup(group)) ? EMPTY : DELETED;
+        if(ctrl[i]==DELETED) tombstones++;
+        entries[i]=Entry();
+        count--;
+        return true;
+    }
+    size_t size() const { return count; }
+    vector<K> keys() const {
+        vector<K> result;
+        result.reserve(count);
+        for(size_t i=0; i<capacity; i++){
+            if(ctrl[i]<0x80) result.push_back(entries[i].key);
+        }
+        return result;
+    }
+};
+
+// An immutable, reference-counted piece of content. Interned blobs live in the
+// BlobStore and are shared by every version (of any file) holding the same bytes.
+// A blob left unread for a whole cold window may be packed (BlobStore::compressCold)
+// and is then decompressed again by the next read.
+struct Blob {
+    string data;//owned bytes; moved out once packed, unused for mapped blobs
+    Hash128 hash;
+    int refs;
+    bool interned;
+    bool incompressible;//packing was tried and did not pay off
+    const char* mapped;//bytes inside a loaded repository file (see Persistence.hpp), or nullptr
+    size_t length;
+    // Where bytes() reads from: data, mapped, or a decompressed copy of packed; null
+    // while the blob is cold. Dropped buffers are retired through the EpochManager, so
+    // bytes stay valid while the reader holds an EpochGuard (or the store lock).
+    atomic<const char*> resident;
+    atomic<const string*> packed;//compressed bytes, never changed once set
+    atomic<uint32_t> last_used;//BlobStore generation of the last read
+
+    Blob(string bytes, const Hash128& hash, bool interned);
+    Blob(const char* mapped, size_t length, const Hash128& hash);
+    ~Blob();
+    string_view bytes();//decompresses a cold blob
+    size_t size() const { return length; }
+};
+
+// Owning handle to a Blob; a null handle is the empty string.
+class BlobRef {
+    Blob* blob;
+public:
+    BlobRef() : blob(nullptr) {}
+    explicit BlobRef(Blob* b);//takes over one reference
+    BlobRef(const BlobRef& other);
+    BlobRef(BlobRef&& other) : blob(other.blob) { other.blob=nullptr; }
+    BlobRef& operator=(BlobRef other);//by value: covers both copy and move
+    ~BlobRef();
+
+    string_view view() const;
+    size_t size() const { return blob ? blob->size() : 0; }
+    bool empty() const { return size()==0; }
+    Blob* get() const { return blob; }
+    void append(string_view content);//copy-on-write: leaves other holders untouched
+};
+
+// Global content-addressed store. Identical content is held once no matter how many
+// versions or files reference it. One mutex guards the table, every Blob's refs and
+// the counters; blob bytes are immutable once shared, so reading them needs no lock.
+// Interned blobs are also tiered: compressCold() packs those not read since the
+// previous pass, and bytes() unpacks them again on demand.
+class BlobStore {
+private:
+    mutex lock;
+    HashTable<Hash128, Blob*, Hash128Hash> blobs;
+    size_t logical_bytes;//bytes as seen by all references
+    size_t physical_bytes;//unique bytes, packed or not
+    size_t mapped_bytes;//bytes served straight from a loaded repository file
+    size_t lookups;
+    size_t hits;
+    atomic<uint32_t> generation;//advanced by each compressCold() pass, stamped on blobs by reads
+    mutex tier_lock;//one compressCold() pass at a time
+    size_t compressed_bytes;//packed size of the cold blobs
+    size_t cold_bytes;//unpacked size of the same blobs
+    atomic<size_t> cold_blobs;
+    atomic<size_t> unpacked_bytes;//decompressed copies of cold blobs currently held
+    static constexpr size_t MIN_COLD_BLOB = 512;//smaller blobs are not worth packing
+    BlobStore();
+    ~BlobStore();
+    Blob* find(const Hash128& hash, string_view content);//caller holds lock
+    void unlink(Blob* blob);//caller holds lock
+    const char* unpack(Blob* blob);
+    friend class BlobRef;
+    friend struct Blob;
+public:
+    static BlobStore& instance();
+    BlobRef intern(string_view content);
+    void freeze(BlobRef& ref);//interns a blob built up by append(), deduplicating it
+    BlobRef lookup(string_view content);//existing blob for content, or a null ref
+    BlobRef adopt(const char* bytes, size_t size, const Hash128& hash);//wraps mapped bytes without copying
+    // Packs the interned blobs not read since the previous pass and drops the
+    // decompressed copies of those already packed. Returns the number of blobs packed.
+    size_t compressCold();
+    bool anyCold() const { return cold_blobs.load(memory_order_relaxed)>0; }
+    size_t residentBytes();//unpacked bytes held in memory, copies of cold blobs included
+    size_t compressedBytes();
+    void printStats();
+    double dedupRatio();
+};
+
+// EPOCH-BASED RECLAMATION
+// Lock-free readers pin the current epoch (EpochGuard) while they hold pointers to
+// shared objects. A writer that unlinks such an object retires it instead of deleting
+// it; it is freed once every reader pinned at or before the retiring epoch has left.
+// Readers never block or take a lock; only retire() does.
+class EpochManager {
+private:
+    struct Participant {
+        atomic<uint64_t> epoch;//epoch pinned by the owning thread, 0 when not reading
+        atomic<bool> in_use;//false once the thread has exited; the entry is then reused
+        Participant* next;
+    };
+    struct Retired {
+        uint64_t epoch;
+        void* object;
+        void (*destroy)(void*);
+    };
+    atomic<uint64_t> global_epoch;
+    atomic<Participant*> participants;//push-only list, entries are never freed
+    mutex retire_lock;
+    vector<Retired> limbo;
+    static constexpr size_t COLLECT_THRESHOLD = 64;
+    EpochManager();
+    ~EpochManager();
+    Participant* participant();//this thread's entry, registered on first use
+    void collect();//caller holds retire_lock
+    uint64_t oldestPinned();
+public:
+    static EpochManager& instance();
+    void enter();//nests
+    void exit();
+    void retire(void* object, void (*destroy)(void*));
+    // For writers that free many objects in bulk: unlink them, take e=barrier(), and
+    // free them once passed(e), i.e. every reader pinned at that point has left.
+    uint64_t barrier();
+    bool passed(uint64_t e);
+    template <typename T>
+    void retire(T* object){
+        retire(object, [](void* p){ delete static_cast<T*>(p); });
+    }
+};
+
+struct EpochGuard {
+    EpochGuard(){ EpochManager::instance().enter(); }
+    ~EpochGuard(){ EpochManager::instance().exit(); }
+};
+
+// ROPE
+// Immutable content as a height-balanced (AVL) tree whose leaves are slices of blobs.
+// Nodes are never modified once built, so ropes share subtrees freely: a version's
+// content reuses its parent's nodes and only the O(log n) nodes along the edited
+// boundaries are new. Reference counts are plain ints and only change under the
+// owning File's lock; lock-free readers walk a published rope without touching them.
+struct RopeNode {
+    RopeNode* left;//both children are null for a leaf
+    RopeNode* right;
+    BlobRef blob;//leaf: bytes [offset, offset+length) of blob
+    size_t offset;
+    size_t length;//bytes under this node
+    int height;//0 for a leaf
+    int refs;
+};
+
+class Rope {
+private:
+    static constexpr size_t SMALL_LEAF = 1024;//concat copies leaves up to this size together
+    RopeNode* root;
+    explicit Rope(RopeNode* node) : root(node) {}//takes over one reference
+    static void retain(RopeNode* node){ if(node) node->refs++; }
+    static void release(RopeNode* node);
+    static int height(RopeNode* node){ return node ? node->height : -1; }
+    // These take their arguments borrowed and return a new reference.
+    static RopeNode* makeLeaf(const BlobRef& blob, size_t offset, size_t length);
+    static RopeNode* makeBranch(RopeNode* left, RopeNode* right);
+    static RopeNode* balance(RopeNode* left, RopeNode* right);//heights differ by at most 2
+    static RopeNode* join(RopeNode* left, RopeNode* right);
+    static RopeNode* slice(RopeNode* node, size_t start, size_t length);
+    template <typename F>
+    static bool visit(const RopeNode* node, F& f, bool reverse){
+        if(!node) return true;
+        if(!node->left) return f(node->blob.view().substr(node->offset, node->length));
+        if(reverse) return visit(node->right, f, true) && visit(node->left, f, true);
+        return visit(node->left, f, false) && visit(node->right, f, false);
+    }
+public:
+    Rope() : root(nullptr) {}
+    explicit Rope(const BlobRef& blob);//the whole blob as one leaf
+    Rope(const Rope& other) : root(other.root) { retain(root); }
+    Rope(Rope&& other) : root(other.root) { other.root=nullptr; }
+    Rope& operator=(Rope other){ swap(root, other.root); return *this; }
+    ~Rope(){ release(root); }
+
+    size_t size() const { return root ? root->length : 0; }
+    Rope substr(size_t start, size_t length) const;//O(log n), shares the untouched subtrees
+    static Rope concat(const Rope& left, const Rope& right);//O(log n)
+    // Calls f(string_view) on each piece in order (backwards for the Reverse form) until
+    // it returns false; returns whether every piece was visited. The pieces stay valid
+    // only during the call.
+    template <typename F>
+    bool forEachPiece(F f) const {
+        EpochGuard pin;
+        return visit(root, f, false);
+    }
+    template <typename F>
+    bool forEachPieceReverse(F f) const {
+        EpochGuard pin;
+        return visit(root, f, true);
+    }
+    string flatten() const;
+};
+
+// A node in the version history tree.
+class TreeNode {
+public:
+    int version_id;
+    // The edit that made this version, stored either in full (a keyframe: the root, or
+    // content already in the blob store) or against the parent: the parent's first
+    // prefix_len bytes, then data, then the parent's last suffix_len bytes.
+    bool is_keyframe;
+    BlobRef data;
+    size_t prefix_len;
+    size_t suffix_len;
+    size_t length;//length of the whole content
+    // The whole content, sharing structure with the parent's rope. Set when the node
+    // becomes a snapshot and never changed after; built on demand for other versions.
+    Rope content;
+    string message;
+    Stamp created_timestamp;
+    Stamp snapshot_timestamp;
+    TreeNode* parent;
+    TreeNode* first_child;//children form an intrusive list, newest first
+    TreeNode* next_sibling;
+    // Ancestry index, fixed when the node is created. jump is a skew-binary jump pointer
+    // (Myers): its depth depends only on this node's depth, and following jumps or
+    // parents reaches any ancestor in O(log depth) steps.
+    int depth;//root is 0
+    TreeNode* jump;
+
+    TreeNode(int id, const string& msg);//Constructor for creating a snapshot node with a message
+    TreeNode(int id, TreeNode* p);//Constructor overloading for creating a new version node with a parent
+    ~TreeNode();
+
+    bool isSnapshot();//function to check if the node is a snapshot
+    void attachTo(TreeNode* p);//sets parent, depth and jump; p's own must be final
+    void addChild(TreeNode* child);
+    TreeNode* ancestorAtDepth(int target_depth);//nullptr unless 0 <= target_depth <= depth
+    bool isAncestorOf(TreeNode* other);//a node counts as its own ancestor
+    static TreeNode* lowestCommonAncestor(TreeNode* a, TreeNode* b);
+};
+
+// Slab allocator for the TreeNodes of one File. Nodes are carved out of slabs that
+// double in size (up to MAX_SLAB nodes), and the whole tree is freed in one linear
+// pass over the slabs, so no teardown recursion regardless of history depth.
+class NodeArena {
+private:
+    struct Slab {
+        TreeNode* nodes;
+        size_t used;
+        size_t capacity;
+    };
+    vector<Slab> slabs;
+    vector<TreeNode*> free_nodes;//destroyed by PRUNE, reused before carving new ones
+    static constexpr size_t FIRST_SLAB = 4;
+    static constexpr size_t MAX_SLAB = 4096;
+    TreeNode* allocate();
+public:
+    NodeArena();
+    ~NodeArena();
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+    template <typename... Args>
+    TreeNode* create(Args&&... args){
+        return new (allocate()) TreeNode(std::forward<Args>(args)...);
+    }
+    void destroy(TreeNode* node);
+    size_t slabCount() const { return slabs.size(); }
+};
+
+// A HashMap specificaly for version IDs to TreeNodes
+typedef HashTable<int, TreeNode*, IntHash, PROBE_VERSION_MAP> VersionMap;
+
+// Supplies the version tree of a File that was registered (e.g. from a repository on
+// disk) but has not been built yet. File calls buildTree on first use; what cannot be
+// built is reported to err.
+class TreeSource {
+public:
+    virtual ~TreeSource(){}
+    virtual void buildTree(File& file, size_t index, ostream& err) = 0;
+};
+
+// Lock-free id -> node index of a File's snapshotted versions. Snapshots never change
+// content, so a reader that finds one here can stream its rope without the file's lock.
+// Segment s holds ids [FIRST_SEGMENT*(2^s-1), FIRST_SEGMENT*(2^(s+1)-1)); segments are
+// added by the writer and never move, so a lookup is two acquire loads.
+class PublishedVersions {
+private:
+    static constexpr size_t FIRST_SEGMENT = 64;
+    static constexpr size_t SEGMENTS = 26;//enough for every non-negative int id
+    atomic<atomic<TreeNode*>*> segments[SEGMENTS];
+    static size_t segmentOf(size_t id, size_t& offset);
+public:
+    PublishedVersions();
+    ~PublishedVersions();
+    PublishedVersions(const PublishedVersions&) = delete;
+    PublishedVersions& operator=(const PublishedVersions&) = delete;
+    void publish(TreeNode* node);//caller holds the file's lock
+    void unpublish(int version_id);//caller holds the file's lock
+    TreeNode* get(int version_id) const;//wait-free; nullptr if not published
+};
+
+// (timestamp, value) pairs sorted by timestamp, equal timestamps in the order added.
+// Timestamps almost always arrive in order, so add() is an append; lookups by time are
+// a binary search.
+class TimeIndex {
+private:
+    vector<pair<Stamp, int>> entries;
+public:
+    void add(Stamp time, int value);
+    void addAll(vector<pair<Stamp, int>> added);//many at once, in any order: one merge
+    int atOrBefore(Stamp time) const;//value of the last entry at or before time, -1 if none
+    vector<int> upTo(Stamp time) const;//values of every entry at or before time, oldest first
+    template <typename Keep>
+    void retain(Keep keep){//keeps the entries whose value keep(value) accepts
+        entries.erase(remove_if(entries.begin(), entries.end(), [&](const pair<Stamp, int>& entry){
+            return !keep(entry.second);
+        }), entries.end());
+    }
+    size_t size() const { return entries.size(); }
+};
+
+// Trigram index over one file's versions, for GREP. A version posts the trigrams of its
+// own edit - the bytes it does not share with its parent, plus two bytes of context on
+// either side - so every trigram of a version's content is posted by the version or one
+// of its ancestors. Edits only mark the range they touched; the range is posted at the
+// next GREP (catchUp), so writes cost nothing more. Postings are never removed: a
+// version edited again keeps its old trigrams too, which costs GREP a verification but
+// can never hide a match. Nothing is kept until the first GREP builds the whole index.
+class TrigramIndex {
+public:
+    struct Range {
+        int version_id;
+        size_t start;
+        size_t end;
+    };
+    static int trigram(const char* p){
+        return (unsigned char)p[0]<<16 | (unsigned char)p[1]<<8 | (unsigned char)p[2];
+    }
+    TrigramIndex() : built(false) {}
+    bool isBuilt() const { return built; }
+    void markBuilt(){ built=true; pending.clear(); }
+    void mark(int version_id, size_t start, size_t end){//content range of the version to post
+        if(!built) return;
+        if(!pending.empty() && pending.back().version_id==version_id && pending.back().end>=start
+           && pending.back().start<=start){//appends to the same version extend one range
+            pending.back().end=max(pending.back().end, end);
+            return;
+        }
+        pending.push_back({version_id, start, end});
+    }
+    vector<Range> takePending(){ vector<Range> taken; taken.swap(pending); return taken; }
+    void post(int version_id, string_view text);//every trigram of text
+    const vector<int>* find(int trigram){ return postings.find(trigram); }
+    size_t size() const { return postings.size(); }
+private:
+    HashTable<int, vector<int>, IntHash> postings;//trigram -> versions posting it
+    vector<Range> pending;
+    bool built;
+};
+
+// One version GREP found, with the line holding its first match.
+struct GrepMatch {
+    int version_id;
+    string line;
+};
+
+// Which versions PRUNE keeps besides the root, the active version and those the caller
+// pins (PruneJob::pinned): the newest `value` snapshots (KEEP_LAST), or every version
+// snapshotted at or after unix time `value` - last modified, for one that is not a
+// snapshot (KEEP_SINCE).
+struct PrunePolicy {
+    enum Kind { KEEP_LAST, KEEP_SINCE } kind;
+    long long value;//snapshots to keep, or the oldest stamp to keep
+};
+
+// Progress of one prune, carried between the time-bounded slices it runs in.
+struct PruneJob {
+    enum Stage { START, MARK, LINK, COMMIT, FREE, DONE };
+    struct Link {
+        bool keep;
+        TreeNode* anchor;//nearest kept proper ancestor
+        size_t prefix_len;//the node's edit composed along the dropped nodes up to anchor
+        size_t suffix_len;
+    };
+    struct Relink {//a kept node whose parent is dropped, with its edit against the new parent
+        TreeNode* node;
+        TreeNode* parent;
+        size_t prefix_len;
+        size_t suffix_len;
+        BlobRef data;
+    };
+    PrunePolicy policy;
+    vector<int> pinned;//versions kept whatever the policy says, ascending
+    Stage stage;
+    uint64_t changes;//File::changes when the plan was started
+    int attempts;//plans abandoned because the file changed under them
+    int cursor;
+    int snapshots_seen;
+    vector<Link> links;//appended by MARK, newest id first, so no slice touches them all at once
+    vector<TreeNode*> kept;//ascending ids
+    vector<TreeNode*> dropped;
+    vector<Relink> relinks;
+    uint64_t epoch;//EpochManager::barrier() taken once dropped nodes were unpublished
+    explicit PruneJob(const PrunePolicy& policy)
+        : policy(policy), stage(START), changes(0), attempts(0), cursor(0), snapshots_seen(0), epoch(0) {}
+    Link& linkOf(int version_id){ return links[links.size()-1-version_id]; }
+};
+
+// FILE STORAGE POLICIES
+// How a File holds its versions is set by three compile-time policies, picked per file
+// at CREATE (as a FileLayout) to suit the workload it will see:
+// Content, how a version's bytes are held -
+//   DeltaContent: only the bytes a version does not share with its parent; the rest
+//     comes from the parent's rope. Least memory for large files edited a little at a time.
+//   WholeContent: each version whole, as one blob in the shared store: identical
+//     content anywhere is held once, READ streams a single piece, and UPDATE skips
+//     comparing the new content with the parent's.
+//   PrivateContent: each version whole, in a blob of its own that is never hashed or
+//     interned, so writes never touch the store's table; for small content written often.
+// Index, version id -> node -
+//   HashIndex: the SWAR hash table (VersionMap).
+//   DenseIndex: a vector indexed by id, since ids are handed out in sequence: one load
+//     per lookup, but a slot for every id ever used, pruned or not.
+// Times, how READ_AT and SNAPSHOT_AT find a snapshot by time -
+//   IndexedTimes: a TimeIndex appended to by every SNAPSHOT, O(log n) per lookup.
+//   ScannedTimes: no index, so SNAPSHOT keeps nothing more; a lookup walks every version.
+struct FileLayout {
+    enum Content : uint8_t { DELTA, WHOLE, PRIVATE } content;
+    enum Index : uint8_t { HASH, DENSE } index;
+    enum Times : uint8_t { INDEXED, SCANNED } times;
+};
+
+struct DeltaContent {
+    static constexpr FileLayout::Content LAYOUT = FileLayout::DELTA;
+    static constexpr bool DELTAS = true;
+    static constexpr bool SHARED = true;
+};
+struct WholeContent {
+    static constexpr FileLayout::Content LAYOUT = FileLayout::WHOLE;
+    static constexpr bool DELTAS = false;
+    static constexpr bool SHARED = true;
+};
+struct PrivateContent {
+    static constexpr FileLayout::Content LAYOUT = FileLayout::PRIVATE;
+    static constexpr bool DELTAS = false;
+    static constexpr bool SHARED = false;
+};
+
+// Version id -> node as a plain vector; the same interface as VersionMap.
+class DenseVersionMap {
+private:
+    vector<TreeNode*> nodes;//nullptr for ids never used or pruned
+public:
+    explicit DenseVersionMap(size_t capacity = 0){ nodes.reserve(capacity); }
+    TreeNode* get(int version_id) const { return (size_t)version_id<nodes.size() ? nodes[version_id] : nullptr; }
+    bool contains(int version_id) const { return get(version_id)!=nullptr; }
+    void insert(int version_id, TreeNode* node){
+        if((size_t)version_id>=nodes.size()) nodes.resize(version_id+1, nullptr);
+        nodes[version_id]=node;
+    }
+    void erase(int version_id){
+        if((size_t)version_id<nodes.size()) nodes[version_id]=nullptr;
+    }
+    void reserve(size_t count){ nodes.reserve(count); }
+};
+
+struct HashIndex {
+    static constexpr FileLayout::Index LAYOUT = FileLayout::HASH;
+    typedef VersionMap Map;
+};
+struct DenseIndex {
+    static constexpr FileLayout::Index LAYOUT = FileLayout::DENSE;
+    typedef DenseVersionMap Map;
+};
+
+struct IndexedTimes {
+    static constexpr FileLayout::Times LAYOUT = FileLayout::INDEXED;
+    static constexpr bool INDEXED = true;
+};
+struct ScannedTimes {
+    static constexpr FileLayout::Times LAYOUT = FileLayout::SCANNED;
+    static constexpr bool INDEXED = false;
+};
+
+template <typename ContentPolicy, typename IndexPolicy, typename TimesPolicy>
+struct FilePolicies {
+    typedef ContentPolicy Content;
+    typedef IndexPolicy Index;
+    typedef TimesPolicy Times;
+};
+
+// FILE
+// One file's version tree and the commands on it. File is the interface FileSystem holds
+// files of any layout by; each command is one virtual call, and all the work below it is
+// compiled for the file's own policies in BasicFile.
+class File {
+protected:
+    PublishedVersions published;
+    NodeArena arena;//owns every TreeNode of this file
+    TreeSource* tree_source;//non-null until a lazily registered file is first used
+    size_t source_index;
+    uint64_t changes;//bumped by every change to the tree, the active version or its content
+    TrigramIndex search_index;
+    File(FileLayout layout, TreeSource* source, size_t index, int total_versions);
+    virtual void loadTree(ostream& err) = 0;//builds the tree from tree_source
+    void printContent(ostream& out, int version_id, const Rope& content);
+public:
+    TreeNode* root;
+    TreeNode* active_version;
+    int total_versions;
+    int id;//index in FileSystem::file_order, -1 until the file is registered
+    int slot;//handle in its FileSystem shard's analytics heaps
+    int committed_version;//what its FileSystem shard's version trie holds for this file
+    const FileLayout layout;
+    mutex lock;//held by FileSystem for the whole of each command on this file
+    virtual ~File();
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    void read();
+    virtual void read(ostream& out, ostream& err) = 0;//to out and err instead of cout and cerr, as MULTI_READ's workers do
+    virtual void read(int version_id) = 0;
+    // Prints a snapshotted version without taking the file's lock. Returns false when
+    // version_id is not a published snapshot; the caller then falls back to read(id).
+    bool readSnapshot(int version_id);
+    virtual void insert(string_view content) = 0;
+    virtual void update(string_view content) = 0;
+    void snapshot(string_view msg);
+    virtual void snapshot(string_view msg, ostream& out, ostream& err) = 0;
+    virtual bool setActive(int version_id) = 0;//rollback without output; false if there is no such version
+    void rollback(int version_id);
+    void rollbackToParent();
+    void history();
+    // Snapshots on the path from the root to the active version, oldest first, from
+    // index offset on. O(log depth + count), the rest of the path is never walked.
+    void history(int offset, int count);
+    virtual void ancestor(int version_id, int k) = 0;//k-th ancestor (0 is the version itself)
+    virtual void lowestCommonAncestor(int version1, int version2) = 0;
+    virtual void isAncestor(int version1, int version2) = 0;
+    // The newest snapshot taken at or before time, on any branch: what the file held as
+    // of then. nullptr if the file had none yet. O(log snapshots) with IndexedTimes.
+    virtual TreeNode* snapshotAt(Stamp time) = 0;
+    void readAt(Stamp time);
+    // Every version whose content contains pattern, ascending, each with the line of its
+    // first match. Candidates come from the trigram index; a candidate whose parent's
+    // first match lies in the prefix it shares with the parent matches there too, and
+    // only the rest are scanned. Returns how many versions were scanned.
+    virtual size_t grep(string_view pattern, vector<GrepMatch>& matches) = 0;
+    virtual void diff(int version1, int version2) = 0;//line diff from version1 to version2
+    // Three-way merge of version2 into version1 against their lowest common ancestor.
+    // The result becomes a new child of version1 (which must be a snapshot) and the
+    // active version.
+    virtual void merge(int version1, int version2) = 0;
+    // PRUNE drops every version the policy does not keep; kept versions whose parent
+    // is dropped are reattached to their nearest kept ancestor. It runs in slices, each
+    // with the file's lock held and returning by the deadline, and other commands may
+    // run between them: prunePlan until it returns true, then pruneCommit in the same
+    // slice (the only step other commands can observe), then pruneFree until true.
+    virtual bool prunePlan(PruneJob& job, chrono::steady_clock::time_point deadline) = 0;
+    virtual void pruneCommit(PruneJob& job) = 0;
+    bool pruneFree(PruneJob& job, chrono::steady_clock::time_point deadline);
+    size_t contentBytes();//bytes held by version content across the whole tree
+    void ensureLoaded();//reporting to cerr
+    void ensureLoaded(ostream& err){
+        if(tree_source) loadTree(err);
+    }
+    bool isLoaded() const { return tree_source==nullptr; }
+
+    // For a TreeSource building the tree, and for tools: the node of an id (nullptr if
+    // none), and adding a node under parent (the root if parent is null), parents first.
+    virtual TreeNode* version(int version_id) = 0;
+    virtual TreeNode* addVersion(int version_id, TreeNode* parent, string message) = 0;
+    virtual void reserveVersions(size_t count) = 0;
+};
+
+// File compiled for one set of FilePolicies. final, so calls from one member to
+// another are direct.
+template <typename Policies>
+class BasicFile final : public File {
+private:
+    typedef typename Policies::Content Content;
+    typedef typename Policies::Times Times;
+    TimeIndex snapshot_times;//version ids by snapshot_timestamp; empty with ScannedTimes
+    static constexpr int PRUNE_ATTEMPTS = 4;//then a plan is finished in one slice
+
+    void loadTree(ostream& err) override;
+    void createNewVersion();
+    void updateTime();
+    Rope buildContent(TreeNode* node);//from the parent's rope and the node's edit, O(log n)
+    Rope contentOf(TreeNode* node);
+    void setContent(TreeNode* node, string_view content);
+    void postRange(int version_id, const Rope& content, size_t start, size_t end);
+    void catchUpSearchIndex();//posts what changed since the last GREP, or builds the index
+public:
+    static constexpr FileLayout LAYOUT = {Content::LAYOUT, Policies::Index::LAYOUT, Times::LAYOUT};
+    typename Policies::Index::Map version_map;
+    explicit BasicFile(string initial_message);
+    BasicFile(TreeSource* source, size_t index, int total_versions);//tree is built on first use
+
+    using File::read;
+    using File::snapshot;
+    void read(ostream& out, ostream& err) override;
+    void read(int version_id) override;
+    void insert(string_view content) override;
+    void update(string_view content) override;
+    void snapshot(string_view msg, ostream& out, ostream& err) override;
+    bool setActive(int version_id) override;
+    void ancestor(int version_id, int k) override;
+    void lowestCommonAncestor(int version1, int version2) override;
+    void isAncestor(int version1, int version2) override;
+    TreeNode* snapshotAt(Stamp time) override;
+    size_t grep(string_view pattern, vector<GrepMatch>& matches) override;
+    void diff(int version1, int version2) override;
+    void merge(int version1, int version2) override;
+    bool prunePlan(PruneJob& job, chrono::steady_clock::time_point deadline) override;
+    void pruneCommit(PruneJob& job) override;
+    TreeNode* version(int version_id) override { return version_map.get(version_id); }
+    TreeNode* addVersion(int version_id, TreeNode* parent, string message) override;
+    void reserveVersions(size_t count) override { version_map.reserve(count); }
+};
+
+// The layout every file had before layouts could be chosen, and the one CREATE uses
+// by default.
+typedef BasicFile<FilePolicies<DeltaContent, HashIndex, IndexedTimes>> DefaultFile;
+
+// A new file of the given layout: with just a root version, or built from source on
+// first use.
+File* makeFile(FileLayout layout, string initial_message);
+File* makeFile(FileLayout layout, TreeSource* source, size_t index, int total_versions);
+
+// A struct to hold the file properties for heap operations.
+struct Fileppt {
+    string filename;
+    Stamp last_modified;//unique, so files never tie on recency
+    int total_versions;
+    int id;//position of the file in FileSystem::file_order, used as the heap's handle
+};
+
+// Custom hash map for string keys (filenames) to File*
+typedef HashTable<string, File*, StringHash, PROBE_FILE_MAP> FileMap;
+
+// The Heap data structure, specifically for fileproperties.
+// Indexed: position[id] tracks where each file sits, so a file's key can be raised or
+// lowered in place and the heap kept up to date across commands instead of rebuilt.
+// Ties on the key are broken by filename.
+class FileHeap {
+public:
+    FileHeap(bool sort_by_recent);
+    ~FileHeap();
+
+    void push(const Fileppt& value);
+    void build(vector<Fileppt> values);//replaces the contents, O(n) bottom-up heapify
+    Fileppt pop();
+    bool empty();
+    bool contains(int id);
+    void update(int id, Stamp last_modified, int total_versions);//increase- or decrease-key
+    vector<Fileppt> top(int k);//best k entries in order, O(k log k), heap unchanged
+    vector<Fileppt> heap;
+    vector<int> position;//id -> index in heap, -1 if absent
+    bool sort_by_recent;
+
+    void swapEntries(unsigned int a, unsigned int b);
+    void heapifyUp(unsigned int index);//unsigned int handles negative values if given by mistake. Heapify up to maintain heap property
+    void heapifyDown(unsigned int index);//heapify down to maintain heap property
+    bool compare(Fileppt& a, Fileppt& b);//Comparison function to determine heap order
+};
+
+// Persistent hash array mapped trie from string keys to ints: a copy shares the whole
+// tree, so copying a map is O(1) however large it is. Each level picks one of 32 slots
+// with 5 bits of the key's hash; a slot holds a key or a subtrie, and a node stores only
+// its occupied slots (two bitmaps, then the entries and children packed in slot order).
+// set() copies the O(log32 n) nodes on the key's path that another map shares and
+// changes the rest in place. Reference counts are atomic, because maps sharing nodes
+// may be changed under different locks; any one map needs its own lock.
+struct TrieNode;
+class PersistentMap {
+private:
+    TrieNode* root;
+    size_t count;
+public:
+    PersistentMap() : root(nullptr), count(0) {}
+    PersistentMap(const PersistentMap& other);
+    PersistentMap& operator=(PersistentMap other){
+        swap(root, other.root);
+        swap(count, other.count);
+        return *this;
+    }
+    ~PersistentMap();
+
+    int get(string_view key) const;//-1 if absent
+    void set(string_view key, int value);
+    size_t size() const { return count; }
+    // Calls visit(key, value) for every key whose value differs from its value in base, or
+    // that base lacks. Subtries the two maps share are skipped, so this costs time in
+    // proportion to what changed since one was copied from the other, not to their size.
+    void forEachChange(const PersistentMap& base, const function<void(const string&, int)>& visit) const;
+    void forEach(const function<void(const string&, int)>& visit) const;
+};
+#endif
@@ -0,0 +1,286 @@
+#include "Diff.hpp"
+#include "DataStructures.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// BYTE TRIMMING
+size_t commonPrefixLength(const char* a, const char* b, size_t n){
+    size_t i=0;
+#ifdef __SSE2__
+    for(; i+16<=n; i+=16){
+        __m128i x=_mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i));
+        __m128i y=_mm_loadu_si128(reinterpret_cast<const __m128i*>(b+i));
+        unsigned int equal=_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if(equal!=0xFFFF) return i+__builtin_ctz(~equal);
+    }
+#endif
+    for(; i+8<=n; i+=8){
+        uint64_t x, y;
+        memcpy(&x, a+i, 8);
+        memcpy(&y, b+i, 8);
+        if(x!=y) return i+(__builtin_ctzll(x^y)>>3);//little-endian: lowest differing byte
+    }
+    while(i<n && a[i]==b[i]) i++;
+    return i;
+}
+
+size_t commonSuffixLength(const char* a_end, const char* b_end, size_t n){
+    size_t i=0;
+#ifdef __SSE2__
+    for(; i+16<=n; i+=16){
+        __m128i x=_mm_loadu_si128(reinterpret_cast<const __m128i*>(a_end-i-16));
+        __m128i y=_mm_loadu_si128(reinterpret_cast<const __m128i*>(b_end-i-16));
+        unsigned int equal=_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if(equal!=0xFFFF) return i+__builtin_clz(~equal<<16);//highest differing byte
+    }
+#endif
+    for(; i+8<=n; i+=8){
+        uint64_t x, y;
+        memcpy(&x, a_end-i-8, 8);
+        memcpy(&y, b_end-i-8, 8);
+        if(x!=y) return i+(__builtin_clzll(x^y)>>3);//little-endian: highest differing byte
+    }
+    while(i<n && a_end[-1-(ptrdiff_t)i]==b_end[-1-(ptrdiff_t)i]) i++;
+    return i;
+}
+
+size_t findSubstring(string_view haystack, string_view needle){
+    size_t n=haystack.size(), m=needle.size();
+    if(m==0) return 0;
+    if(m>n) return string_view::npos;
+    const char* h=haystack.data();
+    size_t i=0;
+#ifdef __SSE2__
+    __m128i first=_mm_set1_epi8(needle[0]);
+    __m128i last=_mm_set1_epi8(needle[m-1]);
+    for(; i+m-1+16<=n; i+=16){
+        __m128i starts=_mm_loadu_si128(reinterpret_cast<const __m128i*>(h+i));
+        __m128i ends=_mm_loadu_si128(reinterpret_cast<const __m128i*>(h+i+m-1));
+        unsigned int both=_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, first), _mm_cmpeq_epi8(ends, last)));
+        for(; both; both&=both-1){
+            size_t at=i+__builtin_ctz(both);
+            if(memcmp(h+at, needle.data(), m)==0) return at;
+        }
+    }
+#endif
+    for(; i+m<=n; i++){
+        const void* found=memchr(h+i, needle[0], n-m+1-i);
+        if(!found) break;
+        i=static_cast<const char*>(found)-h;
+        if(memcmp(h+i, needle.data(), m)==0) return i;
+    }
+    return string_view::npos;
+}
+
+vector<string_view> splitLines(string_view text){
+    vector<string_view> lines;
+    size_t start=0;
+    while(start<text.size()){
+        const void* newline=memchr(text.data()+start, '\n', text.size()-start);
+        size_t end=newline ? static_cast<const char*>(newline)-text.data()+1 : text.size();
+        lines.push_back(text.substr(start, end-start));
+        start=end;
+    }
+    return lines;
+}
+
+// MYERS DIFF
+// Sequences are line ids; removed/added mark the lines that are not part of the longest
+// common subsequence found.
+namespace {
+class MyersDiff {
+public:
+    const int* x;
+    const int* y;
+    vector<char> removed;
+    vector<char> added;
+    vector<int> forward;//furthest-reaching x per diagonal (x - y), offset by diagonal_offset
+    vector<int> backward;
+    int diagonal_offset;
+
+    MyersDiff(const vector<int>& a, const vector<int>& b)
+        : x(a.data()), y(b.data()), removed(a.size(), 0), added(b.size(), 0),
+          forward(a.size()+b.size()+3), backward(a.size()+b.size()+3), diagonal_offset(b.size()+1) {}
+
+    // Finds a point (x_mid, y_mid) on an optimal path through the box by running the
+    // greedy search from both corners until the frontiers overlap.
+    void middleSnake(int x_off, int x_lim, int y_off, int y_lim, int& x_mid, int& y_mid){
+        int* fd=forward.data()+diagonal_offset;
+        int* bd=backward.data()+diagonal_offset;
+        int d_min=x_off-y_lim, d_max=x_lim-y_off;
+        int f_mid=x_off-y_off, b_mid=x_lim-y_lim;
+        int f_min=f_mid, f_max=f_mid, b_min=b_mid, b_max=b_mid;
+        bool odd=(f_mid-b_mid) & 1;
+        fd[f_mid]=x_off;
+        bd[b_mid]=x_lim;
+        while(true){
+            if(f_min>d_min) fd[--f_min-1]=-1; else f_min++;
+            if(f_max<d_max) fd[++f_max+1]=-1; else f_max--;
+            for(int d=f_max; d>=f_min; d-=2){
+                int low=fd[d-1], high=fd[d+1];
+                int xi=low>=high ? low+1 : high;
+                int yi=xi-d;
+                while(xi<x_lim && yi<y_lim && x[xi]==y[yi]){ xi++; yi++; }
+                fd[d]=xi;
+                if(odd && b_min<=d && d<=b_max && bd[d]<=xi){
+                    x_mid=xi;
+                    y_mid=yi;
+                    return;
+                }
+            }
+            if(b_min>d_min) bd[--b_min-1]=INT_MAX; else b_min++;
+            if(b_max<d_max) bd[++b_max+1]=INT_MAX; else b_max--;
+            for(int d=b_max; d>=b_min; d-=2){
+                int low=bd[d-1], high=bd[d+1];
+                int xi=low<high ? low : high-1;
+                int yi=xi-d;
+                while(xi>x_off && yi>y_off && x[xi-1]==y[yi-1]){ xi--; yi--; }
+                bd[d]=xi;
+                if(!odd && f_min<=d && d<=f_max && xi<=fd[d]){
+                    x_mid=xi;
+                    y_mid=yi;
+                    return;
+                }
+            }
+        }
+    }
+
+    void compare(int x_off, int x_lim, int y_off, int y_lim){
+        while(x_off<x_lim && y_off<y_lim && x[x_off]==y[y_off]){ x_off++; y_off++; }
+        while(x_lim>x_off && y_lim>y_off && x[x_lim-1]==y[y_lim-1]){ x_lim--; y_lim--; }
+        if(x_off==x_lim){
+            fill(added.begin()+y_off, added.begin()+y_lim, 1);
+        } else if(y_off==y_lim){
+            fill(removed.begin()+x_off, removed.begin()+x_lim, 1);
+        } else {
+            int x_mid, y_mid;
+            middleSnake(x_off, x_lim, y_off, y_lim, x_mid, y_mid);
+            compare(x_off, x_mid, y_off, y_mid);
+            compare(x_mid, x_lim, y_mid, y_lim);
+        }
+    }
+};
+}
+
+vector<DiffHunk> diffLines(string_view old_text, string_view new_text){
+    //Trim to whole lines: the prefix ends after a newline, the suffix starts after one
+    size_t limit=min(old_text.size(), new_text.size());
+    size_t prefix=commonPrefixLength(old_text.data(), new_text.data(), limit);
+    if(prefix<old_text.size() || prefix<new_text.size()){
+        while(prefix>0 && old_text[prefix-1]!='\n') prefix--;
+    }
+    size_t suffix=commonSuffixLength(old_text.data()+old_text.size(), new_text.data()+new_text.size(), limit-prefix);
+    auto startsLine=[&](size_t length){//the suffix of this length starts a line in both texts
+        size_t old_start=old_text.size()-length, new_start=new_text.size()-length;
+        return (old_start==prefix || old_text[old_start-1]=='\n') && (new_start==prefix || new_text[new_start-1]=='\n');
+    };
+    while(suffix>0 && !startsLine(suffix)) suffix--;
+    size_t prefix_lines=count(old_text.begin(), old_text.begin()+prefix, '\n');
+    vector<string_view> a=splitLines(old_text.substr(prefix, old_text.size()-prefix-suffix));
+    vector<string_view> b=splitLines(new_text.substr(prefix, new_text.size()-prefix-suffix));
+
+    HashTable<string_view, int, StringHash> ids;
+    ids.reserve(a.size()+b.size());
+    vector<int> a_ids(a.size()), b_ids(b.size());
+    auto intern=[&](string_view line){
+        int* id=ids.find(line);
+        if(id) return *id;
+        int next=ids.size();
+        ids.insert(line, next);
+        return next;
+    };
+    for(size_t i=0; i<a.size(); i++) a_ids[i]=intern(a[i]);
+    for(size_t i=0; i<b.size(); i++) b_ids[i]=intern(b[i]);
+
+    MyersDiff diff(a_ids, b_ids);
+    diff.compare(0, a.size(), 0, b.size());
+
+    vector<DiffHunk> hunks;
+    size_t i=0, j=0;
+    while(i<a.size() || j<b.size()){
+        if(i<a.size() && j<b.size() && !diff.removed[i] && !diff.added[j]){
+            i++;
+            j++;
+            continue;
+        }
+        DiffHunk hunk={prefix_lines+i, 0, prefix_lines+j, 0};
+        while(i<a.size() && diff.removed[i]){ i++; hunk.old_count++; }
+        while(j<b.size() && diff.added[j]){ j++; hunk.new_count++; }
+        hunks.push_back(hunk);
+    }
+    return hunks;
+}
+
+// THREE-WAY MERGE
+// Concatenation of lines [start, start+count) as one view into the text they came from.
+static string_view lineRange(const vector<string_view>& lines, size_t start, size_t count){
+    if(count==0) return string_view();
+    const char* begin=lines[start].data();
+    const char* end=lines[start+count-1].data()+lines[start+count-1].size();
+    return string_view(begin, end-begin);
+}
+
+static void appendLine(string& out, string_view text){
+    out.append(text.data(), text.size());
+    if(!text.empty() && text.back()!='\n') out+='\n';//markers must start on their own line
+}
+
+MergeResult mergeLines(string_view base, string_view ours, string_view theirs,
+                       const string& ours_label, const string& theirs_label){
+    vector<string_view> base_lines=splitLines(base), our_lines=splitLines(ours), their_lines=splitLines(theirs);
+    vector<DiffHunk> mine=diffLines(base, ours), other=diffLines(base, theirs);
+    MergeResult result{string(), 0};
+    result.content.reserve(max(ours.size(), theirs.size()));
+    size_t position=0, i=0, j=0;
+    //Offsets (new - old line numbers) of each side before the current group
+    long our_shift=0, their_shift=0;
+    while(i<mine.size() || j<other.size()){
+        //A group is a maximal chain of hunks, from either side, that overlap or touch
+        bool from_mine=j==other.size() || (i<mine.size() && mine[i].old_start<=other[j].old_start);
+        size_t low=from_mine ? mine[i].old_start : other[j].old_start;
+        size_t high=low;
+        size_t first_mine=i, first_other=j;
+        while(true){
+            if(i<mine.size() && mine[i].old_start<=high){
+                high=max(high, mine[i].old_start+mine[i].old_count);
+                i++;
+            } else if(j<other.size() && other[j].old_start<=high){
+                high=max(high, other[j].old_start+other[j].old_count);
+                j++;
+            } else {
+                break;
+            }
+        }
+        result.content.append(lineRange(base_lines, position, low-position));
+        //Each side's text for base lines [low, high): unchanged lines are shifted by the
+        //side's offset, so the range ends where the side's last hunk leaves off.
+        long our_end_shift=our_shift, their_end_shift=their_shift;
+        for(size_t k=first_mine; k<i; k++) our_end_shift+=(long)mine[k].new_count-(long)mine[k].old_count;
+        for(size_t k=first_other; k<j; k++) their_end_shift+=(long)other[k].new_count-(long)other[k].old_count;
+        string_view our_text=lineRange(our_lines, low+our_shift, high+our_end_shift-(low+our_shift));
+        string_view their_text=lineRange(their_lines, low+their_shift, high+their_end_shift-(low+their_shift));
+        if(first_other==j || our_text==their_text){
+            result.content.append(our_text);
+        } else if(first_mine==i){
+            result.content.append(their_text);
+        } else {
+            result.conflicts++;
+            result.content+="<<<<<<< "+ours_label+"\n";
+            appendLine(result.content, our_text);
+            result.content+="=======\n";
+            appendLine(result.content, their_text);
+            result.content+=">>>>>>> "+theirs_label+"\n";
+        }
+        our_shift=our_end_shift;
+        their_shift=their_end_shift;
+        position=high;
+    }
+    result.content.append(lineRange(base_lines, position, base_lines.size()-position));
+    return result;
+}
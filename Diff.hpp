@@ -0,0 +1,47 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// Length of the common prefix / suffix of two buffers of n bytes each, compared 16
+// bytes at a time with SSE2 where available, 8 at a time otherwise.
+size_t commonPrefixLength(const char* a, const char* b, size_t n);
+size_t commonSuffixLength(const char* a_end, const char* b_end, size_t n);//compares backwards from the ends
+
+// First occurrence of needle in haystack, or string_view::npos. With SSE2, 16 start
+// positions are tested at once against the needle's first and last bytes, and the whole
+// needle compared only where both match.
+size_t findSubstring(string_view haystack, string_view needle);
+
+// A run of lines that differ: old lines [old_start, old_start+old_count) are replaced
+// by new lines [new_start, new_start+new_count). Lines are numbered from 0.
+struct DiffHunk {
+    size_t old_start;
+    size_t old_count;
+    size_t new_start;
+    size_t new_count;
+};
+
+// Splits text into lines, each keeping its '\n' (the last one may have none), so
+// concatenating the lines gives back the text exactly.
+vector<string_view> splitLines(string_view text);
+
+// Line diff of old_text -> new_text. The common prefix and suffix are trimmed bytewise
+// first, then the rest is compared with Myers' linear-space algorithm (the middle-snake
+// divide and conquer) over interned line ids: O((N+M)D) time, O(N+M) space.
+vector<DiffHunk> diffLines(string_view old_text, string_view new_text);
+
+struct MergeResult {
+    string content;
+    int conflicts;
+};
+
+// Three-way line merge. Changes from base to ours and from base to theirs are combined;
+// where both sides change overlapping (or touching) base lines differently, both
+// versions are kept between conflict markers labelled with ours_label/theirs_label.
+MergeResult mergeLines(string_view base, string_view ours, string_view theirs,
+                       const string& ours_label, const string& theirs_label);
+#endif
@@ -0,0 +1,1027 @@
+#include "FileSystem.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+// Resolves a command word by switching on its length and first character, so at most
+// one string comparison is made.
+Opcode parseOpcode(string_view cmd) {
+    switch(cmd.size()){
+    case 3:
+        switch(cmd[0]){
+        case 'L': if(cmd=="LCA") return Opcode::LCA; break;
+        case 'T': if(cmd=="TAG") return Opcode::TAG; break;
+        }
+        break;
+    case 4:
+        switch(cmd[0]){
+        case 'R': if(cmd=="READ") return Opcode::READ; break;
+        case 'T': if(cmd=="TAGS") return Opcode::TAGS; break;
+        case 'S': if(cmd=="SAVE") return Opcode::SAVE; break;
+        case 'D': if(cmd=="DIFF") return Opcode::DIFF; break;
+        case 'G': if(cmd=="GREP") return Opcode::GREP; break;
+        }
+        break;
+    case 5:
+        switch(cmd[0]){
+        case 'M': if(cmd=="MERGE") return Opcode::MERGE; break;
+        case 'P': if(cmd=="PRUNE") return Opcode::PRUNE; break;
+        case 'S': if(cmd=="STATS") return Opcode::STATS; break;
+        }
+        break;
+    case 6:
+        switch(cmd[0]){
+        case 'C': if(cmd=="CREATE") return Opcode::CREATE; break;
+        case 'I':
+            if(cmd=="INSERT") return Opcode::INSERT;
+            if(cmd=="IMPORT") return Opcode::IMPORT;
+            break;
+        case 'U': if(cmd=="UPDATE") return Opcode::UPDATE; break;
+        case 'B': if(cmd=="BRANCH") return Opcode::BRANCH; break;
+        }
+        break;
+    case 7:
+        switch(cmd[0]){
+        case 'H': if(cmd=="HISTORY") return Opcode::HISTORY; break;
+        case 'R': if(cmd=="READ_AT") return Opcode::READ_AT; break;
+        }
+        break;
+    case 8:
+        switch(cmd[0]){
+        case 'S': if(cmd=="SNAPSHOT") return Opcode::SNAPSHOT; break;
+        case 'R': if(cmd=="ROLLBACK") return Opcode::ROLLBACK; break;
+        case 'A': if(cmd=="ANCESTOR") return Opcode::ANCESTOR; break;
+        case 'C': if(cmd=="CHECKOUT") return Opcode::CHECKOUT; break;
+        }
+        break;
+    case 10:
+        if(cmd=="MULTI_READ") return Opcode::MULTI_READ;
+        break;
+    case 11:
+        switch(cmd[0]){
+        case 'I': if(cmd=="IS_ANCESTOR") return Opcode::IS_ANCESTOR; break;
+        case 'S': if(cmd=="SNAPSHOT_AT") return Opcode::SNAPSHOT_AT; break;
+        }
+        break;
+    case 12:
+        if(cmd=="RECENT_FILES") return Opcode::RECENT_FILES;
+        break;
+    case 13:
+        switch(cmd[0]){
+        case 'B': if(cmd=="BIGGEST_TREES") return Opcode::BIGGEST_TREES; break;
+        case 'S': if(cmd=="STORAGE_STATS") return Opcode::STORAGE_STATS; break;
+        }
+        break;
+    case 14:
+        if(cmd=="MULTI_SNAPSHOT") return Opcode::MULTI_SNAPSHOT;
+        break;
+    }
+    return Opcode::UNKNOWN;
+}
+
+// Command words by Opcode, for STATS.
+static const char* const OPCODE_NAMES[]={
+    "CREATE", "READ", "INSERT", "UPDATE", "SNAPSHOT", "ROLLBACK", "HISTORY",
+    "ANCESTOR", "LCA", "IS_ANCESTOR", "DIFF", "MERGE", "PRUNE", "READ_AT", "SNAPSHOT_AT",
+    "IMPORT", "MULTI_READ", "MULTI_SNAPSHOT", "GREP", "TAG", "BRANCH", "CHECKOUT", "TAGS", "RECENT_FILES", "BIGGEST_TREES", "STORAGE_STATS", "STATS", "SAVE", "(unknown)"
+};
+static_assert(size(OPCODE_NAMES)==(size_t)Opcode::UNKNOWN+1, "OPCODE_NAMES must follow Opcode");
+static_assert((int)Opcode::UNKNOWN<Stats::COMMANDS, "Stats::COMMANDS is too small");
+
+// Returns false on any junk or overflow.
+bool parseNumber(string_view text, int& value) {
+    if(text.empty()) return false;
+    auto result=from_chars(text.data(), text.data()+text.size(), value);
+    return result.ec==errc() && result.ptr==text.data()+text.size() && value>=0;
+}
+
+// Unix seconds, up to the last second whose stamps an int64 Stamp can hold.
+static bool parseUnixTime(string_view text, int64_t& seconds) {
+    if(text.empty()) return false;
+    auto result=from_chars(text.data(), text.data()+text.size(), seconds);
+    return result.ec==errc() && result.ptr==text.data()+text.size() && seconds>=0
+           && seconds<INT64_MAX/STAMPS_PER_SECOND;
+}
+
+bool parseNumberPair(string_view text, int& first, int& second) {
+    size_t space=text.find(' ');
+    if(space==string_view::npos) return false;
+    return parseNumber(text.substr(0, space), first) && parseNumber(text.substr(space+1), second);
+}
+
+// One of "content=delta|whole|private", "index=hash|dense" or "times=indexed|scanned".
+static bool parseLayoutOption(string_view option, FileLayout& layout){
+    if(option=="content=delta") layout.content=FileLayout::DELTA;
+    else if(option=="content=whole") layout.content=FileLayout::WHOLE;
+    else if(option=="content=private") layout.content=FileLayout::PRIVATE;
+    else if(option=="index=hash") layout.index=FileLayout::HASH;
+    else if(option=="index=dense") layout.index=FileLayout::DENSE;
+    else if(option=="times=indexed") layout.times=FileLayout::INDEXED;
+    else if(option=="times=scanned") layout.times=FileLayout::SCANNED;
+    else return false;
+    return true;
+}
+
+// CREATE's options, each optional and in any order; what is not given keeps
+// DefaultFile's policy.
+static bool parseLayout(string_view text, FileLayout& layout){
+    layout=DefaultFile::LAYOUT;
+    while(!text.empty()){
+        size_t space=text.find(' ');
+        string_view option=text.substr(0, space);
+        text=space==string_view::npos ? string_view() : text.substr(space+1);
+        if(!option.empty() && !parseLayoutOption(option, layout)) return false;
+    }
+    return true;
+}
+
+// IMPORT's arguments: layout options as CREATE takes them, then the path, which may hold
+// spaces, so the options are only the leading words that parse as one.
+static string_view parseImportLayout(string_view text, FileLayout& layout){
+    layout=DefaultFile::LAYOUT;
+    while(true){
+        size_t space=text.find(' ');
+        if(space==string_view::npos || !parseLayoutOption(text.substr(0, space), layout)) return text;
+        text.remove_prefix(space+1);
+    }
+}
+
+// Whether a mutating command's arguments are ones its handler will act on, checked with
+// the file's lock held and its tree built. A command the handler rejects changes
+// nothing, so it is not logged (nor waited on under --wal-sync); the handler still
+// prints the error.
+static bool acceptsArguments(Opcode op, File* f, string_view rest){
+    if(!f->active_version) return false;
+    if(op==Opcode::ROLLBACK){
+        if(rest.empty()) return f->active_version->parent!=nullptr;
+        int version_id=0;
+        return parseNumber(rest, version_id) && f->version(version_id);
+    }
+    if(op==Opcode::MERGE){
+        int first=0, second=0;
+        if(!parseNumberPair(rest, first, second)) return false;
+        TreeNode* ours=f->version(first);
+        return ours && ours->isSnapshot() && f->version(second);
+    }
+    return true;//INSERT, UPDATE and SNAPSHOT take any text
+}
+
+// "a,b,c" as views into list, each name once, in order of first mention.
+static vector<string_view> splitNames(string_view list){
+    vector<string_view> names;
+    while(!list.empty()){
+        size_t comma=list.find(',');
+        string_view name=list.substr(0, comma);
+        if(!name.empty() && find(names.begin(), names.end(), name)==names.end()) names.push_back(name);
+        list.remove_prefix(comma==string_view::npos ? list.size() : comma+1);
+    }
+    return names;
+}
+
+// Threads parallelFor uses: one per core, but only one per min_per_thread tasks.
+static size_t threadsFor(size_t count, size_t min_per_thread){
+    return max(min((size_t)thread::hardware_concurrency(), count/min_per_thread), (size_t)1);
+}
+
+// Runs task(i) for every i below count on threadsFor(count, min_per_thread) threads, the
+// calling thread among them, each claiming the next index when it finishes one.
+template <typename Task>
+static void parallelFor(size_t count, size_t min_per_thread, Task task){
+    size_t threads=threadsFor(count, min_per_thread);
+    atomic<size_t> next{0};
+    auto work=[&]{
+        for(size_t i=next.fetch_add(1); i<count; i=next.fetch_add(1)) task(i);
+    };
+    vector<thread> helpers;
+    for(size_t t=1; t<threads; t++) helpers.emplace_back(work);
+    work();
+    for(thread& helper : helpers) helper.join();
+}
+
+FileSystem::~FileSystem(){
+    delete stats_dumper;
+    delete cold_tier;
+    for(size_t i=0; i<file_order.size(); i++){
+        delete find(file_order[i]);
+    }
+    delete repository;//after the files, whose content may point into its mapping
+    delete wal;//flushes anything still pending
+}
+
+bool FileSystem::load(const string& path, string& error){
+    if(fileCount()>0 || repository){
+        error="Can only load into an empty file system.";
+        return false;
+    }
+    Repository* loaded=new Repository();
+    if(!loaded->open(path, error)){
+        delete loaded;
+        return false;
+    }
+    repository=loaded;
+    repository->populate(*this);
+    return true;
+}
+
+bool FileSystem::openLog(const string& path, size_t& replayed, string& error){
+    WriteAheadLog* log=new WriteAheadLog();
+    replayed=0;
+    replaying=true;
+    // Replayed commands print what they printed the first time; nobody is listening.
+    streambuf* saved_out=cout.rdbuf(nullptr);
+    streambuf* saved_err=cerr.rdbuf(nullptr);
+    bool ok=log->open(path, repository ? repository->checkpointLsn() : 0, [&](int64_t timestamp, string_view command){
+        setTimeOverride(timestamp);//versions keep their original timestamps
+        processCommand(command);
+        replayed++;
+    }, error);
+    setTimeOverride(0);
+    cout.rdbuf(saved_out);
+    cerr.rdbuf(saved_err);
+    cout.clear();
+    cerr.clear();
+    replaying=false;
+    if(!ok){
+        delete log;
+        return false;
+    }
+    wal=log;
+    return true;
+}
+
+FileShard& FileSystem::shardFor(string_view filename){
+    //Top bits: the shard's own table indexes with the low ones.
+    return shards[hashBytes(filename.data(), filename.size())>>(64-SHARD_BITS)];
+}
+
+File* FileSystem::find(string_view filename){
+    FileShard& shard=shardFor(filename);
+    shared_lock<shared_mutex> guard(shard.lock);
+    return shard.files.get(filename);//files are never removed, so f outlives the lock
+}
+
+size_t FileSystem::fileCount(){
+    lock_guard<mutex> guard(order_lock);
+    return file_order.size();
+}
+
+string FileSystem::statsReport(){
+#if FS_STATS
+    string report;
+    char line[160];
+    report+="Command latency (us):\n";
+    snprintf(line, sizeof(line), "  %-14s %10s %9s %9s %9s %9s\n", "command", "count", "p50", "p99", "p99.9", "max");
+    report+=line;
+    for(int i=0; i<=(int)Opcode::UNKNOWN; i++){
+        MergedHistogram h=Stats::command(i);
+        if(h.total==0) continue;
+        snprintf(line, sizeof(line), "  %-14s %10llu %9.1f %9.1f %9.1f %9.1f\n", OPCODE_NAMES[i],
+                 (unsigned long long)h.total, h.percentile(0.5)/1e3, h.percentile(0.99)/1e3,
+                 h.percentile(0.999)/1e3, h.largest/1e3);
+        report+=line;
+    }
+    report+="Hash table probes (groups scanned per lookup):\n";
+    const char* sites[PROBE_SITES]={"VersionMap", "FileMap"};
+    for(int i=0; i<PROBE_SITES; i++){
+        MergedHistogram h=Stats::probes((ProbeSite)i);
+        snprintf(line, sizeof(line), "  %-14s %10llu lookups, mean %.2f, p99 %llu, max %llu\n", sites[i],
+                 (unsigned long long)h.total, h.mean(), (unsigned long long)h.percentile(0.99),
+                 (unsigned long long)h.largest);
+        report+=line;
+    }
+    int64_t nodes=Stats::nodes();
+    report+="Memory:\n";
+    snprintf(line, sizeof(line), "  Version nodes: %lld (%llu bytes)\n", (long long)nodes,
+             (unsigned long long)(nodes*sizeof(TreeNode)));
+    report+=line;
+    snprintf(line, sizeof(line), "  Content bytes: %zu resident, %zu compressed\n",
+             BlobStore::instance().residentBytes(), BlobStore::instance().compressedBytes());
+    report+=line;
+    return report;
+#else
+    return "Statistics are compiled out (build without -DFS_STATS=0 to enable them).\n";
+#endif
+}
+
+void FileSystem::processCommand(string_view command){
+    // Input Parsing: split only first two tokens, rest is content/message (can be empty).
+    // All three are views into command, nothing is copied.
+    string_view cmd, filename, rest;
+    size_t pos1 = command.find(' ');//find the space character
+    if(pos1== string_view::npos){//No space, entire string is treated as a command
+        cmd=command;
+    } else {
+        cmd=command.substr(0,pos1);
+        size_t pos2=command.find(' ', pos1 + 1);//sssearch another space after the first space
+        if(pos2 == string_view::npos){//No second space, rest of the string is filename
+            filename = command.substr(pos1 + 1);
+        } else {
+            filename = command.substr(pos1 + 1, pos2 - pos1 - 1);
+            rest = command.substr(pos2 + 1); // content or message, can be empty
+        }
+    }
+
+    if(cmd.empty()) return;//If empty command is given, ignore it
+
+    Opcode op=parseOpcode(cmd);
+    if(filename.empty() && op!=Opcode::RECENT_FILES && op!=Opcode::BIGGEST_TREES && op!=Opcode::STORAGE_STATS
+       && op!=Opcode::STATS && op!=Opcode::TAGS){
+        op=Opcode::UNKNOWN;//every other command needs a filename
+    }
+    FS_STAT(CommandTimer timer((int)op));
+    switch(op){
+    case Opcode::CREATE: handleCreate(filename, command, rest); break;
+    case Opcode::READ:
+    case Opcode::READ_AT:
+    case Opcode::INSERT:
+    case Opcode::UPDATE:
+    case Opcode::SNAPSHOT:
+    case Opcode::ROLLBACK:
+    case Opcode::HISTORY:
+    case Opcode::ANCESTOR:
+    case Opcode::LCA:
+    case Opcode::IS_ANCESTOR:
+    case Opcode::DIFF:
+    case Opcode::MERGE: {
+        bool mutating=op==Opcode::INSERT || op==Opcode::UPDATE || op==Opcode::SNAPSHOT || op==Opcode::ROLLBACK
+                      || op==Opcode::MERGE;
+        FileShard& shard=shardFor(filename);
+        shared_lock<shared_mutex> shard_guard(shard.lock);
+        File* f=shard.files.get(filename);
+        if(!mutating) shard_guard.unlock();//files are never removed, so f outlives the lock
+        if(!f){
+            cerr<<"Error: File '"<<filename<<"' not found."<<'\n';
+            break;
+        }
+        int version_id=-1;
+        if(op==Opcode::READ && !rest.empty()){
+            if(!parseNumber(rest, version_id)){
+                cerr<<"Error: Invalid version ID provided."<<'\n';
+                break;
+            }
+            if(f->readSnapshot(version_id)) break;//published snapshot: no lock needed
+        }
+        lock_guard<mutex> guard(f->lock);
+        if(mutating){
+            f->ensureLoaded();//a lazily loaded file has no active version until its tree is built
+            if(acceptsArguments(op, f, rest) && !logCommand(command)) break;
+        }
+        switch(op){
+        case Opcode::READ: handleRead(f, version_id); break;
+        case Opcode::READ_AT: handleReadAt(f, rest); break;
+        case Opcode::INSERT: handleInsert(f, rest); break;
+        case Opcode::UPDATE: handleUpdate(f, rest); break;
+        case Opcode::SNAPSHOT: handleSnapshot(f, rest); break;
+        case Opcode::ROLLBACK: handleRollback(f, rest); break;
+        case Opcode::HISTORY: handleHistory(f, rest); break;
+        default: handleVersionPair(op, f, rest); break;
+        }
+        if(mutating){
+            reindex(filename, f);
+            setTimeOverride(0);
+        }
+        break;
+    }
+    case Opcode::PRUNE: handlePrune(filename, command, rest); break;
+    case Opcode::SNAPSHOT_AT: handleSnapshotAt(filename); break;
+    case Opcode::IMPORT: handleImport(command.substr(pos1+1), command); break;//the path may hold spaces
+    case Opcode::MULTI_READ: handleMultiRead(filename); break;
+    case Opcode::MULTI_SNAPSHOT: handleMultiSnapshot(filename, command, rest); break;
+    case Opcode::GREP: handleGrep(filename, rest); break;
+    case Opcode::TAG:
+    case Opcode::BRANCH: handleTag(filename, command, op==Opcode::BRANCH); break;
+    case Opcode::CHECKOUT: handleCheckout(filename, command); break;
+    case Opcode::TAGS: handleTags(); break;
+    case Opcode::RECENT_FILES:
+    case Opcode::BIGGEST_TREES: {
+        int num = 5;
+        if(!filename.empty() && !parseNumber(filename, num)){
+            cerr<<"Error: Number of files must be a non-negative integer."<<'\n';
+            break;
+        }
+        if(op==Opcode::RECENT_FILES) handleRecentFiles(num);
+        else handleBiggestTrees(num);
+        break;
+    }
+    case Opcode::STORAGE_STATS:
+        BlobStore::instance().printStats();
+        if(wal) wal->printStats();
+        break;
+    case Opcode::STATS: cout<<statsReport(); break;
+    case Opcode::SAVE: handleSave(filename); break;
+    case Opcode::UNKNOWN: cerr<<"Error: Unknown command."<<'\n'; break;
+    }
+}
+
+bool FileSystem::logCommand(string_view command){
+    if(!wal || replaying) return true;
+    Stamp now=currentTime();
+    uint64_t lsn=wal->append(now, command);
+    if(lsn==0 || (wal_sync && !wal->waitDurable(lsn))){
+        cerr<<"Error: Cannot write the write-ahead log; the command was not applied. SAVE to start a new log."<<'\n';
+        return false;
+    }
+    setTimeOverride(now);
+    return true;
+}
+
+void FileSystem::reindex(string_view filename, File* f){
+    if(!f->active_version) return;//a tree that is not built yet has nothing new to index
+    FileShard& shard=shardFor(filename);
+    lock_guard<mutex> guard(shard.index_lock);
+    shard.recent_index.update(f->slot, f->active_version->created_timestamp, f->total_versions);
+    shard.biggest_index.update(f->slot, f->active_version->created_timestamp, f->total_versions);
+    TreeNode* committed=f->active_version->isSnapshot() ? f->active_version : f->active_version->parent;
+    if(committed->version_id!=f->committed_version){//not after INSERT or UPDATE, which keep the parent
+        f->committed_version=committed->version_id;
+        shard.versions.set(filename, f->committed_version);
+    }
+}
+
+Checkpoint* FileSystem::findCheckpoint(string_view name){
+    for(Checkpoint& checkpoint : checkpoints){
+        if(checkpoint.name==name) return &checkpoint;
+    }
+    return nullptr;
+}
+
+vector<int> FileSystem::pinnedVersions(string_view filename){
+    size_t s=&shardFor(filename)-shards;
+    vector<int> pinned;
+    for(const Checkpoint& checkpoint : checkpoints){
+        if(checkpoint.versions.empty()) continue;//the current branch, which is the live state
+        int version_id=checkpoint.versions[s].get(filename);
+        if(version_id>=0) pinned.push_back(version_id);
+    }
+    sort(pinned.begin(), pinned.end());
+    pinned.erase(unique(pinned.begin(), pinned.end()), pinned.end());
+    return pinned;
+}
+
+// Each shard's best num entries, merged. Shard indexes are locked one at a time, so
+// the answer may mix shards read at slightly different moments.
+vector<Fileppt> FileSystem::topFiles(bool sort_by_recent, int num){
+    vector<Fileppt> merged;
+    for(size_t i=0; i<SHARDS; i++){
+        lock_guard<mutex> guard(shards[i].index_lock);
+        FileHeap& index=sort_by_recent ? shards[i].recent_index : shards[i].biggest_index;
+        vector<Fileppt> top=index.top(num);
+        merged.insert(merged.end(), make_move_iterator(top.begin()), make_move_iterator(top.end()));
+    }
+    FileHeap order(sort_by_recent);//only for its comparison
+    size_t k=min(merged.size(), (size_t)num);
+    partial_sort(merged.begin(), merged.begin()+k, merged.end(), [&](Fileppt& a, Fileppt& b){
+        return order.compare(a, b);
+    });
+    merged.resize(k);
+    return merged;
+}
+
+void FileSystem::handleCreate(string_view filename, string_view command, string_view options){
+    FileLayout layout;
+    if(!parseLayout(options, layout)){
+        cerr<<"Error: CREATE takes content=delta|whole|private, index=hash|dense and times=indexed|scanned."<<'\n';
+        return;
+    }
+    //order_lock first: SAVE holds it while looking files up, so it never misses a
+    //logged CREATE. CREATEs are serialized, which keeps file ids dense.
+    lock_guard<mutex> order_guard(order_lock);
+    FileShard& shard=shardFor(filename);
+    unique_lock<shared_mutex> guard(shard.lock);
+    if(!shard.files.contains(filename)){
+        if(!logCommand(command)) return;
+        string name(filename);
+        File* f=makeFile(layout, "File created.");
+        f->id=file_order.size();
+        f->slot=shard.next_slot++;
+        shard.files.insert(name, f);
+        file_order.push_back(name);
+        created_index.add(f->root->snapshot_timestamp, f->id);
+        Fileppt entry={name, f->active_version->created_timestamp, f->total_versions, f->slot};
+        {
+            lock_guard<mutex> index_guard(shard.index_lock);
+            shard.recent_index.push(entry);
+            shard.biggest_index.push(entry);
+            shard.versions.set(name, f->committed_version);
+        }
+        setTimeOverride(0);
+        cout<<"File '"<<filename<<"' created successfully."<<'\n';
+    } else {
+        cerr<<"Error: File '"<<filename<<"' already exists."<<'\n';
+    }
+}
+
+void FileSystem::handleRead(File* f, int version_id){
+    if(version_id<0) f->read();
+    else f->read(version_id);
+}
+
+void FileSystem::handleInsert(File* f, string_view content){
+    f->insert(content);
+}
+
+void FileSystem::handleUpdate(File* f, string_view content){
+    f->update(content);
+}
+
+void FileSystem::handleSnapshot(File* f, string_view message){
+    f->snapshot(message);
+}
+
+void FileSystem::handleRollback(File* f, string_view version_str){
+    if(version_str.empty()){
+        f->rollbackToParent();
+    } else {
+        int version_id=0;
+        if(parseNumber(version_str, version_id)){
+            f->rollback(version_id);
+        } else {
+            cerr<<"Error: Invalid version ID provided."<<'\n';
+        }
+    }
+}
+
+void FileSystem::handleReadAt(File* f, string_view time_text){
+    int64_t time=0;
+    if(!parseUnixTime(time_text, time)){
+        cerr<<"Error: Invalid timestamp provided."<<'\n';
+        return;
+    }
+    f->readAt(endOfSecond(time));
+}
+
+void FileSystem::handleHistory(File* f, string_view page){
+    if(page.empty()){
+        f->history();
+        return;
+    }
+    int offset=0, count=20;
+    if(page.find(' ')==string_view::npos ? !parseNumber(page, offset) : !parseNumberPair(page, offset, count)){
+        cerr<<"Error: HISTORY takes an offset and an optional count."<<'\n';
+        return;
+    }
+    f->history(offset, count);
+}
+
+void FileSystem::handleVersionPair(Opcode op, File* f, string_view versions){
+    int first=0, second=0;
+    if(!parseNumberPair(versions, first, second)){
+        cerr<<"Error: Expected two non-negative numbers."<<'\n';
+        return;
+    }
+    if(op==Opcode::ANCESTOR) f->ancestor(first, second);
+    else if(op==Opcode::LCA) f->lowestCommonAncestor(first, second);
+    else if(op==Opcode::IS_ANCESTOR) f->isAncestor(first, second);
+    else if(op==Opcode::DIFF) f->diff(first, second);
+    else f->merge(first, second);
+}
+
+// Runs the prune one slice at a time, releasing the file's lock in between so other
+// commands on the file wait for at most one slice. The command is logged in the slice
+// that commits, which is where it takes effect.
+void FileSystem::handlePrune(string_view filename, string_view command, string_view policy_text){
+    File* f=find(filename);
+    if(!f){
+        cerr<<"Error: File '"<<filename<<"' not found."<<'\n';
+        return;
+    }
+    size_t space=policy_text.find(' ');
+    string_view kind=policy_text.substr(0, space);
+    int64_t value=0;
+    int count=0;
+    bool valid=kind=="LAST" ? parseNumber(policy_text.substr(space+1), count)
+                            : kind=="SINCE" && parseUnixTime(policy_text.substr(space+1), value);
+    if(space==string_view::npos || !valid){
+        cerr<<"Error: PRUNE takes LAST <snapshots> or SINCE <unix time>."<<'\n';
+        return;
+    }
+    PruneJob job(kind=="LAST" ? PrunePolicy{PrunePolicy::KEEP_LAST, count}
+                              : PrunePolicy{PrunePolicy::KEEP_SINCE, value*STAMPS_PER_SECOND});
+    FileShard& shard=shardFor(filename);
+    uint64_t pinned_generation=~uint64_t(0);
+    while(job.stage!=PruneJob::DONE){
+        if(job.stage!=PruneJob::FREE && checkpoint_generation.load()!=pinned_generation){
+            lock_guard<mutex> order_guard(order_lock);
+            pinned_generation=checkpoint_generation.load();
+            job.pinned=pinnedVersions(filename);
+            job.stage=PruneJob::START;
+        }
+        {
+            shared_lock<shared_mutex> shard_guard(shard.lock);//keeps TAG and CHECKOUT out of the commit
+            lock_guard<mutex> guard(f->lock);
+            auto deadline=chrono::steady_clock::now()+PRUNE_SLICE;
+            if(job.stage==PruneJob::FREE){
+                f->pruneFree(job, deadline);
+            } else if(checkpoint_generation.load()!=pinned_generation){
+                //a checkpoint was taken since the pins were read: read them again
+            } else if(f->prunePlan(job, deadline)){
+                if(!logCommand(command)) return;
+                f->pruneCommit(job);
+                reindex(filename, f);
+                setTimeOverride(0);
+            }
+        }
+        if(job.stage!=PruneJob::DONE) this_thread::yield();
+    }
+}
+
+// Files created by then come from created_index; each one's state is then one lookup
+// in its own snapshot index, under its lock. Files are locked one at a time, so a
+// concurrent write to one file may or may not be seen, but nothing after time is shown.
+void FileSystem::handleSnapshotAt(string_view time_text){
+    int64_t time=0;
+    if(!parseUnixTime(time_text, time)){
+        cerr<<"Error: Invalid timestamp provided."<<'\n';
+        return;
+    }
+    Stamp until=endOfSecond(time);
+    vector<string> names;
+    {
+        lock_guard<mutex> guard(order_lock);
+        for(int id : created_index.upTo(until)) names.push_back(file_order[id]);
+    }
+    if(names.empty()){
+        cout<<"No files existed as of "<<formatTime(until)<<"."<<'\n';
+        return;
+    }
+    cout<<"Files as of "<<formatTime(until)<<":"<<'\n';
+    for(const string& name : names){
+        File* f=find(name);
+        lock_guard<mutex> guard(f->lock);
+        TreeNode* snapshot=f->snapshotAt(until);
+        if(!snapshot) continue;
+        cout<<"  - "<<name<<": version ID "<<snapshot->version_id
+            <<", Time: "<<formatTime(snapshot->snapshot_timestamp)
+            <<", Message: \""<<snapshot->message<<"\""<<'\n';
+    }
+}
+
+// Builds every file on its own thread, from its own content, then publishes them all in
+// one step: with order_lock and every shard held exclusively, each shard's table grows
+// once and its heaps are rebuilt once instead of taking a push per file, and no command
+// sees part of an import. The log records only the command, so replay reads the source
+// again; SAVE after an IMPORT if the source may change.
+void FileSystem::handleImport(string_view arguments, string_view command){
+    FileLayout layout;
+    string_view path=parseImportLayout(arguments, layout);
+    ImportSource source;
+    string error;
+    if(!source.open(string(path), error)){
+        cerr<<"Error: "<<error<<'\n';
+        return;
+    }
+    size_t count=source.files.size();
+    vector<File*> built(count, nullptr);
+    vector<size_t> bytes(count, 0);
+    parallelFor(count, IMPORT_PER_THREAD, [&](size_t i){
+        const ImportFile& in=source.files[i];
+        if(in.name.find_first_of(" ,\r\n")!=string::npos || find(in.name)) return;//commands could not name it
+        ostream discard(nullptr);
+        string buffer;
+        File* f=nullptr;
+        for(const ImportVersion& version : in.versions){
+            string_view content;
+            if(!source.content(in, version, buffer, content)) break;
+            setTimeOverride(max(version.time, (Stamp)1));//0 would mean the clock
+            if(!f){
+                f=makeFile(layout, "File created.");
+                f->reserveVersions(in.versions.size()+1);
+            }
+            f->update(content);
+            f->snapshot("Imported.", discard, discard);
+            bytes[i]+=content.size();
+        }
+        setTimeOverride(0);
+        built[i]=f;
+    });
+
+    size_t imported=0, versions=0, total_bytes=0;
+    {
+        lock_guard<mutex> order_guard(order_lock);
+        vector<unique_lock<shared_mutex>> shard_guards;
+        for(FileShard& shard : shards) shard_guards.emplace_back(shard.lock);
+        if(!logCommand(command)){
+            for(File* f : built) delete f;
+            return;
+        }
+        setTimeOverride(0);
+        vector<size_t> added(SHARDS, 0);
+        for(size_t i=0; i<count; i++){
+            if(built[i]) added[&shardFor(source.files[i].name)-shards]++;
+        }
+        for(size_t s=0; s<SHARDS; s++) shards[s].files.reserve(shards[s].files.size()+added[s]);
+        file_order.reserve(file_order.size()+count);
+        vector<vector<Fileppt>> entries(SHARDS);
+        vector<pair<Stamp, int>> created;
+        for(size_t i=0; i<count; i++){
+            File* f=built[i];
+            if(!f) continue;
+            const string& name=source.files[i].name;
+            FileShard& shard=shardFor(name);
+            if(shard.files.contains(name)){//created while this import was building
+                delete f;
+                continue;
+            }
+            f->id=file_order.size();
+            f->slot=shard.next_slot++;
+            shard.files.insert(name, f);
+            file_order.push_back(name);
+            created.emplace_back(f->root->snapshot_timestamp, f->id);
+            entries[&shard-shards].push_back({name, f->active_version->created_timestamp, f->total_versions, f->slot});
+            f->committed_version=f->active_version->version_id;
+            shard.versions.set(name, f->committed_version);
+            imported++;
+            versions+=f->total_versions-1;
+            total_bytes+=bytes[i];
+        }
+        created_index.addAll(std::move(created));
+        for(size_t s=0; s<SHARDS; s++){
+            if(entries[s].empty()) continue;
+            lock_guard<mutex> index_guard(shards[s].index_lock);
+            vector<Fileppt> all=shards[s].recent_index.heap;
+            all.insert(all.end(), make_move_iterator(entries[s].begin()), make_move_iterator(entries[s].end()));
+            shards[s].recent_index.build(all);
+            shards[s].biggest_index.build(std::move(all));
+        }
+    }
+    cout<<"Imported "<<imported<<" files ("<<versions<<" versions, "<<total_bytes<<" bytes) from '"<<path<<"'."<<'\n';
+    if(imported<count){
+        cout<<"Skipped "<<count-imported<<" files that already exist, could not be read, or have a space or comma in their name."<<'\n';
+    }
+}
+
+// Each file is read under its own lock into its own buffers, on as many threads as the
+// batch is worth, and the buffers printed in the order given from the calling thread:
+// in server mode only its cout and cerr reach the request's response. A batch too
+// small to share out is printed as it is read, without buffering.
+void FileSystem::handleMultiRead(string_view list){
+    vector<string_view> names=splitNames(list);
+    auto readOne=[&](size_t i, ostream& out, ostream& err){
+        File* f=find(names[i]);
+        if(!f) return false;
+        out<<"File '"<<names[i]<<"':"<<'\n';
+        lock_guard<mutex> guard(f->lock);
+        f->read(out, err);
+        return true;
+    };
+    if(threadsFor(names.size(), MULTI_PER_THREAD)==1){
+        for(size_t i=0; i<names.size(); i++){
+            if(!readOne(i, cout, cerr)) cerr<<"Error: File '"<<names[i]<<"' not found."<<'\n';
+        }
+        return;
+    }
+    vector<string> outputs(names.size()), errors(names.size());
+    vector<char> found(names.size(), 0);
+    parallelFor(names.size(), MULTI_PER_THREAD, [&](size_t i){
+        ostringstream out, err;
+        found[i]=readOne(i, out, err);
+        outputs[i]=out.str();
+        errors[i]=err.str();
+    });
+    for(size_t i=0; i<names.size(); i++){
+        if(found[i]) cout<<outputs[i];
+        else cerr<<"Error: File '"<<names[i]<<"' not found."<<'\n';
+        cerr<<errors[i];
+    }
+}
+
+// Every named file is locked for the whole command, in id order as SAVE locks them, so
+// one log record covers them all and replay sees the same files at the same versions.
+// The snapshots themselves are then taken in parallel, each with its own stamp from a
+// range reserved for the command: the logged stamp plus the file's place among those
+// found, so replay recreates them. What each prints is buffered for the calling thread
+// to print in order.
+void FileSystem::handleMultiSnapshot(string_view list, string_view command, string_view message){
+    vector<string_view> names=splitNames(list);
+    vector<File*> files(names.size());
+    vector<Stamp> offsets(names.size(), 0);
+    vector<File*> locking;
+    vector<size_t> held_shards;
+    for(size_t i=0; i<names.size(); i++){
+        files[i]=find(names[i]);
+        if(files[i]){
+            offsets[i]=locking.size();
+            locking.push_back(files[i]);
+            held_shards.push_back(&shardFor(names[i])-shards);
+        }
+    }
+    sort(locking.begin(), locking.end(), [](File* a, File* b){ return a->id<b->id; });
+    sort(held_shards.begin(), held_shards.end());
+    held_shards.erase(unique(held_shards.begin(), held_shards.end()), held_shards.end());
+    vector<shared_lock<shared_mutex>> shard_guards;//shards before files, as every command takes them
+    shard_guards.reserve(held_shards.size());
+    for(size_t s : held_shards) shard_guards.emplace_back(shards[s].lock);
+    vector<unique_lock<mutex>> guards;
+    guards.reserve(locking.size());
+    for(File* f : locking) guards.emplace_back(f->lock);
+    if(!locking.empty()){
+        setTimeOverride(reserveTimes(locking.size()));//so the log records the range's first stamp
+        if(!logCommand(command)){
+            setTimeOverride(0);
+            return;
+        }
+    }
+    Stamp first=currentTime();//the logged time, if logging
+    vector<string> outputs(names.size()), errors(names.size());
+    parallelFor(names.size(), MULTI_PER_THREAD, [&](size_t i){
+        if(!files[i]) return;
+        setTimeOverride(first+offsets[i]);
+        ostringstream out, err;
+        files[i]->snapshot(message, out, err);
+        reindex(names[i], files[i]);
+        outputs[i]=out.str();
+        errors[i]=err.str();
+    });
+    setTimeOverride(0);
+    guards.clear();
+    shard_guards.clear();
+    for(size_t i=0; i<names.size(); i++){
+        if(!files[i]) cerr<<"Error: File '"<<names[i]<<"' not found."<<'\n';
+        else cout<<"File '"<<names[i]<<"': "<<outputs[i];
+        cerr<<errors[i];
+    }
+}
+
+// Files are searched in parallel, each under its own lock (which also brings its index
+// up to date), and reported in creation order.
+void FileSystem::handleGrep(string_view pattern, string_view filename){
+    vector<string> names;
+    if(!filename.empty()){
+        if(!find(filename)){
+            cerr<<"Error: File '"<<filename<<"' not found."<<'\n';
+            return;
+        }
+        names.emplace_back(filename);
+    } else {
+        lock_guard<mutex> guard(order_lock);
+        names=file_order;
+    }
+    vector<vector<GrepMatch>> matches(names.size());
+    vector<size_t> scanned(names.size(), 0);
+    vector<string> errors(names.size());
+    parallelFor(names.size(), GREP_PER_THREAD, [&](size_t i){
+        File* f=find(names[i]);
+        lock_guard<mutex> guard(f->lock);
+        ostringstream err;
+        f->ensureLoaded(err);//a file loaded here reports to the calling thread, not this one
+        errors[i]=err.str();
+        scanned[i]=f->grep(pattern, matches[i]);
+    });
+    size_t versions=0, files=0, total_scanned=0;
+    for(size_t i=0; i<names.size(); i++){
+        cerr<<errors[i];
+        for(const GrepMatch& match : matches[i]){
+            cout<<names[i]<<" (version "<<match.version_id<<"): "<<match.line<<'\n';
+        }
+        versions+=matches[i].size();
+        files+=!matches[i].empty();
+        total_scanned+=scanned[i];
+    }
+    cout<<"Found '"<<pattern<<"' in "<<versions<<" versions of "<<files<<" files ("
+        <<total_scanned<<" versions scanned)."<<'\n';
+}
+
+// O(SHARDS) however many files there are: each shard's version trie is copied by
+// reference. With every shard held exclusively no command that changes a file is half
+// done, so the tag is the state after exactly the commands logged before it.
+void FileSystem::handleTag(string_view name, string_view command, bool is_branch){
+    lock_guard<mutex> order_guard(order_lock);
+    if(findCheckpoint(name)){
+        cerr<<"Error: A tag or branch named '"<<name<<"' already exists."<<'\n';
+        return;
+    }
+    vector<unique_lock<shared_mutex>> shard_guards;
+    shard_guards.reserve(SHARDS);
+    for(FileShard& shard : shards) shard_guards.emplace_back(shard.lock);
+    if(!logCommand(command)) return;
+    Checkpoint checkpoint{string(name), is_branch, currentTime(), {}};
+    checkpoint.versions.reserve(SHARDS);
+    size_t files=0;
+    for(FileShard& shard : shards){
+        checkpoint.versions.push_back(shard.versions);
+        files+=shard.versions.size();
+    }
+    checkpoints.push_back(std::move(checkpoint));
+    checkpoint_generation++;
+    setTimeOverride(0);
+    if(is_branch) cout<<"Created branch '"<<name<<"' at "<<files<<" files."<<'\n';
+    else cout<<"Tagged "<<files<<" files as '"<<name<<"'."<<'\n';
+}
+
+// Sets every file whose committed version differs from the target's to the target's,
+// as ROLLBACK would. The tries share every subtrie that did not change since one was
+// copied from the other, and forEachChange skips those, so the cost follows the number
+// of files that differ, not the number of files. Edits not yet snapshotted stay on a
+// file whose committed version is the same on both sides, and files created since the
+// target was taken are left as they are. Switching to a branch first stores the live
+// state in the branch being left.
+void FileSystem::handleCheckout(string_view name, string_view command){
+    lock_guard<mutex> order_guard(order_lock);
+    Checkpoint* target=findCheckpoint(name);
+    if(!target){
+        cerr<<"Error: No tag or branch named '"<<name<<"'."<<'\n';
+        return;
+    }
+    size_t target_index=target-checkpoints.data();
+    if(target_index==current_branch){
+        cout<<"Already on branch '"<<name<<"'."<<'\n';
+        return;
+    }
+    vector<unique_lock<shared_mutex>> shard_guards;
+    shard_guards.reserve(SHARDS);
+    for(FileShard& shard : shards) shard_guards.emplace_back(shard.lock);
+    if(!logCommand(command)) return;
+    vector<PersistentMap> versions=target->versions;
+    if(target->is_branch){
+        Checkpoint& left=checkpoints[current_branch];
+        left.time=currentTime();
+        for(FileShard& shard : shards) left.versions.push_back(shard.versions);
+        target->versions.clear();
+        current_branch=target_index;
+        checkpoint_generation++;
+    }
+    size_t changed=0;
+    for(size_t s=0; s<SHARDS; s++){
+        PersistentMap live=shards[s].versions;//reindex changes the shard's own as this walks
+        versions[s].forEachChange(live, [&](const string& filename, int version_id){
+            File* f=shards[s].files.get(filename);
+            lock_guard<mutex> guard(f->lock);//a reader may still hold it
+            if(!f->setActive(version_id)) return;
+            reindex(filename, f);
+            changed++;
+        });
+    }
+    setTimeOverride(0);
+    if(target->is_branch) cout<<"Switched to branch '"<<name<<"' ("<<changed<<" files changed)."<<'\n';
+    else cout<<"Checked out tag '"<<name<<"' ("<<changed<<" files changed)."<<'\n';
+}
+
+void FileSystem::handleTags(){
+    lock_guard<mutex> order_guard(order_lock);
+    auto filesIn=[](const Checkpoint& checkpoint){
+        size_t files=0;
+        for(const PersistentMap& versions : checkpoint.versions) files+=versions.size();
+        return files;
+    };
+    cout<<"Tags:"<<'\n';
+    for(const Checkpoint& checkpoint : checkpoints){
+        if(checkpoint.is_branch) continue;
+        cout<<"  - "<<checkpoint.name<<": "<<filesIn(checkpoint)<<" files, Time: "<<formatTime(checkpoint.time)<<'\n';
+    }
+    cout<<"Branches:"<<'\n';
+    for(size_t i=0; i<checkpoints.size(); i++){
+        const Checkpoint& checkpoint=checkpoints[i];
+        if(!checkpoint.is_branch) continue;
+        if(i==current_branch) cout<<"  * "<<checkpoint.name<<" (current)"<<'\n';
+        else cout<<"  - "<<checkpoint.name<<": "<<filesIn(checkpoint)<<" files, Time: "<<formatTime(checkpoint.time)<<'\n';
+    }
+}
+
+void FileSystem::handleRecentFiles(int num){
+    if(num<0) {
+        cerr<<"Error: Number of files must be non-negative."<<'\n';
+        return;
+    }
+    vector<Fileppt> files=topFiles(true, num);
+    cout<<"Most recently modified files:"<<'\n';
+    for(int i=0; i<(int)files.size(); i++){
+        cout<<"  -> "<<files[i].filename<<'\n';
+    }
+}
+
+void FileSystem::handleBiggestTrees(int num){
+    if(num<0) {
+        cerr<<"Error: Number of files must be non-negative."<<'\n';
+        return;
+    }
+    vector<Fileppt> files=topFiles(false, num);
+    cout<<"Files with the most versions:"<<'\n';
+    for(int i=0; i<(int)files.size(); i++){
+        cout<<"  - "<<files[i].filename<<" ("<<files[i].total_versions<<" versions)"<<'\n';
+    }
+}
+
+// Saves a consistent cut: with file_order and every file locked no command is in
+// flight, so the repository holds exactly the logged commands up to lastLsn().
+void FileSystem::handleSave(string_view path) {
+    lock_guard<mutex> order_guard(order_lock);
+    vector<unique_lock<mutex>> file_guards;
+    file_guards.reserve(file_order.size());
+    for(size_t i=0; i<file_order.size(); i++){
+        file_guards.emplace_back(find(file_order[i])->lock);
+    }
+    string error;
+    uint64_t lsn=wal ? wal->lastLsn() : 0;
+    if(!Repository::save(*this, string(path), lsn, error)){
+        cerr<<"Error: "<<error<<'\n';
+    } else if(wal && !wal->checkpointed(lsn)){//everything logged so far is in the repository now
+        cerr<<"Error: Saved to '"<<path<<"', but the write-ahead log could not be emptied."<<'\n';
+    } else {
+        cout<<"Saved "<<file_order.size()<<" files to '"<<path<<"'."<<'\n';
+    }
+}
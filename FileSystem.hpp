@@ -0,0 +1,130 @@
+#ifndef FILESYSTEM_H
+#define FILESYSTEM_H
+
+#include "Compression.hpp"
+#include "DataStructures.hpp"
+#include "Persistence.hpp"
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+using namespace std;
+
+// Commands understood by FileSystem::processCommand
+enum class Opcode {
+    CREATE, READ, INSERT, UPDATE, SNAPSHOT, ROLLBACK, HISTORY,
+    ANCESTOR, LCA, IS_ANCESTOR, DIFF, MERGE, PRUNE, READ_AT, SNAPSHOT_AT,
+    IMPORT, MULTI_READ, MULTI_SNAPSHOT, GREP, TAG, BRANCH, CHECKOUT, TAGS, RECENT_FILES, BIGGEST_TREES, STORAGE_STATS, STATS, SAVE, UNKNOWN
+};
+
+Opcode parseOpcode(string_view cmd);//resolves a command word, UNKNOWN if not recognised
+bool parseNumber(string_view text, int& value);//whole token as a non-negative int
+bool parseNumberPair(string_view text, int& first, int& second);//"<first> <second>"
+
+// One slice of the file namespace; a file lives in the shard picked by its name's hash.
+// Lookups hold the shard lock shared and CREATE holds it exclusively; a command that
+// changes a file holds it shared until it is done, so TAG and CHECKOUT, which hold every
+// shard exclusively, never see one half done. Each shard keeps its own analytics heaps
+// (keyed by File::slot) behind a separate lock, so RECENT_FILES and BIGGEST_TREES merge
+// per-shard top-k lists instead of locking every file.
+struct FileShard {
+    shared_mutex lock;
+    FileMap files;
+    mutex index_lock;
+    FileHeap recent_index;
+    FileHeap biggest_index;
+    PersistentMap versions;//name -> File::committed_version; under index_lock, or with the shard held exclusively
+    int next_slot;
+    FileShard() : recent_index(true), biggest_index(false), next_slot(0) {}
+};
+
+// A named state of the whole file system: for every file that existed then, its
+// committed version (the active version if it is a snapshot, else the snapshot it was
+// edited from), as the shards' version tries held them. A tag never changes. A branch
+// holds the state it was left in by the CHECKOUT that switched away from it; while it
+// is the current branch the live state is its state, and versions is empty.
+struct Checkpoint {
+    string name;
+    bool is_branch;
+    Stamp time;//when taken, or when last left for a branch
+    vector<PersistentMap> versions;//by shard
+};
+
+// FILESYSTEM - To manage multiple files with O(1) lookup using the sharded hashmap
+// processCommand may be called from many threads at once. A command holds the lock of
+// the one File it touches, so commands on different files run in parallel.
+class FileSystem {
+public:
+    static constexpr size_t SHARD_BITS = 6;
+    static constexpr chrono::microseconds PRUNE_SLICE{1000};//longest a PRUNE holds a file's lock at once
+    static constexpr size_t SHARDS = size_t(1)<<SHARD_BITS;
+    static constexpr size_t IMPORT_PER_THREAD = 16;//files an IMPORT builds per extra thread
+    static constexpr size_t MULTI_PER_THREAD = 8;//files a MULTI_READ or MULTI_SNAPSHOT gives each thread
+    static constexpr size_t GREP_PER_THREAD = 4;
+    FileShard shards[SHARDS];
+    mutex order_lock;//guards file_order; also held by SAVE to keep CREATE out
+    vector<string> file_order; // to preserve insertion order for listing
+    TimeIndex created_index;//file_order positions by creation time; guarded by order_lock
+    Repository* repository;//mapped repository the files were loaded from, if any
+    WriteAheadLog* wal;//log of mutating commands since the last SAVE, if enabled
+    bool wal_sync;//wait for each logged command to be durable before running it
+    ColdTier* cold_tier;//compresses content left unread for a window, if enabled
+    StatsDumper* stats_dumper;//prints statsReport() periodically, if enabled
+    vector<Checkpoint> checkpoints;//tags and branches, in order taken; guarded by order_lock
+    size_t current_branch;//index in checkpoints
+    atomic<uint64_t> checkpoint_generation;//bumped whenever what checkpoints hold changes, for PRUNE
+
+    FileSystem() : repository(nullptr), wal(nullptr), wal_sync(false), cold_tier(nullptr), stats_dumper(nullptr),
+                   checkpoints(1, Checkpoint{"main", true, 0, {}}), current_branch(0), checkpoint_generation(0),
+                   replaying(false) {}
+    ~FileSystem();
+
+    void processCommand(string_view command);
+    bool load(const string& path, string& error);//only into an empty FileSystem
+    // Replays the log on top of the loaded repository (or an empty FileSystem), then
+    // keeps appending every mutating command to it. Returns the number of replayed records.
+    bool openLog(const string& path, size_t& replayed, string& error);
+    FileShard& shardFor(string_view filename);
+    File* find(string_view filename);//nullptr if there is no such file
+    size_t fileCount();
+    // What STATS prints: latency percentiles per command, hash table probe lengths and
+    // memory held by versions, merged over every thread's counters.
+    string statsReport();
+
+private:
+    bool replaying;//commands come from the log, so are not logged again
+
+    // Appends a mutating command to the log (caller holds the file's lock, so the log
+    // orders commands on one file the way they ran) and pins this thread's clock to the
+    // logged time, so replay recreates identical versions. Returns false, having printed
+    // the error, if the log has failed (or, under --wal-sync, the record could not be
+    // synced): the caller must then leave the command unapplied.
+    bool logCommand(string_view command);
+    // Re-keys a file in its shard's analytics indexes and version trie after any command
+    // that may have changed its active version, modification time or version count.
+    void reindex(string_view filename, File* f);
+    Checkpoint* findCheckpoint(string_view name);//caller holds order_lock
+    vector<int> pinnedVersions(string_view filename);//what checkpoints hold of it; caller holds order_lock
+    vector<Fileppt> topFiles(bool sort_by_recent, int num);
+    void handleCreate(string_view filename, string_view command, string_view options);
+    void handleRead(File* f, int version_id);//-1 for the active version
+    void handleInsert(File* f, string_view content);
+    void handleUpdate(File* f, string_view content);
+    void handleSnapshot(File* f, string_view message);
+    void handleRollback(File* f, string_view version_str);
+    void handleReadAt(File* f, string_view time);
+    void handleHistory(File* f, string_view page);//"[offset [count]]"
+    void handleVersionPair(Opcode op, File* f, string_view versions);//commands on a pair of versions
+    void handlePrune(string_view filename, string_view command, string_view policy);//takes the file's lock per slice
+    void handleSnapshotAt(string_view time);//every file as of a unix time
+    void handleImport(string_view arguments, string_view command);//"[layout options] <path>"
+    void handleMultiRead(string_view names);//"a,b,c"
+    void handleMultiSnapshot(string_view names, string_view command, string_view message);
+    void handleGrep(string_view pattern, string_view filename);//every file if filename is empty
+    void handleTag(string_view name, string_view command, bool is_branch);
+    void handleCheckout(string_view name, string_view command);
+    void handleTags();
+    void handleRecentFiles(int num);
+    void handleBiggestTrees(int num);
+    void handleSave(string_view path);
+};
+#endif
@@ -0,0 +1,675 @@
+#include "Persistence.hpp"
+#include "FileSystem.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char REPO_MAGIC[8] = {'T', 'T', 'F', 'S', 'R', 'E', 'P', '6'};
+
+// SAVING
+// Streams content bytes as they are first seen, so only the (small) record tables are
+// held in memory while writing.
+class RepoWriter {
+public:
+    FILE* out;
+    uint64_t offset;
+    bool failed;//a write came up short; the repository must not be kept
+    HashTable<Hash128, uint32_t, Hash128Hash> blob_ids;
+    vector<BlobRecord> blobs;
+
+    RepoWriter(FILE* out) : out(out), offset(0), failed(false) {}
+    void write(const void* data, size_t size){
+        if(size>0 && fwrite(data, 1, size, out)!=size) failed=true;//data of an empty vector may be null
+        offset+=size;
+    }
+    void align(){
+        static const char zeros[8]={0};
+        if(offset%8) write(zeros, 8-offset%8);
+    }
+    uint32_t blob(string_view bytes, Hash128 hash){
+        if(bytes.empty()) return 0xFFFFFFFF;
+        uint32_t* existing=blob_ids.find(hash);
+        if(existing) return *existing;
+        uint32_t id=blobs.size();
+        blobs.push_back({offset, bytes.size(), hash.lo, hash.hi});
+        blob_ids.insert(hash, id);
+        write(bytes.data(), bytes.size());
+        return id;
+    }
+    uint32_t blob(const BlobRef& ref){
+        Blob* b=ref.get();
+        if(!b) return 0xFFFFFFFF;
+        EpochGuard pin;
+        string_view bytes=b->bytes();
+        //Blobs still being appended to (active, unsnapshotted versions) have no hash yet
+        Hash128 hash=b->interned ? b->hash : hashBytes128(bytes.data(), bytes.size());
+        return blob(bytes, hash);
+    }
+};
+
+bool Repository::save(FileSystem& fs, const string& path, uint64_t wal_lsn, string& error){
+    string temp_path=path+".tmp";
+    FILE* out=fopen(temp_path.c_str(), "wb");
+    if(!out){
+        error="Cannot create '"+temp_path+"'.";
+        return false;
+    }
+    setvbuf(out, nullptr, _IOFBF, 1<<20);
+    RepoWriter writer(out);
+    RepoHeader header={};
+    memcpy(header.magic, REPO_MAGIC, sizeof(header.magic));
+    writer.write(&header, sizeof(header));
+
+    vector<FileRecord> files;
+    string names;
+    vector<NodeRecord> nodes;
+    vector<TreeNode*> stack;
+    for(size_t i=0; i<fs.file_order.size(); i++){
+        File* file=fs.find(fs.file_order[i]);
+        file->ensureLoaded();
+        nodes.clear();
+        stack.assign(1, file->root);
+        while(!stack.empty()){//preorder, so every parent is written before its children
+            TreeNode* node=stack.back();
+            stack.pop_back();
+            NodeRecord record={};
+            record.created_timestamp=node->created_timestamp;
+            record.snapshot_timestamp=node->snapshot_timestamp;
+            record.prefix_len=node->prefix_len;
+            record.suffix_len=node->suffix_len;
+            record.length=node->length;
+            record.version_id=node->version_id;
+            record.parent_id=node->parent ? node->parent->version_id : -1;
+            record.data_blob=writer.blob(node->data);
+            record.message_blob=writer.blob(node->message, hashBytes128(node->message.data(), node->message.size()));
+            record.is_keyframe=node->is_keyframe;
+            nodes.push_back(record);
+            for(TreeNode* child=node->first_child; child; child=child->next_sibling) stack.push_back(child);
+        }
+        writer.align();
+        FileRecord record={};
+        record.name_offset=names.size();
+        record.name_size=fs.file_order[i].size();
+        record.nodes_offset=writer.offset;
+        record.last_modified=file->active_version->created_timestamp;
+        record.node_count=nodes.size();
+        record.total_versions=file->total_versions;
+        record.active_version=file->active_version->version_id;
+        record.committed_version=file->committed_version;
+        record.layout=file->layout;
+        files.push_back(record);
+        names+=fs.file_order[i];
+        writer.write(nodes.data(), nodes.size()*sizeof(NodeRecord));
+    }
+    writer.align();
+    header.blob_count=writer.blobs.size();
+    header.blob_table_offset=writer.offset;
+    writer.write(writer.blobs.data(), writer.blobs.size()*sizeof(BlobRecord));
+    header.file_count=files.size();
+    header.file_table_offset=writer.offset;
+    writer.write(files.data(), files.size()*sizeof(FileRecord));
+    header.names_offset=writer.offset;
+    writer.write(names.data(), names.size());
+    vector<CheckpointRecord> checkpoints;
+    vector<CheckpointEntry> entries;
+    for(size_t i=0; i<fs.checkpoints.size(); i++){
+        const Checkpoint& checkpoint=fs.checkpoints[i];
+        entries.clear();
+        for(size_t s=0; s<checkpoint.versions.size(); s++){
+            checkpoint.versions[s].forEach([&](const string& name, int version_id){
+                entries.push_back({(uint32_t)fs.shards[s].files.get(name)->id, version_id});
+            });
+        }
+        writer.align();
+        CheckpointRecord record={};
+        record.entries_offset=writer.offset;
+        record.entry_count=entries.size();
+        writer.write(entries.data(), entries.size()*sizeof(CheckpointEntry));
+        record.name_offset=writer.offset;
+        record.name_size=checkpoint.name.size();
+        writer.write(checkpoint.name.data(), checkpoint.name.size());
+        record.time=checkpoint.time;
+        record.is_branch=checkpoint.is_branch;
+        checkpoints.push_back(record);
+    }
+    writer.align();
+    header.checkpoint_table_offset=writer.offset;
+    header.checkpoint_count=checkpoints.size();
+    header.current_branch=fs.current_branch;
+    writer.write(checkpoints.data(), checkpoints.size()*sizeof(CheckpointRecord));
+    header.wal_lsn=wal_lsn;
+
+    bool ok=!writer.failed && fseek(out, 0, SEEK_SET)==0 && fwrite(&header, sizeof(header), 1, out)==1;
+    ok=fflush(out)==0 && ok && !ferror(out) && fsync(fileno(out))==0;//ferror: a short write fflush did not see
+    ok=fclose(out)==0 && ok;
+    if(!ok || rename(temp_path.c_str(), path.c_str())!=0){//the old repository stays intact on failure
+        error="Cannot write '"+path+"'.";
+        remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// LOADING
+Repository::Repository()
+    : base(nullptr), size(0), header(nullptr), blob_table(nullptr), file_table(nullptr), checkpoint_table(nullptr) {}
+
+Repository::~Repository(){
+    loaded.clear();//drop our references before the bytes they point at go away
+    if(base) munmap(const_cast<char*>(base), size);
+}
+
+// Whether count items of item_size bytes from offset lie inside a mapping of size bytes,
+// without overflowing on corrupt values. Record arrays (items over a byte) must also be
+// 8-byte aligned, to be read in place.
+static bool fits(uint64_t offset, uint64_t count, uint64_t item_size, size_t size){
+    return offset<=size && count<=(size-offset)/item_size && (item_size==1 || offset%8==0);
+}
+
+bool Repository::open(const string& path, string& error){
+    int fd=::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if(fd<0 || fstat(fd, &info)<0){
+        error="Cannot open '"+path+"'.";
+        if(fd>=0) close(fd);
+        return false;
+    }
+    size=info.st_size;
+    if(size<sizeof(RepoHeader)){
+        error="'"+path+"' is not a repository.";
+        close(fd);
+        return false;
+    }
+    void* mapped=mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);//the mapping stays valid
+    if(mapped==MAP_FAILED){
+        error="Cannot map '"+path+"'.";
+        return false;
+    }
+    base=static_cast<const char*>(mapped);
+    header=reinterpret_cast<const RepoHeader*>(base);
+    bool valid=memcmp(header->magic, REPO_MAGIC, sizeof(REPO_MAGIC))==0
+               && fits(header->blob_table_offset, header->blob_count, sizeof(BlobRecord), size)
+               && fits(header->file_table_offset, header->file_count, sizeof(FileRecord), size)
+               && header->names_offset<=size
+               && fits(header->checkpoint_table_offset, header->checkpoint_count, sizeof(CheckpointRecord), size)
+               && header->current_branch<header->checkpoint_count;
+    if(valid){
+        blob_table=reinterpret_cast<const BlobRecord*>(base+header->blob_table_offset);
+        file_table=reinterpret_cast<const FileRecord*>(base+header->file_table_offset);
+        checkpoint_table=reinterpret_cast<const CheckpointRecord*>(base+header->checkpoint_table_offset);
+    }
+    for(size_t i=0; valid && i<header->blob_count; i++){
+        valid=fits(blob_table[i].offset, blob_table[i].size, 1, size);
+    }
+    for(size_t i=0; valid && i<header->file_count; i++){//nodes[0], the root, is read without building the tree
+        const FileRecord& record=file_table[i];
+        valid=record.node_count>0 && fits(record.nodes_offset, record.node_count, sizeof(NodeRecord), size)
+              && fits(record.name_offset, record.name_size, 1, size-header->names_offset);
+    }
+    for(size_t i=0; valid && i<header->checkpoint_count; i++){
+        const CheckpointRecord& record=checkpoint_table[i];
+        valid=fits(record.entries_offset, record.entry_count, sizeof(CheckpointEntry), size)
+              && fits(record.name_offset, record.name_size, 1, size);
+    }
+    if(!valid){
+        error="'"+path+"' is not a valid repository.";
+        return false;
+    }
+    loaded.resize(header->blob_count);
+    return true;
+}
+
+void Repository::populate(FileSystem& fs){
+    const char* names=base+header->names_offset;
+    vector<vector<Fileppt>> entries(FileSystem::SHARDS);//per shard
+    for(size_t s=0; s<FileSystem::SHARDS; s++){
+        fs.shards[s].files.reserve(header->file_count/FileSystem::SHARDS);
+    }
+    fs.file_order.reserve(header->file_count);
+    vector<int> file_ids(header->file_count, -1);//record index -> file id; -1 for a name seen before
+    for(size_t i=0; i<header->file_count; i++){
+        const FileRecord& record=file_table[i];
+        string name(names+record.name_offset, record.name_size);
+        FileShard& shard=fs.shardFor(name);
+        if(shard.files.contains(name)) continue;//only in a corrupt repository
+        file_ids[i]=fs.file_order.size();
+        File* file=makeFile(record.layout, this, i, record.total_versions);
+        file->id=fs.file_order.size();
+        file->slot=shard.next_slot++;
+        shard.files.insert(name, file);
+        fs.file_order.push_back(name);
+        const NodeRecord* nodes=reinterpret_cast<const NodeRecord*>(base+record.nodes_offset);
+        fs.created_index.add(nodes[0].snapshot_timestamp, file->id);//the root comes first
+        entries[&shard-fs.shards].push_back({name, record.last_modified, record.total_versions, file->slot});
+        file->committed_version=record.committed_version;
+        shard.versions.set(name, file->committed_version);
+    }
+    for(size_t s=0; s<FileSystem::SHARDS; s++){
+        fs.shards[s].recent_index.build(entries[s]);
+        fs.shards[s].biggest_index.build(std::move(entries[s]));
+    }
+    fs.checkpoints.clear();
+    for(size_t i=0; i<header->checkpoint_count; i++){
+        const CheckpointRecord& record=checkpoint_table[i];
+        Checkpoint checkpoint{string(base+record.name_offset, record.name_size), record.is_branch!=0, record.time, {}};
+        if(i!=header->current_branch) checkpoint.versions.resize(FileSystem::SHARDS);
+        const CheckpointEntry* tagged=reinterpret_cast<const CheckpointEntry*>(base+record.entries_offset);
+        for(size_t j=0; j<record.entry_count; j++){
+            if(checkpoint.versions.empty() || tagged[j].file_index>=header->file_count || file_ids[tagged[j].file_index]<0) continue;
+            const string& name=fs.file_order[file_ids[tagged[j].file_index]];
+            checkpoint.versions[&fs.shardFor(name)-fs.shards].set(name, tagged[j].version_id);
+        }
+        fs.checkpoints.push_back(std::move(checkpoint));
+    }
+    fs.current_branch=header->current_branch;
+}
+
+BlobRef Repository::blob(uint32_t id){
+    if(id==NO_BLOB) return BlobRef();
+    if(!loaded[id].get()){
+        const BlobRecord& record=blob_table[id];
+        loaded[id]=BlobStore::instance().adopt(base+record.offset, record.size, Hash128{record.hash_lo, record.hash_hi});
+    }
+    return loaded[id];
+}
+
+// Node records that do not fit the tree built so far (a parent that is missing or not a
+// snapshot, a second root, an id out of range or taken, edit lengths that do not add
+// up) are left out, and with them every version below them.
+void Repository::buildTree(File& file, size_t index, ostream& err){
+    lock_guard<mutex> guard(lock);//loaded is shared by every file
+    const FileRecord& record=file_table[index];
+    const NodeRecord* nodes=reinterpret_cast<const NodeRecord*>(base+record.nodes_offset);
+    auto validBlob=[&](uint32_t id){ return id==NO_BLOB || id<header->blob_count; };
+    file.reserveVersions(record.node_count);
+    size_t skipped=0;
+    for(uint32_t i=0; i<record.node_count; i++){
+        const NodeRecord& r=nodes[i];
+        TreeNode* parent=r.parent_id<0 ? nullptr : file.version(r.parent_id);
+        bool placed=parent ? parent->isSnapshot() : r.parent_id<0 && !file.root;
+        uint64_t data_size=validBlob(r.data_blob) && r.data_blob!=NO_BLOB ? blob_table[r.data_blob].size : 0;
+        bool lengths=r.is_keyframe ? r.prefix_len==0 && r.suffix_len==0 && data_size==r.length
+                                   : parent && r.prefix_len<=parent->length && r.suffix_len<=parent->length-r.prefix_len
+                                     && r.length-data_size==r.prefix_len+r.suffix_len && data_size<=r.length;
+        if(!placed || !lengths || r.version_id<0 || r.version_id>=record.total_versions || file.version(r.version_id)
+           || !validBlob(r.data_blob) || !validBlob(r.message_blob)){
+            skipped++;
+            continue;
+        }
+        BlobRef message=blob(r.message_blob);
+        TreeNode* node=file.addVersion(r.version_id, parent, string(message.view()));
+        node->created_timestamp=r.created_timestamp;
+        node->snapshot_timestamp=r.snapshot_timestamp;
+        node->prefix_len=r.prefix_len;
+        node->suffix_len=r.suffix_len;
+        node->length=r.length;
+        node->is_keyframe=r.is_keyframe;
+        node->data=blob(r.data_blob);
+    }
+    if(!file.root) file.addVersion(0, nullptr, "File created.");
+    file.active_version=file.version(record.active_version);
+    if(!file.active_version) file.active_version=file.root;
+    file.total_versions=max(record.total_versions, 1);
+    if(skipped>0) err<<"Error: "<<skipped<<" corrupt version records skipped while loading a file."<<'\n';
+}
+
+// WRITE-AHEAD LOG
+static uint32_t walChecksum(const WalRecordHeader& header, const char* command){
+    return (uint32_t)hashBytes(command, header.size, header.lsn^(uint64_t)header.timestamp);
+}
+
+static bool writeAll(int fd, const char* data, size_t size){
+    while(size>0){
+        ssize_t written=::write(fd, data, size);
+        if(written<0){
+            if(errno==EINTR) continue;
+            return false;
+        }
+        data+=written;
+        size-=written;
+    }
+    return true;
+}
+
+WriteAheadLog::WriteAheadLog(size_t max_batch, chrono::microseconds max_latency)
+    : fd(-1), pending_records(0), next_lsn(1), durable_lsn(0), max_batch(max_batch<1 ? 1 : max_batch),
+      max_latency(max_latency), stopping(false), writing(false), flush_now(false), waiters(0), log_size(0), failed(false),
+      synced_records(0), syncs(0) {}
+
+WriteAheadLog::~WriteAheadLog(){
+    if(flusher.joinable()){
+        {
+            lock_guard<mutex> guard(lock);
+            stopping=true;
+        }
+        pending_changed.notify_all();
+        flusher.join();
+    }
+    if(failed) cerr<<"Error: The write-ahead log could not be written; commands since the last SAVE are not durable."<<'\n';
+    if(fd>=0) close(fd);
+}
+
+bool WriteAheadLog::open(const string& path, uint64_t after_lsn, function<void(int64_t, string_view)> apply, string& error){
+    fd=::open(path.c_str(), O_RDWR|O_CREAT|O_APPEND, 0644);
+    struct stat info;
+    if(fd<0 || fstat(fd, &info)<0){
+        error="Cannot open log '"+path+"'.";
+        return false;
+    }
+    uint64_t last_lsn=after_lsn, previous_lsn=0;
+    size_t size=info.st_size, valid_end=0;
+    if(size>0){
+        void* mapped=mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped==MAP_FAILED){
+            error="Cannot map log '"+path+"'.";
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        const char* data=static_cast<const char*>(mapped);
+        while(valid_end+sizeof(WalRecordHeader)<=size){
+            WalRecordHeader header;
+            memcpy(&header, data+valid_end, sizeof(header));
+            const char* command=data+valid_end+sizeof(header);
+            if(header.lsn<=previous_lsn || header.size>size-valid_end-sizeof(header)
+               || walChecksum(header, command)!=header.checksum) break;//torn tail
+            previous_lsn=header.lsn;
+            if(header.lsn>after_lsn){
+                apply(header.timestamp, string_view(command, header.size));
+                last_lsn=header.lsn;
+            }
+            valid_end+=sizeof(header)+header.size;
+        }
+        munmap(mapped, size);
+        if(valid_end<size && ftruncate(fd, valid_end)<0){
+            error="Cannot truncate the torn tail of log '"+path+"'.";
+            return false;
+        }
+    }
+    next_lsn=last_lsn+1;
+    durable_lsn=last_lsn;
+    log_size=valid_end;
+    flusher=thread(&WriteAheadLog::flushLoop, this);
+    return true;
+}
+
+uint64_t WriteAheadLog::append(int64_t timestamp, string_view command){
+    WalRecordHeader header;
+    bool wake;
+    {
+        lock_guard<mutex> guard(lock);
+        if(failed) return 0;
+        header.lsn=next_lsn++;
+        header.timestamp=timestamp;
+        header.size=command.size();
+        header.checksum=walChecksum(header, command.data());
+        pending.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        pending.append(command.data(), command.size());
+        if(pending_records==0) oldest_pending=chrono::steady_clock::now();
+        pending_records++;
+        wake=pending_records==1 || pending_records>=max_batch;//start the latency timer, or cut the batch
+    }
+    if(wake) pending_changed.notify_one();
+    return header.lsn;
+}
+
+void WriteAheadLog::flushLoop(){
+    unique_lock<mutex> guard(lock);
+    string batch;
+    while(true){
+        pending_changed.wait(guard, [this]{ return stopping || pending_records>0; });
+        if(pending_records==0) break;//stopping with nothing left
+        pending_changed.wait_until(guard, oldest_pending+max_latency, [this]{
+            return stopping || flush_now || waiters>0 || pending_records>=max_batch;
+        });
+        batch.clear();
+        batch.swap(pending);
+        size_t records=pending_records;
+        uint64_t batch_lsn=next_lsn-1;
+        pending_records=0;
+        flush_now=false;
+        writing=true;
+        guard.unlock();
+        bool ok=writeAll(fd, batch.data(), batch.size()) && fdatasync(fd)==0;
+        guard.lock();
+        writing=false;
+        if(ok){
+            log_size+=batch.size();
+            durable_lsn=batch_lsn;
+            synced_records+=records;
+            syncs++;
+        } else {
+            //Nothing in the batch is durable, and records appended after torn bytes would
+            //be cut off with them by recovery: drop the batch, and refuse the rest.
+            failed=true;
+            pending.clear();
+            pending_records=0;
+            int ignored=ftruncate(fd, (off_t)log_size);//if this fails too, open() cuts the torn tail
+            (void)ignored;
+        }
+        durable_changed.notify_all();
+    }
+}
+
+bool WriteAheadLog::waitDurable(uint64_t lsn){
+    unique_lock<mutex> guard(lock);
+    if(durable_lsn>=lsn) return true;
+    waiters++;
+    pending_changed.notify_one();//nothing is gained by waiting out the latency for us
+    durable_changed.wait(guard, [&]{ return durable_lsn>=lsn || failed; });
+    waiters--;
+    return durable_lsn>=lsn;
+}
+
+uint64_t WriteAheadLog::lastLsn(){
+    lock_guard<mutex> guard(lock);
+    return next_lsn-1;
+}
+
+bool WriteAheadLog::checkpointed(uint64_t lsn){
+    unique_lock<mutex> guard(lock);
+    flush_now=true;
+    pending_changed.notify_one();
+    durable_changed.wait(guard, [this]{ return pending_records==0 && !writing; });
+    if(next_lsn-1>lsn) return false;//records after the checkpoint must survive
+    if(ftruncate(fd, 0)<0) return false;
+    log_size=0;//O_APPEND: the next batch starts at offset 0
+    if(failed){//the checkpoint holds every record the log lost
+        failed=false;
+        durable_lsn=lsn;
+    }
+    return true;
+}
+
+void WriteAheadLog::printStats(){
+    lock_guard<mutex> guard(lock);
+    cout<<"Write-ahead log:"<<'\n';
+    cout<<"  Last LSN: "<<next_lsn-1<<", durable up to: "<<durable_lsn<<'\n';
+    cout<<"  Records synced: "<<synced_records<<" in "<<syncs<<" fsyncs";
+    if(syncs) cout<<" ("<<(double)synced_records/syncs<<" records/fsync)";
+    cout<<'\n';
+    if(failed) cout<<"  WARNING: a log write failed; commands are refused until a SAVE succeeds."<<'\n';
+}
+
+// IMPORT SOURCES
+ImportSource::ImportSource() : base(nullptr), size(0) {}
+
+ImportSource::~ImportSource(){
+    if(base) munmap(const_cast<char*>(base), size);
+}
+
+bool ImportSource::open(const string& path, string& error){
+    struct stat info;
+    if(stat(path.c_str(), &info)<0){
+        error="Cannot import '"+path+"'.";
+        return false;
+    }
+    if(S_ISDIR(info.st_mode)){
+        root=path;
+        if(!scanDirectory("", error)) return false;
+        sort(files.begin(), files.end(), [](const ImportFile& a, const ImportFile& b){ return a.name<b.name; });
+        return true;
+    }
+    return scanArchive(path, error);
+}
+
+// Symbolic links and anything else that is not a regular file or directory are left out.
+bool ImportSource::scanDirectory(const string& relative, string& error){
+    string directory=relative.empty() ? root : root+"/"+relative;
+    DIR* dir=opendir(directory.c_str());
+    if(!dir){
+        error="Cannot read directory '"+directory+"'.";
+        return false;
+    }
+    vector<string> subdirectories;
+    while(dirent* entry=readdir(dir)){
+        string name=entry->d_name;
+        if(name=="." || name=="..") continue;
+        string child=relative.empty() ? name : relative+"/"+name;
+        struct stat info;
+        if(lstat((root+"/"+child).c_str(), &info)<0) continue;
+        if(S_ISDIR(info.st_mode)){
+            subdirectories.push_back(child);
+        } else if(S_ISREG(info.st_mode)){
+            Stamp time=(Stamp)info.st_mtim.tv_sec*STAMPS_PER_SECOND+info.st_mtim.tv_nsec;
+            files.push_back({child, {{time, 0, (size_t)info.st_size}}});
+        }
+    }
+    closedir(dir);
+    for(const string& child : subdirectories){
+        if(!scanDirectory(child, error)) return false;
+    }
+    return true;
+}
+
+// Numeric header fields are octal text, or base-256 big-endian when the top bit of the
+// first byte is set (GNU, for values that do not fit).
+static uint64_t tarNumber(const char* field, size_t width){
+    uint64_t value=0;
+    if((unsigned char)field[0] & 0x80){
+        value=(unsigned char)field[0] & 0x7F;
+        for(size_t i=1; i<width; i++) value=value<<8 | (unsigned char)field[i];
+        return value;
+    }
+    for(size_t i=0; i<width && field[i]!='\0'; i++){
+        if(field[i]>='0' && field[i]<='7') value=value*8+(field[i]-'0');
+    }
+    return value;
+}
+
+static bool tarChecksumValid(const char* header){
+    uint64_t sum=0;
+    for(size_t i=0; i<512; i++) sum+=(i>=148 && i<156) ? ' ' : (unsigned char)header[i];
+    return sum==tarNumber(header+148, 8);
+}
+
+static string tarField(const char* field, size_t width){
+    return string(field, strnlen(field, width));
+}
+
+bool ImportSource::scanArchive(const string& path, string& error){
+    int fd=::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if(fd<0 || fstat(fd, &info)<0){
+        error="Cannot import '"+path+"'.";
+        if(fd>=0) close(fd);
+        return false;
+    }
+    size=info.st_size;
+    void* mapped=size>=512 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;//at least one block
+    close(fd);
+    if(mapped==MAP_FAILED){
+        size=0;
+        error="'"+path+"' is not a directory or a tar archive.";
+        return false;
+    }
+    base=static_cast<const char*>(mapped);
+    HashTable<string, size_t, StringHash> index;//name -> position in files
+    string long_name;//from a GNU 'L' or pax entry, for the entry that follows
+    size_t offset=0;
+    while(offset+512<=size){
+        const char* header=base+offset;
+        if(header[0]=='\0') break;//the zero blocks that end the archive
+        if(!tarChecksumValid(header)){
+            error="'"+path+"' is not a directory or a tar archive.";
+            return false;
+        }
+        uint64_t entry_size=tarNumber(header+124, 12);
+        size_t data=offset+512;
+        if(entry_size>size-data){
+            error="'"+path+"' is truncated.";
+            return false;
+        }
+        offset=data+(entry_size+511)/512*512;
+        char type=header[156];
+        if(type=='L'){
+            long_name=tarField(base+data, entry_size);
+            continue;
+        }
+        if(type=='x'){//pax records: "<length> <key>=<value>\n"
+            string_view records(base+data, entry_size);
+            while(!records.empty()){
+                size_t space=records.find(' '), length=0;
+                if(space==string_view::npos) break;
+                for(char c : records.substr(0, space)) length=length*10+(c-'0');
+                if(length<=space+1 || length>records.size()) break;
+                string_view record=records.substr(space+1, length-space-2);
+                if(record.substr(0, 5)=="path=") long_name=string(record.substr(5));
+                records.remove_prefix(length);
+            }
+            continue;
+        }
+        string name=long_name;
+        long_name.clear();
+        if(name.empty()){
+            name=tarField(header, 100);
+            string prefix=memcmp(header+257, "ustar", 5)==0 ? tarField(header+345, 155) : "";
+            if(!prefix.empty()) name=prefix+"/"+name;
+        }
+        if(type!='0' && type!='\0' && type!='7') continue;//directories, links, devices
+        while(name.compare(0, 2, "./")==0 || name.compare(0, 1, "/")==0) name.erase(0, name[0]=='/' ? 1 : 2);
+        if(name.empty() || name.back()=='/') continue;
+        Stamp time=(Stamp)tarNumber(header+136, 12)*STAMPS_PER_SECOND;
+        size_t* existing=index.find(name);
+        if(existing){
+            files[*existing].versions.push_back({time, data, (size_t)entry_size});
+        } else {
+            index.insert(name, files.size());
+            files.push_back({name, {{time, data, (size_t)entry_size}}});
+        }
+    }
+    return true;
+}
+
+bool ImportSource::content(const ImportFile& file, const ImportVersion& version, string& buffer, string_view& bytes) const {
+    if(base){
+        bytes=string_view(base+version.offset, version.size);
+        return true;
+    }
+    int fd=::open((root+"/"+file.name).c_str(), O_RDONLY);
+    struct stat info;
+    if(fd<0 || fstat(fd, &info)<0){
+        if(fd>=0) close(fd);
+        return false;
+    }
+    buffer.resize(info.st_size);//the size now, in case it changed since the scan
+    size_t done=0;
+    while(done<buffer.size()){
+        ssize_t got=::read(fd, &buffer[done], buffer.size()-done);
+        if(got<0 && errno==EINTR) continue;
+        if(got<=0) break;
+        done+=got;
+    }
+    close(fd);
+    buffer.resize(done);
+    bytes=buffer;
+    return true;
+}
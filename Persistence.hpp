@@ -0,0 +1,205 @@
+#ifndef PERSISTENCE_H
+#define PERSISTENCE_H
+
+#include "DataStructures.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+using namespace std;
+
+class FileSystem;
+
+// ON-DISK REPOSITORY FORMAT
+// Fixed-layout records in native byte order, written in this order:
+//   RepoHeader
+//   content bytes, back to back (each unique blob and message once)
+//   for each file: NodeRecord[node_count], parents before children
+//   BlobRecord[blob_count]
+//   FileRecord[file_count], followed by the file names
+//   for each tag and branch: CheckpointEntry[entry_count], then its name
+//   CheckpointRecord[checkpoint_count]
+// Record arrays are 8-byte aligned so they can be read in place from the mapping.
+struct RepoHeader {
+    char magic[8];
+    uint64_t file_count;
+    uint64_t blob_count;
+    uint64_t blob_table_offset;
+    uint64_t file_table_offset;
+    uint64_t names_offset;
+    uint64_t wal_lsn;//last write-ahead log record included in this checkpoint
+    uint64_t checkpoint_table_offset;
+    uint64_t checkpoint_count;
+    uint64_t current_branch;//index in the checkpoint table
+};
+
+struct BlobRecord {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t hash_lo;
+    uint64_t hash_hi;
+};
+
+struct FileRecord {
+    uint64_t name_offset;//relative to RepoHeader::names_offset
+    uint64_t name_size;
+    uint64_t nodes_offset;
+    int64_t last_modified;//active version's timestamp, so indexes load without the tree
+    uint32_t node_count;
+    int32_t total_versions;
+    int32_t active_version;
+    int32_t committed_version;//File::committed_version, so version tries load without the tree
+    FileLayout layout;//the policies it was created with
+    uint8_t reserved[5];
+};
+
+// A tag or branch (FileSystem's Checkpoint). The current branch has no entries: its
+// state is the files' own committed versions.
+struct CheckpointRecord {
+    uint64_t name_offset;
+    uint64_t name_size;
+    uint64_t entries_offset;
+    uint64_t entry_count;
+    int64_t time;
+    uint32_t is_branch;
+    uint32_t reserved;
+};
+
+struct CheckpointEntry {
+    uint32_t file_index;
+    int32_t version_id;
+};
+
+struct NodeRecord {
+    int64_t created_timestamp;
+    int64_t snapshot_timestamp;
+    uint64_t prefix_len;
+    uint64_t suffix_len;
+    uint64_t length;
+    int32_t version_id;
+    int32_t parent_id;//-1 for the root
+    uint32_t data_blob;//NO_BLOB for empty content
+    uint32_t message_blob;
+    uint32_t is_keyframe;
+};
+
+// A repository file mapped into memory. Opening it only validates the header; each
+// File's tree is built from its NodeRecords on first use, and content bytes are
+// referenced in place by the blob store, so pages are only touched when READ.
+class Repository : public TreeSource {
+private:
+    static constexpr uint32_t NO_BLOB = 0xFFFFFFFF;
+    const char* base;
+    size_t size;
+    const RepoHeader* header;
+    const BlobRecord* blob_table;
+    const FileRecord* file_table;
+    const CheckpointRecord* checkpoint_table;
+    vector<BlobRef> loaded;//blob id -> blob, filled in as trees are built
+    mutex lock;//trees of different files may be built concurrently
+    BlobRef blob(uint32_t id);
+public:
+    Repository();
+    ~Repository();
+    Repository(const Repository&) = delete;
+    Repository& operator=(const Repository&) = delete;
+
+    bool open(const string& path, string& error);
+    uint64_t checkpointLsn() const { return header->wal_lsn; }
+    void populate(FileSystem& fs);//registers every file with fs, without building trees; not thread-safe
+    void buildTree(File& file, size_t index, ostream& err) override;
+
+    static bool save(FileSystem& fs, const string& path, uint64_t wal_lsn, string& error);
+};
+
+// WRITE-AHEAD LOG
+// Every mutating command is appended as a record before it is applied:
+//   WalRecordHeader, then the command bytes.
+// The checksum lets recovery find the end of the valid log after a torn write.
+struct WalRecordHeader {
+    uint64_t lsn;
+    int64_t timestamp;
+    uint32_t size;
+    uint32_t checksum;
+};
+
+// Group commit: append() only copies the record into a buffer. A flusher thread writes
+// the buffer and fdatasync()s it once max_batch records are pending, the oldest has
+// waited max_latency, or someone is blocked in waitDurable(). Records appended while a
+// sync is in progress form the next batch, so one sync covers many concurrent callers.
+class WriteAheadLog {
+private:
+    int fd;
+    mutex lock;
+    condition_variable pending_changed;
+    condition_variable durable_changed;
+    string pending;
+    size_t pending_records;
+    chrono::steady_clock::time_point oldest_pending;
+    uint64_t next_lsn;
+    uint64_t durable_lsn;
+    size_t max_batch;
+    chrono::microseconds max_latency;
+    bool stopping;
+    bool writing;//flusher is writing a batch outside the lock
+    bool flush_now;//skip the latency wait for the current batch
+    size_t waiters;//threads blocked in waitDurable()
+    uint64_t log_size;//bytes of whole, synced records in the log file
+    bool failed;//a batch could not be written; appends are refused until a checkpoint
+    size_t synced_records;
+    size_t syncs;
+    thread flusher;
+    void flushLoop();
+public:
+    WriteAheadLog(size_t max_batch = 1024, chrono::microseconds max_latency = chrono::microseconds(2000));
+    ~WriteAheadLog();//flushes whatever is pending
+
+    // Replays records with lsn > after_lsn through apply, truncates a torn tail, and
+    // opens the log for appending after the last valid record.
+    bool open(const string& path, uint64_t after_lsn, function<void(int64_t timestamp, string_view command)> apply, string& error);
+    uint64_t append(int64_t timestamp, string_view command);//0 once the log has failed
+    bool waitDurable(uint64_t lsn);//false if the log failed before lsn was synced
+    uint64_t lastLsn();
+    bool checkpointed(uint64_t lsn);//drops the log once a checkpoint covers everything up to lsn, clearing a failure
+    void printStats();
+};
+
+// IMPORT SOURCES
+// What IMPORT reads: a directory tree, each regular file of which becomes one file named
+// by its path below the root; or a tar archive (ustar, with GNU long names and pax
+// paths), each regular entry of which becomes a snapshot of the file it names, so a name
+// repeated later in the archive carries that file's history. open() only lists files;
+// content is fetched afterwards, from any number of threads.
+struct ImportVersion {
+    Stamp time;//modification time
+    size_t offset;//archive only: where the content starts in the mapping
+    size_t size;
+};
+
+struct ImportFile {
+    string name;
+    vector<ImportVersion> versions;//oldest first
+};
+
+class ImportSource {
+private:
+    string root;//directory import: what names are relative to
+    const char* base;//archive import: the mapped archive
+    size_t size;
+    bool scanDirectory(const string& relative, string& error);
+    bool scanArchive(const string& path, string& error);
+public:
+    vector<ImportFile> files;//directory: sorted by name; archive: in order of first entry
+    ImportSource();
+    ~ImportSource();
+    ImportSource(const ImportSource&) = delete;
+    ImportSource& operator=(const ImportSource&) = delete;
+
+    bool open(const string& path, string& error);
+    // One version's content: a view into the archive, or the file read into buffer.
+    // False if the file can no longer be read.
+    bool content(const ImportFile& file, const ImportVersion& version, string& buffer, string_view& bytes) const;
+};
+#endif
@@ -0,0 +1,336 @@
+#include "Server.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+static constexpr size_t MAX_BATCH = 64;//requests a worker runs before the next connection gets a turn
+static constexpr size_t MAX_LINE = 64<<20;//a longer request is taken as garbage and the connection dropped
+static constexpr int MAX_EVENTS = 256;
+
+// While a worker runs a command, everything it prints goes to the response being built:
+// cout and cerr are pointed at a streambuf that appends to the calling thread's capture
+// string, and passes through to the original buffer on threads not capturing.
+namespace {
+thread_local string* capture=nullptr;
+
+class RoutedOutput : public streambuf {
+private:
+    streambuf* original;
+protected:
+    int overflow(int c) override {
+        if(c==traits_type::eof()) return traits_type::not_eof(c);
+        if(capture){
+            capture->push_back((char)c);
+            return c;
+        }
+        return original->sputc((char)c);
+    }
+    streamsize xsputn(const char* data, streamsize size) override {
+        if(capture){
+            capture->append(data, size);
+            return size;
+        }
+        return original->sputn(data, size);
+    }
+    int sync() override {
+        return capture ? 0 : original->pubsync();
+    }
+public:
+    explicit RoutedOutput(streambuf* original) : original(original) {}
+};
+}
+
+Server::Server(FileSystem& fs, int threads)
+    : fs(fs), listen_fd(-1), epoll_fd(-1), stop_fd(-1), stopping(false), workers(max(threads, 1)) {}
+
+Server::~Server(){
+    if(listen_fd>=0) ::close(listen_fd);
+    if(epoll_fd>=0) ::close(epoll_fd);
+    if(stop_fd>=0) ::close(stop_fd);
+    if(!unix_path.empty()) unlink(unix_path.c_str());
+}
+
+bool Server::listen(const string& address, string& error){
+    bool tcp=!address.empty() && all_of(address.begin(), address.end(), [](char c){ return c>='0' && c<='9'; });
+    listen_fd=socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    bool bound=false;
+    if(listen_fd>=0 && tcp){
+        int port=0;
+        int on=1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in local{};
+        local.sin_family=AF_INET;
+        local.sin_addr.s_addr=htonl(INADDR_LOOPBACK);//local clients only
+        bound=parseNumber(address, port) && port<65536;
+        local.sin_port=htons(port);
+        bound=bound && bind(listen_fd, (sockaddr*)&local, sizeof(local))==0;
+    } else if(listen_fd>=0){
+        sockaddr_un local{};
+        local.sun_family=AF_UNIX;
+        struct stat info;
+        if(address.size()<sizeof(local.sun_path)){
+            memcpy(local.sun_path, address.c_str(), address.size()+1);
+            if(stat(address.c_str(), &info)==0 && S_ISSOCK(info.st_mode)) unlink(address.c_str());//left by an earlier run
+            bound=bind(listen_fd, (sockaddr*)&local, sizeof(local))==0;
+            if(bound) unix_path=address;
+        }
+    }
+    if(!bound || ::listen(listen_fd, SOMAXCONN)<0){
+        error="Cannot listen on '"+address+"'.";
+        return false;
+    }
+    epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+    stop_fd=eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    epoll_event listen_event{}, stop_event{};
+    listen_event.events=EPOLLIN;
+    listen_event.data.ptr=&listen_fd;
+    stop_event.events=EPOLLIN;
+    stop_event.data.ptr=&stop_fd;
+    if(epoll_fd<0 || stop_fd<0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event)<0
+       || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &stop_event)<0){
+        error="Cannot set up the event loop.";
+        return false;
+    }
+    return true;
+}
+
+void Server::stop(){
+    uint64_t one=1;
+    ssize_t ignored=::write(stop_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+void Server::run(){
+    RoutedOutput routed_out(cout.rdbuf()), routed_err(cerr.rdbuf());
+    streambuf* saved_out=cout.rdbuf(&routed_out);
+    streambuf* saved_err=cerr.rdbuf(&routed_err);
+    ostream* saved_tie=cerr.tie(nullptr);//otherwise every error line would flush cout
+    for(thread& worker : workers) worker=thread(&Server::workerLoop, this);
+
+    epoll_event events[MAX_EVENTS];
+    bool running=true;
+    while(running){
+        int ready=epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if(ready<0 && errno!=EINTR) break;
+        for(int i=0; i<ready; i++){
+            if(events[i].data.ptr==&stop_fd){
+                running=false;
+            } else if(events[i].data.ptr==&listen_fd){
+                accept();
+            } else {
+                Connection* c=static_cast<Connection*>(events[i].data.ptr);
+                if(events[i].events & EPOLLERR) close(c);
+                else if(events[i].events & (EPOLLIN|EPOLLRDHUP)) readable(c);
+                else writable(c);
+            }
+        }
+    }
+
+    {
+        lock_guard<mutex> guard(lock);
+        stopping=true;
+    }
+    work_ready.notify_all();
+    for(thread& worker : workers) worker.join();//each finishes the batch it is running
+    for(Connection* c : connections){
+        ::close(c->fd);
+        delete c;
+    }
+    connections.clear();
+    work.clear();
+    cout.flush();
+    cout.rdbuf(saved_out);
+    cerr.rdbuf(saved_err);
+    cerr.tie(saved_tie);
+}
+
+// EVENT LOOP
+void Server::accept(){
+    while(true){
+        int fd=accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if(fd<0){
+            if(errno==EINTR || errno==ECONNABORTED) continue;
+            return;//EAGAIN, or out of descriptors until some close
+        }
+        int on=1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));//fails harmlessly on Unix sockets
+        Connection* c=new Connection(fd);
+        {
+            lock_guard<mutex> guard(lock);
+            connections.push_back(c);
+        }
+        epoll_event event{};
+        event.events=EPOLLIN|EPOLLRDHUP|EPOLLONESHOT;
+        event.data.ptr=c;
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event)<0) close(c);
+    }
+}
+
+void Server::readable(Connection* c){
+    char buffer[65536];
+    size_t scanned=c->input.size();
+    while(true){
+        ssize_t got=::read(c->fd, buffer, sizeof(buffer));
+        if(got>0){
+            c->input.append(buffer, got);
+            if(c->input.size()>MAX_LINE && c->input.find('\n')==string::npos){
+                close(c);
+                return;
+            }
+            continue;
+        }
+        if(got==0){
+            c->peer_closed=true;
+            break;
+        }
+        if(errno==EINTR) continue;
+        if(errno==EAGAIN || errno==EWOULDBLOCK) break;
+        close(c);
+        return;
+    }
+    if(c->peer_closed && !c->input.empty() && c->input.back()!='\n') c->input.push_back('\n');//last line still runs
+    if(!c->output.empty()) writable(c);//a half-close while responses wait: they go first
+    else if(c->input.find('\n', scanned)!=string::npos) schedule(c);
+    else if(c->peer_closed) close(c);
+    else arm(c, EPOLLIN);
+}
+
+void Server::writable(Connection* c){
+    while(!c->output.empty()){
+        ssize_t written=::write(c->fd, c->output.data(), c->output.size());
+        if(written<0){
+            if(errno==EINTR) continue;
+            if(errno==EAGAIN || errno==EWOULDBLOCK) break;
+            close(c);
+            return;
+        }
+        c->output.erase(0, written);
+    }
+    if(!c->output.empty()) arm(c, EPOLLOUT);
+    else if(c->input.find('\n')!=string::npos) schedule(c);
+    else if(c->peer_closed) close(c);
+    else arm(c, EPOLLIN);
+}
+
+// Whoever owns c (the loop or a worker) hands it on with this, or schedule() or close(),
+// and must not touch it afterwards. Once the peer has half-closed, EPOLLRDHUP would
+// fire again at once, so it is only asked for before.
+void Server::arm(Connection* c, uint32_t events){
+    epoll_event event{};
+    event.events=events|(c->peer_closed ? 0u : (uint32_t)EPOLLRDHUP)|EPOLLONESHOT;
+    event.data.ptr=c;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &event)<0) close(c);
+}
+
+void Server::schedule(Connection* c){
+    {
+        lock_guard<mutex> guard(lock);
+        work.push_back(c);
+    }
+    work_ready.notify_one();
+}
+
+void Server::close(Connection* c){
+    {
+        lock_guard<mutex> guard(lock);
+        auto it=find(connections.begin(), connections.end(), c);
+        *it=connections.back();
+        connections.pop_back();
+    }
+    ::close(c->fd);
+    delete c;
+}
+
+// WORKERS
+void Server::workerLoop(){
+    while(true){
+        Connection* c;
+        {
+            unique_lock<mutex> guard(lock);
+            work_ready.wait(guard, [this]{ return stopping || !work.empty(); });
+            if(stopping) return;
+            c=work.front();
+            work.pop_front();
+        }
+        runBatch(c);
+    }
+}
+
+void Server::runBatch(Connection* c){
+    vector<string> responses;//header and output of each request, alternating
+    size_t start=0;
+    string output;
+    capture=&output;
+    for(size_t count=0; count<MAX_BATCH; count++){
+        size_t newline=c->input.find('\n', start);
+        if(newline==string::npos) break;
+        string_view line(c->input.data()+start, newline-start);
+        start=newline+1;
+        if(!line.empty() && line.back()=='\r') line.remove_suffix(1);
+        if(line.compare(0, 4, "EXIT")==0){
+            c->peer_closed=true;//answer what came before, then hang up
+            start=c->input.size();
+            break;
+        }
+        fs.processCommand(line);
+        responses.push_back(to_string(output.size())+'\n');
+        responses.push_back(std::move(output));
+        output.clear();
+    }
+    capture=nullptr;
+    c->input.erase(0, start);
+    if(!send(c, responses)){
+        close(c);
+        return;
+    }
+    if(!c->output.empty()) arm(c, EPOLLOUT);
+    else if(c->input.find('\n')!=string::npos) schedule(c);//pipelined past this batch
+    else if(c->peer_closed) close(c);
+    else arm(c, EPOLLIN);
+}
+
+// Gathers every response of the batch into as few writev calls as the socket allows;
+// whatever it does not take waits in c->output for EPOLLOUT. Behind output already
+// waiting there, the responses only join the queue.
+bool Server::send(Connection* c, vector<string>& responses){
+    if(!c->output.empty()){
+        for(string& piece : responses) c->output+=piece;
+        return true;
+    }
+    vector<iovec> pieces;
+    pieces.reserve(responses.size());
+    for(string& piece : responses){
+        if(!piece.empty()) pieces.push_back({piece.data(), piece.size()});
+    }
+    size_t next=0;
+    while(next<pieces.size()){
+        int count=(int)min(pieces.size()-next, (size_t)IOV_MAX);
+        ssize_t written=writev(c->fd, &pieces[next], count);
+        if(written<0){
+            if(errno==EINTR) continue;
+            if(errno==EAGAIN || errno==EWOULDBLOCK) break;
+            return false;
+        }
+        for(; next<pieces.size() && (size_t)written>=pieces[next].iov_len; next++) written-=pieces[next].iov_len;
+        if(next<pieces.size()){
+            pieces[next].iov_base=static_cast<char*>(pieces[next].iov_base)+written;
+            pieces[next].iov_len-=written;
+        }
+    }
+    for(; next<pieces.size(); next++) c->output.append(static_cast<char*>(pieces[next].iov_base), pieces[next].iov_len);
+    return true;
+}
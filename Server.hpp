@@ -0,0 +1,67 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "FileSystem.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// SERVER MODE
+// Serves the command protocol to many clients at once over a local socket, all against
+// one FileSystem. A request is one command line, exactly as typed at the prompt. Each
+// response is a line holding the byte count of the command's output, then that output
+// (what it would have printed to stdout and stderr, in order). Clients may pipeline any
+// number of requests without waiting; responses come back in request order. EXIT closes
+// the connection.
+//
+// One thread runs an epoll loop that accepts connections and reads requests; complete
+// lines are handed to a pool of workers, which run them through processCommand and send
+// the responses of a whole batch with one writev. A connection belongs either to the
+// loop or to one worker at a time (its epoll registration is one-shot and re-armed when
+// the worker is done), so its requests run in order without locking it, while different
+// connections run in parallel.
+class Server {
+private:
+    struct Connection {
+        int fd;
+        string input;//bytes read but not yet run
+        string output;//response bytes the socket has not taken yet
+        bool peer_closed;
+        explicit Connection(int fd) : fd(fd), peer_closed(false) {}
+    };
+    FileSystem& fs;
+    int listen_fd;
+    int epoll_fd;
+    int stop_fd;//eventfd that wakes the loop for stop()
+    string unix_path;//removed on shutdown
+    mutex lock;
+    condition_variable work_ready;
+    deque<Connection*> work;
+    vector<Connection*> connections;//every open connection, for shutdown
+    bool stopping;
+    vector<thread> workers;
+
+    void accept();
+    void readable(Connection* c);
+    void writable(Connection* c);
+    void arm(Connection* c, uint32_t events);//re-enables the one-shot registration
+    void schedule(Connection* c);
+    void close(Connection* c);
+    void workerLoop();
+    void runBatch(Connection* c);//runs the complete lines in c->input, then hands c back
+    bool send(Connection* c, vector<string>& responses);//false if the connection failed
+public:
+    Server(FileSystem& fs, int threads);
+    ~Server();
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    bool listen(const string& address, string& error);//a port on 127.0.0.1, or a Unix socket path
+    void run();//serves until stop()
+    void stop();//async-signal-safe
+};
+#endif
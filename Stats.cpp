@@ -0,0 +1,114 @@
+#include "Stats.hpp"
+#include <unistd.h>
+
+using namespace std;
+
+// HISTOGRAMS
+uint64_t Histogram::bucketHigh(int bucket){
+    if(bucket<SUB) return bucket;
+    int top=bucket/SUB+SUB_BITS-1;
+    uint64_t low=(uint64_t)(SUB+bucket%SUB)<<(top-SUB_BITS);
+    return low+((uint64_t)1<<(top-SUB_BITS))-1;
+}
+Histogram::Histogram(){
+    for(int i=0; i<BUCKETS; i++) counts[i].store(0, memory_order_relaxed);
+    largest.store(0, memory_order_relaxed);
+}
+
+MergedHistogram::MergedHistogram() : total(0), largest(0) {
+    for(int i=0; i<Histogram::BUCKETS; i++) counts[i]=0;
+}
+void MergedHistogram::add(const Histogram& h){
+    for(int i=0; i<Histogram::BUCKETS; i++){
+        uint64_t count=h.counts[i].load(memory_order_relaxed);
+        counts[i]+=count;
+        total+=count;
+    }
+    largest=max(largest, h.largest.load(memory_order_relaxed));
+}
+uint64_t MergedHistogram::percentile(double p) const {
+    uint64_t rank=(uint64_t)(p*total), seen=0;
+    for(int i=0; i<Histogram::BUCKETS; i++){
+        seen+=counts[i];
+        if(seen>rank) return min(Histogram::bucketHigh(i), largest);
+    }
+    return largest;
+}
+double MergedHistogram::mean() const {
+    if(total==0) return 0;
+    double sum=0;
+    for(int i=0; i<Histogram::BUCKETS; i++){
+        if(counts[i]>0) sum+=(double)counts[i]*(Histogram::bucketHigh(i)+(i>0 ? Histogram::bucketHigh(i-1)+1 : 0))/2;
+    }
+    return sum/total;
+}
+
+// PER-THREAD COUNTERS
+namespace {
+struct StatsThread {
+    atomic<bool>* in_use=nullptr;
+    ~StatsThread(){ if(in_use) in_use->store(false, memory_order_release); }
+};
+thread_local StatsThread stats_thread;
+}
+
+atomic<Stats::ThreadStats*> Stats::threads{nullptr};
+
+Stats::ThreadStats::ThreadStats() : nodes(0), in_use(true), next(nullptr) {}
+
+Stats::ThreadStats* Stats::registerThread(){
+    ThreadStats* t=threads.load(memory_order_acquire);
+    for(; t; t=t->next){//reuse the block of an exited thread, counts and all
+        bool expected=false;
+        if(t->in_use.compare_exchange_strong(expected, true)) break;
+    }
+    if(!t){
+        t=new ThreadStats();
+        t->next=threads.load();
+        while(!threads.compare_exchange_weak(t->next, t)){}
+    }
+    stats_thread.in_use=&t->in_use;
+    return t;
+}
+MergedHistogram Stats::command(int opcode){
+    MergedHistogram merged;
+    for(ThreadStats* t=threads.load(memory_order_acquire); t; t=t->next) merged.add(t->commands[opcode]);
+    return merged;
+}
+MergedHistogram Stats::probes(ProbeSite site){
+    MergedHistogram merged;
+    for(ThreadStats* t=threads.load(memory_order_acquire); t; t=t->next) merged.add(t->probes[site]);
+    return merged;
+}
+int64_t Stats::nodes(){
+    int64_t total=0;
+    for(ThreadStats* t=threads.load(memory_order_acquire); t; t=t->next) total+=t->nodes.load(memory_order_relaxed);
+    return total;
+}
+
+// PERIODIC DUMP
+StatsDumper::StatsDumper(chrono::milliseconds period, function<string()> report)
+    : stopping(false), period(period), report(std::move(report)) {
+    worker=thread(&StatsDumper::run, this);
+}
+StatsDumper::~StatsDumper(){
+    {
+        lock_guard<mutex> guard(lock);
+        stopping=true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+void StatsDumper::run(){
+    unique_lock<mutex> guard(lock);
+    while(!wake.wait_for(guard, period, [this]{ return stopping; })){
+        guard.unlock();
+        string text=report();
+        for(size_t done=0; done<text.size();){
+            ssize_t written=::write(STDERR_FILENO, text.data()+done, text.size()-done);
+            if(written<=0) break;
+            done+=written;
+        }
+        guard.lock();
+    }
+}
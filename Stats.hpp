@@ -0,0 +1,130 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+using namespace std;
+
+// Instrumentation is on unless built with -DFS_STATS=0, which compiles every recording
+// site (FS_STAT(...)) out; STATS then only says so.
+#ifndef FS_STATS
+#define FS_STATS 1
+#endif
+#if FS_STATS
+#define FS_STAT(statement) statement
+#else
+#define FS_STAT(statement)
+#endif
+
+// Log-bucketed histogram in the style of HdrHistogram: a value goes to the bucket of its
+// highest set bit, split into 2^SUB_BITS linear steps, so any value from 1 to 2^64 is
+// counted to within 1/16 in under a thousand buckets. Written by a single thread with
+// plain relaxed stores (no read-modify-write), read by any.
+class Histogram {
+public:
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB = 1<<SUB_BITS;
+    static constexpr int BUCKETS = (64-SUB_BITS+1)*SUB;
+    static int bucketOf(uint64_t value){
+        if(value<SUB) return (int)value;
+        int top=63-__builtin_clzll(value);
+        return (top-SUB_BITS+1)*SUB+(int)((value>>(top-SUB_BITS)) & (SUB-1));
+    }
+    static uint64_t bucketHigh(int bucket);//largest value counted in bucket
+    Histogram();
+    void record(uint64_t value){
+        atomic<uint64_t>& count=counts[bucketOf(value)];
+        count.store(count.load(memory_order_relaxed)+1, memory_order_relaxed);
+        if(value>largest.load(memory_order_relaxed)) largest.store(value, memory_order_relaxed);
+    }
+private:
+    atomic<uint64_t> counts[BUCKETS];
+    atomic<uint64_t> largest;
+    friend class MergedHistogram;
+};
+
+// The sum of several threads' histograms at one moment, for reporting.
+class MergedHistogram {
+private:
+    uint64_t counts[Histogram::BUCKETS];
+public:
+    uint64_t total;
+    uint64_t largest;
+    MergedHistogram();
+    void add(const Histogram& h);
+    uint64_t percentile(double p) const;//upper bound of the bucket holding the p-quantile
+    double mean() const;//from bucket bounds, so also within 1/16
+};
+
+// Hash tables that report probe lengths (groups scanned per lookup).
+enum ProbeSite { PROBE_VERSION_MAP, PROBE_FILE_MAP, PROBE_SITES, PROBE_NONE = -1 };
+
+// Process-wide counters, kept per thread so that recording never contends, and summed
+// when read. Thread blocks are reused after their thread exits, like EpochManager's
+// participants, and keep their counts.
+class Stats {
+public:
+    static constexpr int COMMANDS = 32;//room for every Opcode
+    struct ThreadStats {
+        Histogram commands[COMMANDS];//nanoseconds per command, by opcode
+        Histogram probes[PROBE_SITES];
+        atomic<int64_t> nodes;//version tree nodes created minus destroyed by this thread
+        atomic<bool> in_use;
+        ThreadStats* next;
+        ThreadStats();
+    };
+    static ThreadStats& local(){
+        static thread_local ThreadStats* mine=nullptr;
+        if(!mine) mine=registerThread();
+        return *mine;
+    }
+    static void addNodes(int64_t delta){
+        atomic<int64_t>& nodes=local().nodes;
+        nodes.store(nodes.load(memory_order_relaxed)+delta, memory_order_relaxed);
+    }
+    static MergedHistogram command(int opcode);
+    static MergedHistogram probes(ProbeSite site);
+    static int64_t nodes();
+private:
+    static atomic<ThreadStats*> threads;//push-only list
+    static ThreadStats* registerThread();
+};
+
+// Times one command from construction to destruction.
+class CommandTimer {
+private:
+    int opcode;
+    chrono::steady_clock::time_point start;
+public:
+    explicit CommandTimer(int opcode) : opcode(opcode), start(chrono::steady_clock::now()) {}
+    ~CommandTimer(){
+        auto ns=chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-start).count();
+        Stats::local().commands[opcode].record(ns);
+    }
+};
+
+// Writes report() to stderr once per period on a background thread (--stats-every).
+// Each report goes out in a single write(), so it never interleaves with other output
+// mid-line.
+class StatsDumper {
+private:
+    mutex lock;
+    condition_variable wake;
+    bool stopping;
+    chrono::milliseconds period;
+    function<string()> report;
+    thread worker;
+    void run();
+public:
+    StatsDumper(chrono::milliseconds period, function<string()> report);
+    ~StatsDumper();
+    StatsDumper(const StatsDumper&) = delete;
+    StatsDumper& operator=(const StatsDumper&) = delete;
+};
+#endif
@@ -0,0 +1,1055 @@
+#include "Compression.hpp"
+#include "DataStructures.hpp"
+#include "Diff.hpp"
+#include "FileSystem.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+// Counts heap allocations made by the process, for the allocation benchmarks.
+static atomic<size_t> allocation_count{0};
+// Kept out of line: inlined, the compiler sees free() given operator new's pointers (or
+// operator delete given malloc's) and warns of a mismatch that is not there.
+__attribute__((noinline)) void* operator new(size_t size){
+    allocation_count++;
+    if(void* p=malloc(size)) return p;
+    throw bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
+// Microbenchmarks for the core data structures.
+// Build: g++ -std=c++17 -O2 -pthread benchmark.cpp DataStructures.cpp FileSystem.cpp Persistence.cpp Diff.cpp Compression.cpp Stats.cpp -o benchmark
+
+// LEGACY TABLES - the fixed-capacity linear-probing maps that VersionMap and FileMap
+// used to be, kept here only as a baseline to compare against.
+class LegacyVersionMap {
+    struct Entry {
+        int key;
+        TreeNode* value;
+        bool is_empty;
+    };
+    vector<Entry> entries;
+    unsigned int capacity;
+public:
+    LegacyVersionMap(unsigned int capacity) : capacity(capacity) {
+        entries.resize(capacity, {0, nullptr, true});
+    }
+    void insert(int key, TreeNode* val){
+        unsigned int index=key%capacity;
+        while(!entries[index].is_empty && entries[index].key!=key) index=(index+1)%capacity;
+        entries[index]={key, val, false};
+    }
+    TreeNode* get(int key){
+        unsigned int index=key%capacity, start_index=index;
+        while(!entries[index].is_empty){
+            if(entries[index].key==key) return entries[index].value;
+            index=(index+1)%capacity;
+            if(index==start_index) break;
+        }
+        return nullptr;
+    }
+};
+
+class LegacyFileMap {
+    struct Entry {
+        string key;
+        File* value;
+        bool is_empty;
+        bool is_deleted;
+    };
+    vector<Entry> entries;
+    int capacity;
+    int hashFunction(const string& key){
+        int hash=0;
+        for(size_t i=0; i<key.size(); i++) hash=(hash*31+key[i])%capacity;
+        return hash;
+    }
+public:
+    LegacyFileMap(unsigned int capacity) : capacity(capacity) {
+        entries.resize(capacity, {"", nullptr, true, false});
+    }
+    void insert(const string& key, File* value){
+        int index=hashFunction(key), start_index=index;
+        while(!entries[index].is_empty || entries[index].is_deleted){
+            if(entries[index].key==key && !entries[index].is_empty){ entries[index].value=value; return; }
+            index=(index+1)%capacity;
+            if(index==start_index) break;
+        }
+        entries[index]={key, value, false, false};
+    }
+    File* get(const string& key){
+        int index=hashFunction(key), start_index=index;
+        while(!entries[index].is_empty || entries[index].is_deleted){
+            if(!entries[index].is_empty && !entries[index].is_deleted && entries[index].key==key) return entries[index].value;
+            index=(index+1)%capacity;
+            if(index==start_index) break;
+        }
+        return nullptr;
+    }
+};
+
+static double nsPerOp(chrono::steady_clock::time_point start, size_t ops){
+    chrono::duration<double, nano> elapsed=chrono::steady_clock::now()-start;
+    return elapsed.count()/ops;
+}
+
+// Legacy tables are given a fixed capacity of n/load (they cannot grow), so the
+// comparison shows how they behave at that load factor.
+template <typename Map>
+static void benchVersions(const char* name, Map& map, int n, size_t lookups, mt19937& rng){
+    TreeNode* dummy=reinterpret_cast<TreeNode*>(&map);
+    auto start=chrono::steady_clock::now();
+    for(int i=0; i<n; i++) map.insert(i, dummy);
+    double insert_ns=nsPerOp(start, n);
+    uniform_int_distribution<int> pick(0, n-1);
+    size_t found=0;
+    start=chrono::steady_clock::now();
+    for(size_t i=0; i<lookups; i++) found+=map.get(pick(rng))!=nullptr;
+    double get_ns=nsPerOp(start, lookups);
+    printf("  %-22s n=%-9d insert %8.1f ns/op   get %8.1f ns/op   (%zu hits)\n", name, n, insert_ns, get_ns, found);
+}
+
+template <typename Map>
+static void benchFiles(const char* name, Map& map, const vector<string>& names, size_t lookups, mt19937& rng){
+    File* dummy=reinterpret_cast<File*>(&map);
+    auto start=chrono::steady_clock::now();
+    for(size_t i=0; i<names.size(); i++) map.insert(names[i], dummy);
+    double insert_ns=nsPerOp(start, names.size());
+    uniform_int_distribution<size_t> pick(0, names.size()-1);
+    size_t found=0;
+    start=chrono::steady_clock::now();
+    for(size_t i=0; i<lookups; i++) found+=map.get(names[pick(rng)])!=nullptr;
+    double get_ns=nsPerOp(start, lookups);
+    printf("  %-22s n=%-9zu insert %8.1f ns/op   get %8.1f ns/op   (%zu hits)\n", name, names.size(), insert_ns, get_ns, found);
+}
+
+static void benchHashTables(){
+    mt19937 rng(42);
+    const size_t lookups=1000000;
+    cout<<"VersionMap (sequential version IDs):"<<endl;
+    for(int n : {100, 10000, 1000000}){
+        VersionMap growable;
+        benchVersions("HashTable", growable, n, lookups, rng);
+        LegacyVersionMap legacy_half(n*2+1);
+        benchVersions("legacy @ load 0.5", legacy_half, n, lookups, rng);
+        LegacyVersionMap legacy_full(n+n/10+1);
+        benchVersions("legacy @ load 0.9", legacy_full, n, lookups, rng);
+    }
+    cout<<"FileMap (file names):"<<endl;
+    for(int n : {100, 10000, 1000000}){
+        vector<string> names;
+        for(int i=0; i<n; i++) names.push_back("project/src/file_"+to_string(i)+".cpp");
+        FileMap growable;
+        benchFiles("HashTable", growable, names, lookups, rng);
+        LegacyFileMap legacy_half(n*2+1);
+        benchFiles("legacy @ load 0.5", legacy_half, names, lookups, rng);
+        if(n<=10000){//quadratic clustering makes the 0.9 run take minutes at 1M
+            LegacyFileMap legacy_full(n+n/10+1);
+            benchFiles("legacy @ load 0.9", legacy_full, names, lookups, rng);
+        }
+    }
+}
+
+// File methods print their results; this silences cout for the duration of a benchmark.
+struct MuteOutput {
+    streambuf* saved;
+    MuteOutput() : saved(cout.rdbuf(nullptr)) {}
+    ~MuteOutput(){ cout.rdbuf(saved); cout.clear(); }
+};
+
+// Discards everything. Unlike MuteOutput it never puts the stream into a failed state,
+// so threads can share it without racing on the stream's flags.
+class NullOutput : public streambuf {
+protected:
+    int overflow(int c) override { return traits_type::not_eof(c); }
+    streamsize xsputn(const char*, streamsize size) override { return size; }
+};
+
+// Append-heavy workload: every version appends a line and is snapshotted, so a file
+// with N versions holds N near-identical contents, each a rope sharing its parent's.
+static void benchDeltaStorage(){
+    const int versions=5000, reads=2000;
+    const string line(80, 'x');
+    NullOutput null_output;
+    cout<<"Version content, append-heavy ("<<versions<<" versions x "<<line.size()+1<<" bytes appended):"<<endl;
+    DefaultFile file("File created.");
+    auto start=chrono::steady_clock::now();
+    {
+        MuteOutput mute;
+        for(int i=0; i<versions; i++){
+            file.insert(line+"\n");
+            file.snapshot("v");
+        }
+    }
+    double write_ns=nsPerOp(start, versions);
+    mt19937 rng(7);
+    uniform_int_distribution<int> pick(1, versions);
+    streambuf* saved_out=cout.rdbuf(&null_output);
+    start=chrono::steady_clock::now();
+    for(int i=0; i<reads; i++) file.read(pick(rng));
+    double read_ns=nsPerOp(start, reads);
+    cout.rdbuf(saved_out);
+    printf("  %10.1f bytes/version   write %9.1f ns/op   random READ %10.1f ns/op\n",
+           (double)file.contentBytes()/file.total_versions, write_ns, read_ns);
+
+    //Branching off a large snapshot: each branch appends 1 KB to the whole content
+    const size_t large=32<<20;
+    const int branches=200;
+    DefaultFile big("File created.");
+    {
+        MuteOutput mute;
+        big.update(string(large, 'y'));
+        big.snapshot("base");
+    }
+    size_t held=big.contentBytes();
+    start=chrono::steady_clock::now();
+    {
+        MuteOutput mute;
+        for(int i=0; i<branches; i++){
+            big.rollback(1);
+            big.insert(string(1024, 'a'+i%26));
+            big.snapshot("branch");
+        }
+    }
+    double branch_ns=nsPerOp(start, branches);
+    saved_out=cout.rdbuf(&null_output);
+    start=chrono::steady_clock::now();
+    for(int i=0; i<20; i++) big.read(2+i);
+    double stream_ns=nsPerOp(start, 20);
+    cout.rdbuf(saved_out);
+    cout<<"Branches off a "<<(large>>20)<<" MB snapshot ("<<branches<<" x ROLLBACK, INSERT 1 KB, SNAPSHOT):"<<endl;
+    printf("  %10.1f us/branch   %8.1f bytes stored/branch   READ %8.1f us (streamed)\n",
+           branch_ns/1000, (double)(big.contentBytes()-held)/branches, stream_ns/1000);
+}
+
+// Config-file workload: many files repeatedly UPDATEd to one of a few payloads.
+static void benchDedup(){
+    const int files=2000, rounds=20;
+    vector<string> payloads;
+    for(int i=0; i<5; i++) payloads.push_back("# config revision "+to_string(i)+"\n"+string(4096, 'a'+i));
+    BlobStore& store=BlobStore::instance();
+    vector<File*> all;
+    {
+        MuteOutput mute;
+        for(int f=0; f<files; f++) all.push_back(new DefaultFile("File created."));
+        for(int r=0; r<rounds; r++){
+            for(int f=0; f<files; f++){
+                all[f]->update(payloads[(f+r)%payloads.size()]);
+                all[f]->snapshot("deploy");
+            }
+        }
+    }
+    cout<<"Content dedup ("<<files<<" files x "<<rounds<<" UPDATE+SNAPSHOT rounds, 5 distinct 4 KB payloads):"<<endl;
+    store.printStats();
+    for(File* f : all) delete f;
+}
+
+// Cold tiering: many snapshots of log-like text, then two compressCold() passes (the
+// first one only opens the window). Memory held before and after, and READ of every
+// version while hot, on the first read after going cold (unpacks it) and once warm again.
+static string logText(mt19937& rng, int lines){
+    static const char* levels[]={"INFO", "INFO", "INFO", "WARN", "DEBUG", "ERROR"};
+    static const char* paths[]={"/api/users", "/api/orders", "/api/search", "/static/app.js", "/health"};
+    string text;
+    char line[160];
+    for(int i=0; i<lines; i++){
+        int n=snprintf(line, sizeof(line), "2026-10-16 %02u:%02u:%02u.%03u %s request id=%u path=%s status=%u latency=%ums\n",
+                       (unsigned)(rng()%24), (unsigned)(rng()%60), (unsigned)(rng()%60), (unsigned)(rng()%1000),
+                       levels[rng()%6], (unsigned)(rng()%100000), paths[rng()%5], rng()%10 ? 200u : 500u, (unsigned)(rng()%300));
+        text.append(line, n);
+    }
+    return text;
+}
+static void benchColdStorage(){
+    const int files=50, versions=20, lines=800;
+    mt19937 rng(11);
+    string sample=logText(rng, lines);
+    const int runs=200;
+    string packed;
+    auto start=chrono::steady_clock::now();
+    for(int r=0; r<runs; r++) packed=compressBlock(sample);
+    double compress_s=nsPerOp(start, runs)/1e9;
+    string unpacked(sample.size(), '\0');
+    start=chrono::steady_clock::now();
+    for(int r=0; r<runs; r++) decompressBlock(packed, &unpacked[0], unpacked.size());
+    double decompress_s=nsPerOp(start, runs)/1e9;
+    cout<<"Cold tiering ("<<files<<" files x "<<versions<<" snapshots of "<<sample.size()/1024<<" KB log text):"<<endl;
+    printf("  codec: ratio %.2fx   compress %7.1f MB/s   decompress %7.1f MB/s\n",
+           (double)sample.size()/packed.size(), sample.size()/compress_s/1e6, sample.size()/decompress_s/1e6);
+
+    BlobStore& store=BlobStore::instance();
+    size_t base_resident=store.residentBytes(), base_compressed=store.compressedBytes();
+    vector<File*> all;
+    {
+        MuteOutput mute;
+        for(int f=0; f<files; f++) all.push_back(new DefaultFile("File created."));
+        for(int v=0; v<versions; v++){
+            for(int f=0; f<files; f++){
+                all[f]->update(logText(rng, lines));
+                all[f]->snapshot("v");
+            }
+        }
+    }
+    NullOutput null_output;
+    streambuf* saved_out=cout.rdbuf(&null_output);
+    auto readAll=[&](){
+        auto begin=chrono::steady_clock::now();
+        for(int f=0; f<files; f++){
+            for(int v=1; v<=versions; v++) all[f]->read(v);
+        }
+        return nsPerOp(begin, files*versions);
+    };
+    size_t hot_bytes=store.residentBytes()-base_resident;
+    double hot_ns=readAll();
+    store.compressCold();//everything was just read, so this only starts the window
+    start=chrono::steady_clock::now();
+    size_t packed_blobs=store.compressCold();
+    double pass_ms=nsPerOp(start, 1)/1e6;
+    size_t cold_bytes=store.residentBytes()-base_resident;
+    size_t compressed=store.compressedBytes()-base_compressed;
+    double cold_ns=readAll();
+    double warm_ns=readAll();
+    size_t warm_bytes=store.residentBytes()-base_resident;
+    cout.rdbuf(saved_out);
+    printf("  hot:  %10zu bytes resident                      READ %8.1f us\n", hot_bytes, hot_ns/1000);
+    printf("  cold: %10zu bytes resident + %9zu compressed  READ %8.1f us (first read unpacks)\n",
+           cold_bytes, compressed, cold_ns/1000);
+    printf("  warm: %10zu bytes resident + %9zu compressed  READ %8.1f us\n", warm_bytes, compressed, warm_ns/1000);
+    printf("  compressCold: %zu blobs packed in %.1f ms\n", packed_blobs, pass_ms);
+    for(File* f : all) delete f;
+}
+
+// CREATE followed by many UPDATE/SNAPSHOT cycles, then destroying the whole file.
+// A long linear history used to be freed recursively, one stack frame per version.
+static void benchNodeAllocation(){
+    cout<<"Version tree allocation (CREATE then N x UPDATE+SNAPSHOT, then delete):"<<endl;
+    for(int versions : {1000, 100000, 500000}){
+        size_t allocations_before=allocation_count;
+        auto start=chrono::steady_clock::now();
+        File* file=new DefaultFile("File created.");
+        {
+            MuteOutput mute;
+            for(int i=0; i<versions; i++){
+                file->update(i%2 ? "a" : "b");
+                file->snapshot("");
+            }
+        }
+        double cycle_ns=nsPerOp(start, versions);
+        double allocations=(double)(allocation_count-allocations_before)/versions;
+        start=chrono::steady_clock::now();
+        delete file;
+        chrono::duration<double, milli> teardown=chrono::steady_clock::now()-start;
+        printf("  %7d versions   %6.1f ns/cycle   %5.2f allocations/version   teardown %7.2f ms\n",
+               versions, cycle_ns, allocations, teardown.count());
+    }
+}
+
+// Deep, branching history: 500k UPDATE+SNAPSHOT cycles, rolling back to a random
+// earlier version about once every 20000 cycles. Compares parent-pointer walks (what
+// HISTORY and any ancestry question used to cost) with the jump-pointer index.
+static TreeNode* naiveLca(TreeNode* a, TreeNode* b){
+    while(a->depth>b->depth) a=a->parent;
+    while(b->depth>a->depth) b=b->parent;
+    while(a!=b){ a=a->parent; b=b->parent; }
+    return a;
+}
+
+static void benchAncestry(){
+    const int versions=500000, queries=2000;
+    mt19937 rng(11);
+    DefaultFile file("File created.");
+    {
+        MuteOutput mute;
+        for(int i=0; i<versions; i++){
+            file.update(i%2 ? "a" : "b");
+            file.snapshot("");
+            if(rng()%20000==0) file.rollback(rng()%file.total_versions);
+        }
+    }
+    cout<<"Ancestry queries ("<<versions<<" versions, active depth "<<file.active_version->depth<<"):"<<endl;
+    vector<pair<TreeNode*, TreeNode*>> pairs;
+    for(int q=0; q<queries; q++){
+        pairs.push_back({file.version_map.get((int)(rng()%file.total_versions)), file.version_map.get((int)(rng()%file.total_versions))});
+    }
+    size_t sink=0;
+    auto start=chrono::steady_clock::now();
+    for(auto& p : pairs) sink+=naiveLca(p.first, p.second)->version_id;
+    printf("  LCA, parent walk        %10.1f us/query\n", nsPerOp(start, queries)/1000);
+    start=chrono::steady_clock::now();
+    for(auto& p : pairs) sink-=TreeNode::lowestCommonAncestor(p.first, p.second)->version_id;
+    printf("  LCA, jump pointers      %10.1f us/query   (%s)\n", nsPerOp(start, queries)/1000, sink==0 ? "answers match" : "MISMATCH");
+    const int pages=200;
+    {
+        MuteOutput mute;
+        start=chrono::steady_clock::now();
+        for(int q=0; q<pages; q++) file.history();
+    }
+    printf("  HISTORY, full path      %10.1f us/query\n", nsPerOp(start, pages)/1000);
+    {
+        MuteOutput mute;
+        start=chrono::steady_clock::now();
+        for(int q=0; q<pages; q++) file.history(file.active_version->depth-20, 20);
+    }
+    printf("  HISTORY, last 20 page   %10.1f us/query\n", nsPerOp(start, pages)/1000);
+}
+
+// Version timestamps: a time(nullptr) call per stamp (the old clock, one-second
+// resolution) versus the hybrid clock, from one thread and from several at once, and how
+// many of a burst of stamps share a value with the one before.
+static void benchClock(){
+    const int stamps=2000000, threads=4;
+    cout<<"Timestamps ("<<stamps<<" per thread):"<<endl;
+    auto run=[&](int n, auto stamp){
+        vector<thread> workers;
+        auto start=chrono::steady_clock::now();
+        for(int t=0; t<n; t++){
+            workers.emplace_back([&]{
+                int64_t sink=0;
+                for(int i=0; i<stamps; i++) sink+=stamp();
+                if(sink==1) cout<<"";
+            });
+        }
+        for(thread& worker : workers) worker.join();
+        return nsPerOp(start, stamps);
+    };
+    auto wall=[]{ return (int64_t)time(nullptr); };
+    auto hybrid=[]{ return (int64_t)currentTime(); };
+    printf("  time(nullptr)           %10.1f ns/stamp   %d threads: %6.1f ns/stamp\n", run(1, wall), threads, run(threads, wall));
+    printf("  hybrid clock            %10.1f ns/stamp   %d threads: %6.1f ns/stamp\n", run(1, hybrid), threads, run(threads, hybrid));
+    int wall_ties=0, hybrid_ties=0;
+    int64_t last_wall=wall(), last_hybrid=hybrid();
+    for(int i=0; i<100000; i++){
+        int64_t w=wall(), h=hybrid();
+        wall_ties+=w==last_wall;
+        hybrid_ties+=h==last_hybrid;
+        last_wall=w;
+        last_hybrid=h;
+    }
+    printf("  ties in 100000 stamps   time(nullptr) %d, hybrid clock %d\n", wall_ties, hybrid_ties);
+}
+
+// Point-in-time lookups on a file with a long, branching history whose snapshots are
+// one second apart: the newest snapshot at or before a random time, found by walking
+// every version (all a READ_AT could do without an index) and through the time index.
+static TreeNode* naiveSnapshotAt(File& file, Stamp time){
+    TreeNode* best=nullptr;
+    vector<TreeNode*> stack{file.root};
+    while(!stack.empty()){
+        TreeNode* node=stack.back();
+        stack.pop_back();
+        if(node->isSnapshot() && node->snapshot_timestamp<=time
+           && (!best || node->snapshot_timestamp>=best->snapshot_timestamp)) best=node;
+        for(TreeNode* child=node->first_child; child; child=child->next_sibling) stack.push_back(child);
+    }
+    return best;
+}
+
+static void benchTimeQueries(){
+    const int versions=200000, queries=200;
+    const time_t start_time=1700000000;
+    mt19937 rng(17);
+    setTimeOverride(start_time*STAMPS_PER_SECOND);
+    DefaultFile file("File created.");
+    {
+        MuteOutput mute;
+        for(int i=1; i<=versions; i++){
+            setTimeOverride((start_time+i)*STAMPS_PER_SECOND);
+            file.update(i%2 ? "a" : "b");
+            file.snapshot("");
+            if(rng()%5000==0) file.rollback(rng()%file.total_versions);
+        }
+    }
+    setTimeOverride(0);
+    vector<Stamp> times;
+    for(int q=0; q<queries; q++) times.push_back(endOfSecond(start_time+rng()%(versions+1)));
+    cout<<"Point-in-time lookups ("<<versions<<" snapshots, one per second):"<<endl;
+    long long sink=0;
+    auto start=chrono::steady_clock::now();
+    for(Stamp t : times) sink+=naiveSnapshotAt(file, t)->version_id;
+    printf("  tree walk               %10.1f us/query\n", nsPerOp(start, queries)/1000);
+    start=chrono::steady_clock::now();
+    for(Stamp t : times) sink-=file.snapshotAt(t)->version_id;
+    printf("  time index              %10.3f us/query   (%s)\n", nsPerOp(start, queries)/1000, sink==0 ? "answers match" : "MISMATCH");
+}
+
+// DIFF and MERGE between distant versions of a multi-MB file: two branches of scattered
+// line edits off a common snapshot, plus the byte trimming on its own.
+static void benchDiff(){
+    const int lines=100000, edits=200, runs=5;
+    mt19937 rng(13);
+    string base;
+    for(int i=0; i<lines; i++) base+="line "+to_string(i)+" of a moderately long generated document\n";
+    auto edit=[&](string text, const char* tag){
+        for(int i=0; i<edits; i++){
+            size_t at=text.find('\n', rng()%text.size());
+            if(at!=string::npos) text.insert(at+1, string(tag)+" edit "+to_string(i)+"\n");
+        }
+        return text;
+    };
+    string a=edit(base, "ours"), b=edit(base, "theirs");
+    DefaultFile file("File created.");
+    int ours, theirs;
+    {
+        MuteOutput mute;
+        file.update(base);
+        file.snapshot("base");
+        file.update(a);
+        file.snapshot("ours");
+        ours=file.active_version->version_id;
+        file.rollback(1);
+        file.update(b);
+        theirs=file.active_version->version_id;
+    }
+    cout<<"Diff and merge ("<<base.size()/1000000.0<<" MB, "<<edits<<" edits per branch):"<<endl;
+    string tail_edit=base;
+    tail_edit[tail_edit.size()-2]='!';
+    size_t sink=0;
+    auto start=chrono::steady_clock::now();
+    for(int r=0; r<runs; r++){
+        size_t i=0;
+        while(i<base.size() && base[i]==tail_edit[i]) i++;
+        sink+=i;
+    }
+    printf("  prefix trim, bytewise   %10.2f ms\n", nsPerOp(start, runs)/1e6);
+    start=chrono::steady_clock::now();
+    for(int r=0; r<runs; r++) sink-=commonPrefixLength(base.data(), tail_edit.data(), base.size());
+    printf("  prefix trim, SIMD       %10.2f ms   (%s)\n", nsPerOp(start, runs)/1e6, sink==0 ? "answers match" : "MISMATCH");
+    start=chrono::steady_clock::now();
+    for(int r=0; r<runs; r++) sink+=diffLines(a, b).size();
+    printf("  diff ours -> theirs     %10.2f ms   (%zu hunks)\n", nsPerOp(start, runs)/1e6, sink/runs);
+    {
+        MuteOutput mute;
+        start=chrono::steady_clock::now();
+        file.merge(ours, theirs);
+    }
+    printf("  MERGE                   %10.2f ms\n", nsPerOp(start, 1)/1e6);
+}
+
+// RECENT_FILES over many files: rebuilding a heap per query (the old handler) versus
+// the incrementally maintained index answering top-k directly.
+static void benchAnalytics(){
+    const int files=1000000, k=10, queries=20;
+    mt19937 rng(3);
+    vector<Fileppt> all;
+    FileHeap index(true);
+    for(int i=0; i<files; i++){
+        all.push_back({"project/src/file_"+to_string(i)+".cpp", (Stamp)(rng()%100000), 1, i});
+        index.push(all.back());
+    }
+    cout<<"RECENT_FILES "<<k<<" over "<<files<<" files:"<<endl;
+    auto start=chrono::steady_clock::now();
+    for(int q=0; q<queries; q++){
+        FileHeap rebuilt(true);
+        for(int i=0; i<files; i++) rebuilt.push(all[i]);
+        for(int i=0; i<k; i++) rebuilt.pop();
+    }
+    printf("  rebuild per query    %12.1f us/query\n", nsPerOp(start, queries)/1000);
+    start=chrono::steady_clock::now();
+    const int updates=1000000;
+    for(int i=0; i<updates; i++) index.update(rng()%files, 100000+i, 1);
+    printf("  index update         %12.1f ns/mutation\n", nsPerOp(start, updates));
+    start=chrono::steady_clock::now();
+    size_t sink=0;
+    for(int q=0; q<queries*1000; q++) sink+=index.top(k).size();
+    printf("  indexed top-k        %12.1f us/query   (%zu)\n", nsPerOp(start, queries*1000)/1000, sink);
+}
+
+// Durable commits through the write-ahead log: every thread appends a record and waits
+// for it to be synced before the next, like a client waiting for its acknowledgement.
+static void benchWriteAheadLog(){
+    const char* path="benchmark.wal";
+    const int per_thread=500;
+    cout<<"Write-ahead log, append + waitDurable per record:"<<endl;
+    for(int threads : {1, 4, 16, 64}){
+        remove(path);
+        WriteAheadLog log;
+        string error;
+        if(!log.open(path, 0, [](int64_t, string_view){}, error)){
+            cout<<"  "<<error<<endl;
+            return;
+        }
+        auto start=chrono::steady_clock::now();
+        vector<thread> workers;
+        for(int t=0; t<threads; t++){
+            workers.emplace_back([&log, t]{
+                string command="INSERT file_"+to_string(t)+" "+string(64, 'x');
+                for(int i=0; i<per_thread; i++) log.waitDurable(log.append(0, command));
+            });
+        }
+        for(thread& worker : workers) worker.join();
+        chrono::duration<double> elapsed=chrono::steady_clock::now()-start;
+        size_t records=(size_t)threads*per_thread;
+        printf("  %2d threads: %.0f durable records/sec\n", threads, records/elapsed.count());
+        fflush(stdout);
+        log.printStats();
+    }
+    // Recovery: replaying a log of mutating commands into an empty file system.
+    remove(path);
+    const int files=1000, commands=200000;
+    {
+        WriteAheadLog log;
+        string error;
+        log.open(path, 0, [](int64_t, string_view){}, error);
+        for(int f=0; f<files; f++) log.append(0, "CREATE file_"+to_string(f));
+        for(int i=0; i<commands; i++){
+            string name="file_"+to_string(i%files);
+            log.append(i, (i%4 ? "INSERT " : "SNAPSHOT ")+name+" line "+to_string(i));
+        }
+    }
+    FileSystem fs;
+    size_t replayed=0;
+    string error;
+    auto start=chrono::steady_clock::now();
+    fs.openLog(path, replayed, error);
+    chrono::duration<double, milli> elapsed=chrono::steady_clock::now()-start;
+    printf("  recovery: replayed %zu records in %.1f ms (%.0f records/sec)\n", replayed, elapsed.count(), replayed/elapsed.count()*1000);
+    remove(path);
+}
+
+// Mixed command stream from N client threads over a shared FileSystem: 70% READ,
+// 10% HISTORY, 15% INSERT, 4% SNAPSHOT, 1% RECENT_FILES, on uniformly chosen files.
+static void benchConcurrency(){
+    const int files=10000, ops_per_thread=200000;
+    FileSystem fs;
+    NullOutput null_output;
+    streambuf* saved_out=cout.rdbuf(&null_output);
+    streambuf* saved_err=cerr.rdbuf(&null_output);
+    for(int f=0; f<files; f++){
+        string name="file_"+to_string(f);
+        fs.processCommand("CREATE "+name);
+        fs.processCommand("INSERT "+name+" initial content of "+name);
+    }
+    int max_threads=max(4u, thread::hardware_concurrency());
+    double single=0;
+    vector<string> lines;
+    for(int threads=1; threads<=max_threads; threads*=2){
+        vector<vector<string>> commands(threads);
+        for(int t=0; t<threads; t++){
+            mt19937 rng(100+t);
+            commands[t].reserve(ops_per_thread);
+            for(int i=0; i<ops_per_thread; i++){
+                string name="file_"+to_string(rng()%files);
+                int roll=rng()%100;
+                if(roll<70) commands[t].push_back("READ "+name);
+                else if(roll<80) commands[t].push_back("HISTORY "+name);
+                else if(roll<95) commands[t].push_back("INSERT "+name+" x");
+                else if(roll<99) commands[t].push_back("SNAPSHOT "+name+" s");
+                else commands[t].push_back("RECENT_FILES 10");
+            }
+        }
+        auto start=chrono::steady_clock::now();
+        vector<thread> workers;
+        for(int t=0; t<threads; t++){
+            workers.emplace_back([&fs, &commands, t]{
+                for(const string& command : commands[t]) fs.processCommand(command);
+            });
+        }
+        for(thread& worker : workers) worker.join();
+        chrono::duration<double> elapsed=chrono::steady_clock::now()-start;
+        double rate=(double)threads*ops_per_thread/elapsed.count();
+        if(threads==1) single=rate;
+        char line[128];
+        snprintf(line, sizeof(line), "  %2d threads  %10.0f commands/sec   speedup %5.2fx", threads, rate, rate/single);
+        lines.push_back(line);
+    }
+    cout.rdbuf(saved_out);
+    cerr.rdbuf(saved_err);
+    cout<<"Concurrent clients on one FileSystem ("<<files<<" files, "<<thread::hardware_concurrency()<<" hardware threads):"<<endl;
+    for(const string& line : lines) cout<<line<<endl;
+}
+
+// Readers pulling a handful of hot historical snapshots while a writer keeps adding
+// versions to the same file. Locked: every READ takes the file's lock, as READ of the
+// active version does. Lock-free: READ <file> <version> on published snapshots.
+static void benchSnapshotReads(){
+    const int versions=1000, hot=4, reads_per_thread=200000;
+    NullOutput null_output;
+    streambuf* saved_out=cout.rdbuf(&null_output);
+    DefaultFile file("File created.");
+    for(int i=0; i<versions; i++){
+        file.insert("line "+to_string(i)+" of a moderately long historical document\n");
+        file.snapshot("v");
+    }
+    vector<string> lines;
+    for(int threads : {1, 4}){
+        for(bool lock_free : {false, true}){
+            atomic<bool> done{false};
+            atomic<size_t> writes{0};
+            thread writer([&]{
+                while(!done.load(memory_order_relaxed)){
+                    lock_guard<mutex> guard(file.lock);
+                    file.insert("w");
+                    file.snapshot("w");
+                    writes++;
+                }
+            });
+            auto start=chrono::steady_clock::now();
+            vector<thread> readers;
+            for(int t=0; t<threads; t++){
+                readers.emplace_back([&, t]{
+                    mt19937 rng(t);
+                    for(int i=0; i<reads_per_thread; i++){
+                        int version=1+versions/2+rng()%hot;
+                        if(lock_free && file.readSnapshot(version)) continue;
+                        lock_guard<mutex> guard(file.lock);
+                        file.read(version);
+                    }
+                });
+            }
+            for(thread& reader : readers) reader.join();
+            chrono::duration<double> elapsed=chrono::steady_clock::now()-start;
+            done=true;
+            writer.join();
+            char line[160];
+            snprintf(line, sizeof(line), "  %-9s %d reader(s)  %10.0f READs/sec   writer %8.0f versions/sec",
+                     lock_free ? "lock-free" : "locked", threads,
+                     (double)threads*reads_per_thread/elapsed.count(), writes/elapsed.count());
+            lines.push_back(line);
+        }
+    }
+    cout.rdbuf(saved_out);
+    cout<<"Historical snapshot READs under a concurrent writer ("<<hot<<" hot versions):"<<endl;
+    for(const string& line : lines) cout<<line<<endl;
+}
+
+// PRUNE of a long linear history down to its last 100 snapshots, while a client keeps
+// reading the file's active version. One lock hold: plan, commit and free in a single
+// critical section. Sliced: the PRUNE command, which holds the lock for at most
+// PRUNE_SLICE at a time. The reader's longest wait is the stall PRUNE caused.
+static void benchPrune(){
+    const int versions=300000, keep=100;
+    vector<string> lines;
+    for(bool sliced : {false, true}){
+        FileSystem fs;
+        NullOutput null_output;
+        streambuf* saved_out=cout.rdbuf(&null_output);
+        fs.processCommand("CREATE f");
+        for(int i=0; i<versions; i++){
+            fs.processCommand("UPDATE f revision "+to_string(i)+" of a short configuration file");
+            fs.processCommand("SNAPSHOT f r");
+        }
+        File* file=fs.find("f");
+        size_t bytes_before=file->contentBytes();
+        atomic<bool> done{false};
+        atomic<long long> longest_ns{0};
+        atomic<size_t> reads{0};
+        thread reader([&]{
+            while(!done.load(memory_order_relaxed)){
+                auto begin=chrono::steady_clock::now();
+                fs.processCommand("READ f");
+                long long waited=chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-begin).count();
+                if(waited>longest_ns.load(memory_order_relaxed)) longest_ns.store(waited, memory_order_relaxed);
+                reads++;
+            }
+        });
+        this_thread::sleep_for(chrono::milliseconds(20));
+        auto start=chrono::steady_clock::now();
+        if(sliced){
+            fs.processCommand("PRUNE f LAST "+to_string(keep));
+        } else {
+            lock_guard<mutex> guard(file->lock);
+            PruneJob job(PrunePolicy{PrunePolicy::KEEP_LAST, keep});
+            auto no_deadline=chrono::steady_clock::time_point::max();
+            file->prunePlan(job, no_deadline);
+            file->pruneCommit(job);
+            while(!file->pruneFree(job, no_deadline)) this_thread::yield();
+        }
+        chrono::duration<double, milli> elapsed=chrono::steady_clock::now()-start;
+        done=true;
+        reader.join();
+        cout.rdbuf(saved_out);
+        char line[200];
+        snprintf(line, sizeof(line), "  %-14s %7.1f ms   content %9zu -> %6zu bytes   reader: %7zu READs, longest wait %8.2f ms",
+                 sliced ? "sliced" : "one lock hold", elapsed.count(), bytes_before, file->contentBytes(),
+                 reads.load(), longest_ns/1e6);
+        lines.push_back(line);
+    }
+    cout<<"PRUNE "<<versions<<" snapshots to the last "<<keep<<" under a concurrent reader:"<<endl;
+    for(const string& line : lines) cout<<line<<endl;
+}
+
+// Minimal ustar writer for benchImport.
+static void tarEntry(string& archive, const string& name, const string& content, long mtime){
+    char header[512]={};
+    snprintf(header, 100, "%s", name.c_str());
+    snprintf(header+100, 8, "%07o", 0644);
+    snprintf(header+124, 12, "%011zo", content.size());
+    snprintf(header+136, 12, "%011lo", mtime);
+    header[156]='0';
+    memcpy(header+257, "ustar", 6);
+    memcpy(header+263, "00", 2);
+    memset(header+148, ' ', 8);
+    unsigned sum=0;
+    for(unsigned char c : header) sum+=c;
+    snprintf(header+148, 8, "%06o", sum);
+    archive.append(header, 512);
+    archive+=content;
+    archive.append((512-content.size()%512)%512, '\0');
+}
+
+static void benchImport(){
+    const int files=20000, versions=3, batch=256;
+    const char* path="/tmp/benchmark_import.tar";
+    auto nameOf=[](int i){ return "dir"+to_string(i%100)+"/file"+to_string(i); };
+    mt19937 rng(11);
+    vector<string> contents;
+    string archive;
+    for(int v=0; v<versions; v++){//history: every file again, newer
+        for(int i=0; i<files; i++){
+            contents.push_back(logText(rng, 20));
+            tarEntry(archive, nameOf(i), contents.back(), 1600000000+v*3600);
+        }
+    }
+    archive.append(1024, '\0');
+    FILE* out=fopen(path, "wb");
+    fwrite(archive.data(), 1, archive.size(), out);
+    fclose(out);
+
+    NullOutput null_output;
+    streambuf* saved_out=cout.rdbuf(&null_output);
+    FileSystem one_by_one, imported;
+    auto start=chrono::steady_clock::now();
+    for(int i=0; i<files; i++) one_by_one.processCommand("CREATE "+nameOf(i));
+    for(int v=0; v<versions; v++){
+        for(int i=0; i<files; i++){
+            one_by_one.processCommand("UPDATE "+nameOf(i)+" "+contents[v*files+i]);
+            one_by_one.processCommand("SNAPSHOT "+nameOf(i)+" v");
+        }
+    }
+    double commands=nsPerOp(start, files)/1e3;
+    start=chrono::steady_clock::now();
+    imported.processCommand(string("IMPORT ")+path);
+    double bulk=nsPerOp(start, files)/1e3;
+
+    string names;
+    vector<string> reads;
+    for(int i=0; i<batch; i++){
+        names+=(i ? "," : "")+nameOf(i*files/batch);
+        reads.push_back("READ "+nameOf(i*files/batch));
+    }
+    start=chrono::steady_clock::now();
+    for(int r=0; r<20; r++){
+        for(const string& read : reads) imported.processCommand(read);
+    }
+    double single=nsPerOp(start, 20*batch)/1e3;
+    start=chrono::steady_clock::now();
+    for(int r=0; r<20; r++) imported.processCommand("MULTI_READ "+names);
+    double multi=nsPerOp(start, 20*batch)/1e3;
+    cout.rdbuf(saved_out);
+    remove(path);
+    cout<<"Bulk import ("<<files<<" files x "<<versions<<" versions, "<<thread::hardware_concurrency()<<" cores):"<<endl;
+    printf("  CREATE/UPDATE/SNAPSHOT  %8.1f us/file\n", commands);
+    printf("  IMPORT of a tar         %8.1f us/file\n", bulk);
+    printf("  READ x %d              %8.2f us/file\n", batch, single);
+    printf("  MULTI_READ of %d       %8.2f us/file\n", batch, multi);
+}
+
+// Append-only logs, as in benchDeltaStorage: the naive search reads every version in
+// full, so it grows with the square of the history.
+static void benchGrep(){
+    const int files=100, versions=200;
+    mt19937 rng(13);
+    NullOutput null_output;
+    streambuf* saved_out=cout.rdbuf(&null_output);
+    FileSystem fs;
+    for(int i=0; i<files; i++){
+        string name="log"+to_string(i);
+        fs.processCommand("CREATE "+name);
+        for(int v=0; v<versions; v++){
+            string text=logText(rng, 5);
+            if(i%25==0 && v==versions/2) text+="panic: lost-connection to shard 7\n";//rare
+            fs.processCommand("INSERT "+name+" "+text);
+            fs.processCommand("SNAPSHOT "+name+" v");
+        }
+    }
+    size_t history=0, found=0;
+    auto start=chrono::steady_clock::now();
+    for(int i=0; i<files; i++){
+        File* f=fs.find("log"+to_string(i));
+        for(int v=0; v<f->total_versions; v++){
+            TreeNode* node=f->version(v);
+            history+=node->length;
+            string text=node->content.flatten();
+            found+=findSubstring(text, "lost-connection")!=string_view::npos;
+        }
+    }
+    double naive=chrono::duration<double, milli>(chrono::steady_clock::now()-start).count();
+    auto grep=[&](const string& pattern){
+        auto start=chrono::steady_clock::now();
+        fs.processCommand("GREP "+pattern);
+        return chrono::duration<double, milli>(chrono::steady_clock::now()-start).count();
+    };
+    double first=grep("lost-connection");
+    double rare=grep("shard");
+    fs.processCommand("INSERT log1 one more line\n");//marked, posted by the next GREP
+    double incremental=grep("lost-connection");
+    double common=grep("status=500");
+    cout.rdbuf(saved_out);
+    cout<<"GREP over "<<files<<" files x "<<versions<<" versions ("<<history/1000000<<" MB of history, "
+        <<found<<" versions match):"<<endl;
+    printf("  read every version        %8.1f ms\n", naive);
+    printf("  GREP, building the index  %8.1f ms\n", first);
+    printf("  GREP, rare pattern        %8.1f ms\n", rare);
+    printf("  GREP after one INSERT     %8.1f ms\n", incremental);
+    printf("  GREP, in every version    %8.1f ms\n", common);
+}
+
+static void benchCheckpoints(){
+    const int files=200000, touched=10000;
+    mt19937 rng(17);
+    NullOutput null_output;
+    streambuf* saved_out=cout.rdbuf(&null_output);
+    FileSystem fs;
+    for(int i=0; i<files; i++) fs.processCommand("CREATE file"+to_string(i));
+    auto timed=[&](const string& command){
+        auto start=chrono::steady_clock::now();
+        fs.processCommand(command);
+        return chrono::duration<double, micro>(chrono::steady_clock::now()-start).count();
+    };
+    auto start=chrono::steady_clock::now();
+    vector<pair<string, int>> copied;//what a tag would cost without sharing
+    copied.reserve(files);
+    for(const string& name : fs.file_order) copied.emplace_back(name, fs.find(name)->committed_version);
+    double walk=chrono::duration<double, micro>(chrono::steady_clock::now()-start).count();
+    double tag=timed("TAG release");
+    auto edit=[&](int count){
+        auto start=chrono::steady_clock::now();
+        for(int i=0; i<count; i++){
+            string name="file"+to_string(rng()%files);
+            fs.processCommand("UPDATE "+name+" edited");
+            fs.processCommand("SNAPSHOT "+name+" edit");
+        }
+        return nsPerOp(start, count);
+    };
+    double shared=edit(touched);//first edits after the tag copy the paths it shares
+    double owned=edit(touched);
+    double branch=timed("BRANCH work");
+    double rollback=timed("CHECKOUT release");
+    double forward=timed("CHECKOUT work");
+    fs.processCommand("TAG nearby");
+    edit(100);
+    double small=timed("CHECKOUT nearby");
+    cout.rdbuf(saved_out);
+    cout<<"Checkpoints over "<<files<<" files:"<<endl;
+    printf("  copy every file's version     %10.1f us\n", walk);
+    printf("  TAG                           %10.1f us\n", tag);
+    printf("  UPDATE+SNAPSHOT after TAG     %10.1f ns\n", shared);
+    printf("  UPDATE+SNAPSHOT, paths owned  %10.1f ns\n", owned);
+    printf("  BRANCH                        %10.1f us\n", branch);
+    printf("  CHECKOUT, %d edits apart  %10.1f us\n", 2*touched, rollback);
+    printf("  CHECKOUT back to the branch   %10.1f us\n", forward);
+    printf("  CHECKOUT, 100 edits apart     %10.1f us\n", small);
+}
+
+// The storage policies CREATE can pick (content=, index=, times=), each compiled into its
+// own BasicFile. Every version replaces one line of the file at random and is snapshotted;
+// "held" is what the blob store holds for the file, after deduplication.
+struct PolicyCosts {
+    double write_ns, read_ns, lookup_ns, at_ns, held;
+};
+
+template <typename Policies>
+static PolicyCosts benchLayout(int lines, int line_size, int versions){
+    mt19937 rng(23);
+    vector<string> text(lines);
+    for(string& line : text){
+        line.resize(line_size-1);
+        for(char& c : line) c='a'+rng()%26;
+        line+='\n';
+    }
+    size_t before=BlobStore::instance().residentBytes();
+    NullOutput null_output;
+    ostream discard(&null_output);
+    PolicyCosts costs;
+    BasicFile<Policies> file("File created.");
+    string content;
+    double write_ns=0;
+    for(int v=0; v<versions; v++){
+        text[rng()%lines][rng()%(line_size-1)]='a'+rng()%26;
+        content.clear();
+        for(const string& line : text) content+=line;
+        auto start=chrono::steady_clock::now();
+        file.update(content);
+        file.snapshot("", discard, discard);
+        write_ns+=chrono::duration<double, nano>(chrono::steady_clock::now()-start).count();
+    }
+    costs.write_ns=write_ns/versions;
+    costs.held=(double)(BlobStore::instance().residentBytes()-before)/versions;
+    const int reads=2000, lookups=1000000, queries=2000;
+    vector<int> ids(reads);
+    for(int& id : ids) id=1+rng()%versions;
+    streambuf* saved_out=cout.rdbuf(&null_output);
+    auto start=chrono::steady_clock::now();
+    for(int id : ids) file.read(id);
+    costs.read_ns=nsPerOp(start, reads);
+    cout.rdbuf(saved_out);
+    long long sink=0;
+    start=chrono::steady_clock::now();
+    for(int i=0; i<lookups; i++) sink+=file.version(1+(int)((size_t)i*7919%versions))->length;
+    costs.lookup_ns=nsPerOp(start, lookups);
+    vector<Stamp> times;
+    for(int i=0; i<queries; i++) times.push_back(file.version(1+rng()%versions)->snapshot_timestamp);
+    start=chrono::steady_clock::now();
+    for(Stamp t : times) sink+=file.snapshotAt(t)->version_id;
+    costs.at_ns=nsPerOp(start, queries);
+    if(sink==1) cout<<"";
+    return costs;
+}
+
+template <typename Policies>
+static void printLayout(const char* name, int lines, int line_size, int versions){
+    PolicyCosts c=benchLayout<Policies>(lines, line_size, versions);
+    printf("  %-24s %9.0f %9.0f %9.1f %10.0f %11.0f\n", name, c.write_ns, c.read_ns, c.lookup_ns, c.at_ns, c.held);
+}
+
+static void benchPolicies(){
+    typedef FilePolicies<DeltaContent, HashIndex, IndexedTimes> Delta;
+    typedef FilePolicies<WholeContent, HashIndex, IndexedTimes> Whole;
+    typedef FilePolicies<PrivateContent, HashIndex, IndexedTimes> Private;
+    const char* header="                           write ns   READ ns lookup ns READ_AT ns  held B/ver\n";
+    const int small_versions=20000, large_versions=300;
+    cout<<"Storage policies, small file ("<<small_versions<<" versions of 8 x 32 B lines, one byte changed per version):"<<endl;
+    printf("%s", header);
+    printLayout<Delta>("content=delta (default)", 8, 32, small_versions);
+    printLayout<Whole>("content=whole", 8, 32, small_versions);
+    printLayout<Private>("content=private", 8, 32, small_versions);
+    printLayout<FilePolicies<DeltaContent, DenseIndex, IndexedTimes>>("index=dense", 8, 32, small_versions);
+    printLayout<FilePolicies<DeltaContent, HashIndex, ScannedTimes>>("times=scanned", 8, 32, small_versions);
+    printLayout<FilePolicies<PrivateContent, DenseIndex, IndexedTimes>>("private, dense", 8, 32, small_versions);
+    cout<<"Storage policies, large file ("<<large_versions<<" versions of 4096 x 64 B lines, one byte changed per version):"<<endl;
+    printf("%s", header);
+    printLayout<Delta>("content=delta (default)", 4096, 64, large_versions);
+    printLayout<Whole>("content=whole", 4096, 64, large_versions);
+    printLayout<Private>("content=private", 4096, 64, large_versions);
+    printLayout<FilePolicies<DeltaContent, HashIndex, ScannedTimes>>("times=scanned", 4096, 64, large_versions);
+}
+
+int main(){
+    benchHashTables();
+    benchDeltaStorage();
+    benchDedup();
+    benchColdStorage();
+    benchNodeAllocation();
+    benchAnalytics();
+    benchAncestry();
+    benchClock();
+    benchTimeQueries();
+    benchDiff();
+    benchWriteAheadLog();
+    benchConcurrency();
+    benchSnapshotReads();
+    benchPrune();
+    benchImport();
+    benchGrep();
+    benchCheckpoints();
+    benchPolicies();
+    return 0;
+}
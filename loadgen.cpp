@@ -0,0 +1,341 @@
+#include "FileSystem.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+// Load generator for server mode (filesystem --serve): opens --connections connections,
+// each keeping --pipeline requests in flight until it has had --requests answered, spread
+// over --threads client threads with an epoll loop each. Latency is measured per request,
+// from when it is queued to send until its whole response has arrived. Reports
+// requests/sec and latency percentiles, as a table or (--json) as one JSON object.
+// Build: g++ -std=c++17 -O2 -pthread loadgen.cpp DataStructures.cpp FileSystem.cpp Persistence.cpp Diff.cpp Compression.cpp Stats.cpp -o loadgen
+
+enum Kind { READ, READ_VERSION, INSERT, SNAPSHOT, HISTORY, ANALYTICS, KINDS };
+static const char* KIND_NAMES[KINDS]={"read", "read_version", "insert", "snapshot", "history", "analytics"};
+
+struct LoadConfig {
+    string address;//port on 127.0.0.1, or Unix socket path
+    int connections=64;
+    int pipeline=4;//requests in flight per connection
+    int requests=10000;//per connection
+    int threads=4;
+    int files=1000;
+    int depth=5;//snapshots made on every file before the measured run
+    unsigned seed=1;
+    bool json=false;
+    int mix[KINDS]={60, 15, 15, 5, 3, 2};//relative weights
+};
+
+struct Client {
+    int fd;
+    string in;
+    string out;
+    deque<chrono::steady_clock::time_point> sent;
+    int issued=0;
+    int answered=0;
+};
+
+static int connectTo(const string& address){
+    bool tcp=all_of(address.begin(), address.end(), [](char c){ return c>='0' && c<='9'; });
+    int fd=socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if(fd<0) return -1;
+    int ok;
+    if(tcp){
+        sockaddr_in remote{};
+        remote.sin_family=AF_INET;
+        remote.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+        remote.sin_port=htons(atoi(address.c_str()));
+        ok=connect(fd, (sockaddr*)&remote, sizeof(remote));
+        int on=1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    } else {
+        sockaddr_un remote{};
+        remote.sun_family=AF_UNIX;
+        strncpy(remote.sun_path, address.c_str(), sizeof(remote.sun_path)-1);
+        ok=connect(fd, (sockaddr*)&remote, sizeof(remote));
+    }
+    if(ok<0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Takes every complete response off the front of in; returns how many there were.
+static int takeResponses(string& in, int& errors){
+    size_t at=0;
+    int count=0;
+    while(true){
+        size_t newline=in.find('\n', at);
+        if(newline==string::npos) break;
+        size_t size=strtoull(in.c_str()+at, nullptr, 10);
+        if(in.size()-newline-1<size) break;
+        if(in.compare(newline+1, 6, "Error:")==0) errors++;
+        at=newline+1+size;
+        count++;
+    }
+    in.erase(0, at);
+    return count;
+}
+
+static string fileName(int i){
+    return "load_"+to_string(i);
+}
+
+static string nextRequest(const LoadConfig& config, discrete_distribution<int>& pick_kind, mt19937_64& rng){
+    string name=fileName(rng()%config.files);
+    switch(pick_kind(rng)){
+    case READ: return "READ "+name;
+    case READ_VERSION: return "READ "+name+" "+to_string(1+rng()%config.depth);
+    case INSERT: return "INSERT "+name+" line "+to_string(rng()%1000000);
+    case SNAPSHOT: return "SNAPSHOT "+name+" loadgen";
+    case HISTORY: return "HISTORY "+name+" 0 10";
+    default: return rng()%2 ? "RECENT_FILES 10" : "BIGGEST_TREES 10";
+    }
+}
+
+// Runs commands over one blocking connection, a window at a time so that neither side's
+// socket buffer can fill while the other waits.
+static bool runSetup(const LoadConfig& config){
+    int fd=connectTo(config.address);
+    if(fd<0) return false;
+    vector<string> commands;
+    for(int f=0; f<config.files; f++){
+        commands.push_back("CREATE "+fileName(f));
+        for(int d=0; d<config.depth; d++){
+            commands.push_back("UPDATE "+fileName(f)+" setup content "+to_string(d));
+            commands.push_back("SNAPSHOT "+fileName(f)+" setup");
+        }
+    }
+    const size_t window=256;
+    string in;
+    char buffer[65536];
+    int errors=0;
+    for(size_t start=0; start<commands.size(); start+=window){
+        string out;
+        size_t end=min(commands.size(), start+window);
+        for(size_t i=start; i<end; i++) out+=commands[i]+'\n';
+        if(write(fd, out.data(), out.size())!=(ssize_t)out.size()){
+            close(fd);
+            return false;
+        }
+        for(size_t answered=0; answered<end-start;){
+            ssize_t got=read(fd, buffer, sizeof(buffer));
+            if(got<=0){
+                close(fd);
+                return false;
+            }
+            in.append(buffer, got);
+            answered+=takeResponses(in, errors);
+        }
+    }
+    close(fd);
+    return true;
+}
+
+// One client thread: drives its connections until each has had every request answered.
+static void runClients(const LoadConfig& config, int count, unsigned seed, Histogram& latency, int& errors, bool& failed){
+    mt19937_64 rng(seed);
+    discrete_distribution<int> pick_kind(config.mix, config.mix+KINDS);
+    int epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+    vector<Client> clients(count);
+    auto issue=[&](Client& c){
+        while(c.issued<config.requests && c.issued-c.answered<config.pipeline){
+            c.out+=nextRequest(config, pick_kind, rng);
+            c.out+='\n';
+            c.sent.push_back(chrono::steady_clock::now());
+            c.issued++;
+        }
+    };
+    auto flush=[&](Client& c){
+        while(!c.out.empty()){
+            ssize_t written=write(c.fd, c.out.data(), c.out.size());
+            if(written<0) return errno==EAGAIN || errno==EINTR;
+            c.out.erase(0, written);
+        }
+        return true;
+    };
+    for(int i=0; i<count; i++){
+        Client& c=clients[i];
+        c.fd=connectTo(config.address);
+        if(c.fd<0){
+            failed=true;
+            count=i;
+            break;
+        }
+        fcntl(c.fd, F_SETFL, O_NONBLOCK);
+        epoll_event event{};
+        event.events=EPOLLIN|EPOLLOUT;
+        event.data.u32=i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.fd, &event);
+        issue(c);
+    }
+    epoll_event events[64];
+    char buffer[65536];
+    int remaining=count;
+    while(remaining>0 && !failed){
+        int ready=epoll_wait(epoll_fd, events, 64, 1000);
+        if(ready<0 && errno!=EINTR) break;
+        for(int e=0; e<ready; e++){
+            Client& c=clients[events[e].data.u32];
+            if(events[e].events & (EPOLLIN|EPOLLHUP|EPOLLERR)){
+                ssize_t got=read(c.fd, buffer, sizeof(buffer));
+                if(got==0 || (got<0 && errno!=EAGAIN && errno!=EINTR)){
+                    failed=true;
+                    break;
+                }
+                if(got>0) c.in.append(buffer, got);
+                int answered=takeResponses(c.in, errors);
+                auto now=chrono::steady_clock::now();
+                for(int a=0; a<answered; a++){
+                    latency.record(chrono::duration_cast<chrono::nanoseconds>(now-c.sent.front()).count());
+                    c.sent.pop_front();
+                }
+                c.answered+=answered;
+                if(c.answered==config.requests){
+                    close(c.fd);//also drops it from the epoll set
+                    remaining--;
+                    continue;
+                }
+                issue(c);
+            }
+            if(!flush(c)) failed=true;
+            epoll_event event{};
+            event.events=EPOLLIN|(c.out.empty() ? (uint32_t)0 : (uint32_t)EPOLLOUT);
+            event.data.u32=events[e].data.u32;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &event);
+        }
+    }
+    for(int i=0; i<count; i++){
+        if(clients[i].answered<config.requests) close(clients[i].fd);
+    }
+    close(epoll_fd);
+}
+
+static bool parseMix(const char* text, int mix[KINDS]){
+    int parsed[KINDS]={};
+    string_view rest(text);
+    while(!rest.empty()){
+        size_t comma=rest.find(',');
+        string_view item=rest.substr(0, comma);
+        rest=comma==string_view::npos ? string_view() : rest.substr(comma+1);
+        size_t equals=item.find('=');
+        if(equals==string_view::npos) return false;
+        int kind=find(KIND_NAMES, KIND_NAMES+KINDS, item.substr(0, equals))-KIND_NAMES;
+        if(kind==KINDS || !parseNumber(item.substr(equals+1), parsed[kind])) return false;
+    }
+    if(all_of(parsed, parsed+KINDS, [](int weight){ return weight==0; })) return false;
+    copy(parsed, parsed+KINDS, mix);
+    return true;
+}
+
+static bool parseArguments(int argc, char** argv, LoadConfig& config){
+    for(int i=1; i<argc; i++){
+        auto number=[&](int& value){ return i+1<argc && parseNumber(argv[++i], value); };
+        if(strcmp(argv[i], "--connect")==0 && i+1<argc){
+            config.address=argv[++i];
+        } else if(strcmp(argv[i], "--connections")==0){
+            if(!number(config.connections) || config.connections<1) return false;
+        } else if(strcmp(argv[i], "--pipeline")==0){
+            if(!number(config.pipeline) || config.pipeline<1) return false;
+        } else if(strcmp(argv[i], "--requests")==0){
+            if(!number(config.requests) || config.requests<1) return false;
+        } else if(strcmp(argv[i], "--threads")==0){
+            if(!number(config.threads) || config.threads<1) return false;
+        } else if(strcmp(argv[i], "--files")==0){
+            if(!number(config.files) || config.files<1) return false;
+        } else if(strcmp(argv[i], "--depth")==0){
+            if(!number(config.depth) || config.depth<1) return false;
+        } else if(strcmp(argv[i], "--seed")==0){
+            int seed=0;
+            if(!number(seed)) return false;
+            config.seed=seed;
+        } else if(strcmp(argv[i], "--mix")==0 && i+1<argc){
+            if(!parseMix(argv[++i], config.mix)) return false;
+        } else if(strcmp(argv[i], "--json")==0){
+            config.json=true;
+        } else {
+            return false;
+        }
+    }
+    return !config.address.empty();
+}
+
+int main(int argc, char** argv){
+    LoadConfig config;
+    if(!parseArguments(argc, argv, config)){
+        cerr<<"Usage: "<<argv[0]<<" --connect <port>|<socket path> [--connections N] [--pipeline N] [--requests N]"
+            <<" [--threads N] [--files N] [--depth N] [--seed N] [--mix kind=weight,...] [--json]"<<'\n'
+            <<"Kinds: read read_version insert snapshot history analytics"<<'\n';
+        return 1;
+    }
+    config.threads=min(config.threads, config.connections);
+    auto start=chrono::steady_clock::now();
+    if(!runSetup(config)){
+        cerr<<"Error: Cannot reach a server at '"<<config.address<<"'."<<'\n';
+        return 1;
+    }
+    chrono::duration<double> setup=chrono::steady_clock::now()-start;
+
+    vector<Histogram> latencies(config.threads);
+    vector<int> errors(config.threads, 0);
+    unique_ptr<bool[]> failed(new bool[config.threads]());
+    start=chrono::steady_clock::now();
+    vector<thread> threads;
+    for(int t=0; t<config.threads; t++){
+        int count=config.connections/config.threads+(t<config.connections%config.threads);
+        threads.emplace_back(runClients, cref(config), count, config.seed+1+t, ref(latencies[t]), ref(errors[t]),
+                             ref(failed[t]));
+    }
+    for(thread& t : threads) t.join();
+    chrono::duration<double> elapsed=chrono::steady_clock::now()-start;
+    if(any_of(failed.get(), failed.get()+config.threads, [](bool f){ return f; })){
+        cerr<<"Error: A connection to the server failed."<<'\n';
+        return 1;
+    }
+
+    MergedHistogram merged;
+    for(const Histogram& h : latencies) merged.add(h);
+    int error_count=0;
+    for(int e : errors) error_count+=e;
+    double throughput=merged.total/elapsed.count();
+    double p50=merged.percentile(0.5)/1e3, p99=merged.percentile(0.99)/1e3, p999=merged.percentile(0.999)/1e3;
+    double largest=merged.largest/1e3;
+
+    if(config.json){
+        printf("{\"config\": {\"connections\": %d, \"pipeline\": %d, \"requests\": %d, \"threads\": %d, "
+               "\"files\": %d, \"depth\": %d, \"seed\": %u, \"mix\": {",
+               config.connections, config.pipeline, config.requests, config.threads, config.files, config.depth,
+               config.seed);
+        for(int k=0; k<KINDS; k++) printf("%s\"%s\": %d", k ? ", " : "", KIND_NAMES[k], config.mix[k]);
+        printf("}},\n \"setup_seconds\": %.3f, \"seconds\": %.3f, \"requests\": %llu, \"errors\": %d, "
+               "\"requests_per_second\": %.0f,\n \"latency_us\": {\"p50\": %.2f, \"p99\": %.2f, \"p999\": %.2f, "
+               "\"max\": %.2f}}\n", setup.count(), elapsed.count(), (unsigned long long)merged.total, error_count,
+               throughput, p50, p99, p999, largest);
+        return 0;
+    }
+    printf("Setup: %d files x %d snapshots in %.2f s\n", config.files, config.depth, setup.count());
+    printf("Run:   %llu requests over %d connections (pipeline %d, %d client threads) in %.2f s: %.0f requests/sec\n",
+           (unsigned long long)merged.total, config.connections, config.pipeline, config.threads, elapsed.count(),
+           throughput);
+    if(error_count) printf("       %d responses were errors\n", error_count);
+    printf("  latency us   p50 %.1f   p99 %.1f   p99.9 %.1f   max %.1f\n", p50, p99, p999, largest);
+    return 0;
+}
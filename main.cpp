@@ -1,222 +1,267 @@
-#include "DataStructures.hpp"
-#include <iostream>
-
-using namespace std;
-
-// FILESYSTEM - To manage multiple files with O(1) lookup using the hashmap FileMap
-class FileSystem {
-public:
-    FileMap file_map;
-    vector<string> file_order; // to preserve insertion order for listing
-
-    FileSystem(){}
-    ~FileSystem(){
-        vector<string> keys = file_map.keys();
-        for(int i=0; i<keys.size(); i++){
-            File* f=file_map.get(keys[i]);
-            delete f;
-        }
-    }
-
-    void processCommand(const string& command){
-        // Input Parsing: split only first two tokens, rest is content/message (can be empty)
-        string cmd, filename, rest;
-        size_t pos1 = command.find(' ');//find the space character
-        if(pos1== string::npos){//No space, entire string is treated as a command
-            cmd=command;        
-        } else {
-            cmd=command.substr(0,pos1);
-            size_t pos2=command.find(' ', pos1 + 1);//sssearch another space after the first space
-            if(pos2 == string::npos){//No second space, rest of the string is filename
-                filename = command.substr(pos1 + 1);
-            } else {
-                filename = command.substr(pos1 + 1, pos2 - pos1 - 1);
-                rest = command.substr(pos2 + 1); // content or message, can be empty
-            }
-        }
-
-        if(cmd.empty()) return;//If empty command is given, ignore it
-
-        if(cmd=="CREATE" && !filename.empty()){
-            handleCreate(filename);
-        } else if (cmd=="READ" && !filename.empty()) {
-            handleRead(filename);
-        } else if (cmd=="INSERT" && !filename.empty()) {
-            handleInsert(filename, rest);
-        } else if (cmd=="UPDATE" && !filename.empty()) {
-            handleUpdate(filename, rest);
-        } else if (cmd=="SNAPSHOT" && !filename.empty()) {
-            handleSnapshot(filename, rest);
-        } else if (cmd=="ROLLBACK" && !filename.empty()) {
-            string version_str = rest;
-            handleRollback(filename, version_str);
-        } else if (cmd=="HISTORY" && !filename.empty()) {
-            handleHistory(filename);
-        } else if (cmd=="RECENT_FILES") {
-            int num = 5;
-            if (!filename.empty()) num = stoi(filename);
-            handleRecentFiles(num);
-        } else if (cmd=="BIGGEST_TREES") {
-            int num = 5;
-            if (!filename.empty()) num = stoi(filename);
-            handleBiggestTrees(num);
-        } else {
-            cerr<<"Error: Unknown command."<<endl;
-        }
-    }
-
-private:
-    void handleCreate(const string& filename) {
-        if(!file_map.contains(filename)){
-            file_map.insert(filename, new File("File created."));
-            file_order.push_back(filename);
-            cout<<"File '"<<filename<<"' created successfully."<<endl;
-        } else {
-            cerr<<"Error: File '"<<filename<<"' already exists."<<endl;
-        }
-    }
-
-    void handleRead(const string& filename){
-        File* f=file_map.get(filename);
-        if(f){
-            f->read();
-        } else {
-            cerr<<"Error: File '"<<filename<<"' not found."<<endl;
-        }
-    }
-
-    void handleInsert(const string& filename, const string& content) {
-        File* f=file_map.get(filename);
-        if(f){
-            f->insert(content);
-        } else {
-            cerr<<"Error: File '"<<filename<<"' not found."<<endl;
-        }
-    }
-
-    void handleUpdate(const string& filename, const string& content) {
-        File* f=file_map.get(filename);
-        if(f){
-            f->update(content);
-        } else {
-            cerr<<"Error: File '"<<filename<<"' not found."<<endl;
-        }
-    }
-
-    void handleSnapshot(const string& filename, const string& message) {
-        File* f=file_map.get(filename);
-        if(f){
-            f->snapshot(message);
-        } else {
-            cerr<<"Error: File '"<<filename<<"' not found."<<endl;
-        }
-    }
-
-    void handleRollback(const string& filename, const string& version_str) {
-        File* f=file_map.get(filename);
-        if(f){
-            if(version_str.empty()){
-                f->rollbackToParent();
-            } else {
-                int version_id=0;
-                bool valid=true;
-                for(int i=0; i<version_str.size(); i++){
-                    if(version_str[i]<'0' || version_str[i]>'9') { valid=false; break; }
-                    version_id=version_id*10 + (version_str[i]-'0');
-                }
-                if(valid){
-                    f->rollback(version_id);
-                } else {
-                    cerr<<"Error: Invalid version ID provided."<<endl;
-                }
-            }
-        } else {
-            cerr<<"Error: File '"<<filename<<"' not found."<<endl;
-        }
-    }
-
-    void handleHistory(const string& filename) {
-        File* f=file_map.get(filename);
-        if(f){
-            f->history();
-        } else {
-            cerr<<"Error: File '"<<filename<<"' not found."<<endl;
-        }
-    }
-
-    void handleRecentFiles(int num) {
-        if(num<0) {
-            cerr<<"Error: Number of files must be non-negative."<<endl;
-            return;
-        }
-        FileHeap recent_files_heap(true);
-        for(int i=0; i<file_order.size(); i++){
-            File* file=file_map.get(file_order[i]);
-            if(file && file->active_version){
-                recent_files_heap.push({file_order[i], file->active_version->created_timestamp, 0});
-            }
-        }
-        cout<<"Most recently modified files:"<<endl;
-        for(int i=0; i<num && !recent_files_heap.empty(); i++){
-            Fileppt file=recent_files_heap.pop();
-            cout<<"  -> "<<file.filename<<endl;
-        }
-    }
-
-    void handleBiggestTrees(int num) {
-        if(num<0) {
-            cerr<<"Error: Number of files must be non-negative."<<endl;
-            return;
-        }
-        FileHeap biggest_trees_heap(false);
-        for(int i=0; i<file_order.size(); i++){
-            File* file=file_map.get(file_order[i]);
-            if(file){
-                biggest_trees_heap.push({file_order[i], 0, file->total_versions});
-            }
-        }
-        cout<<"Files with the most versions:"<<endl;
-        for(int i=0; i<num && !biggest_trees_heap.empty(); i++){
-            Fileppt file=biggest_trees_heap.pop();
-            cout<<"  - "<<file.filename<<" ("<<file.total_versions<<" versions)"<<endl;
-        }
-    }
-};
-
-void showUsage() {
-    //List all the available commands and their input format
-    cout << "Available commands:" << endl;
-    cout << "  CREATE <filename>" << endl;
-    cout << "  READ <filename>" << endl;
-    cout << "  INSERT <filename> <content>" << endl;
-    cout << "  UPDATE <filename> <content>" << endl;
-    cout << "  SNAPSHOT <filename> <message>" << endl;
-    cout << "  ROLLBACK <filename> [versionID]" << endl;
-    cout << "  HISTORY <filename>" << endl;
-    cout << "  RECENT_FILES [num]" << endl;
-    cout << "  BIGGEST_TREES [num]" << endl;
-    cout << "  EXIT" << endl;// Exit the program
-}
-
-int main() {
-    FileSystem fs;
-    string line;
-
-    showUsage();
-    cout << "\n> ";
-
-    while(true){
-        getline(cin, line);
-        if(line.empty()){
-            cout<<"> ";
-            continue;
-        }
-        if(line.substr(0, 4)=="EXIT"){
-            break;
-        }
-        fs.processCommand(line);
-        cout<<endl<<"> ";//Prompt for next command
-    }
-
-    return 0;
-}
\ No newline at end of file
+#include "FileSystem.hpp"
+#include "Server.hpp"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+void showUsage() {
+    //List all the available commands and their input format
+    cout << "Available commands:" << '\n';
+    cout << "  CREATE <filename> [content=delta|whole|private] [index=hash|dense] [times=indexed|scanned]" << '\n';
+    cout << "  READ <filename> [versionID]" << '\n';
+    cout << "  READ_AT <filename> <unix time>" << '\n';
+    cout << "  INSERT <filename> <content>" << '\n';
+    cout << "  UPDATE <filename> <content>" << '\n';
+    cout << "  SNAPSHOT <filename> <message>" << '\n';
+    cout << "  ROLLBACK <filename> [versionID]" << '\n';
+    cout << "  HISTORY <filename> [offset] [count]" << '\n';
+    cout << "  ANCESTOR <filename> <versionID> <k>" << '\n';
+    cout << "  LCA <filename> <versionID1> <versionID2>" << '\n';
+    cout << "  IS_ANCESTOR <filename> <versionID1> <versionID2>" << '\n';
+    cout << "  DIFF <filename> <versionID1> <versionID2>" << '\n';
+    cout << "  MERGE <filename> <versionID1> <versionID2>" << '\n';
+    cout << "  PRUNE <filename> LAST <n> | SINCE <unix time>" << '\n';
+    cout << "  SNAPSHOT_AT <unix time>" << '\n';
+    cout << "  IMPORT <directory> | <tar archive>" << '\n';
+    cout << "  MULTI_READ <filename>,<filename>,..." << '\n';
+    cout << "  MULTI_SNAPSHOT <filename>,<filename>,... <message>" << '\n';
+    cout << "  GREP <pattern> [filename]" << '\n';
+    cout << "  TAG <name>" << '\n';
+    cout << "  BRANCH <name>" << '\n';
+    cout << "  CHECKOUT <tag or branch>" << '\n';
+    cout << "  TAGS" << '\n';
+    cout << "  RECENT_FILES [num]" << '\n';
+    cout << "  BIGGEST_TREES [num]" << '\n';
+    cout << "  STORAGE_STATS" << '\n';
+    cout << "  STATS" << '\n';
+    cout << "  SAVE <path>" << '\n';
+    cout << "  EXIT" << '\n';// Exit the program
+}
+
+// Output buffer for batch mode: collects output in a large buffer and only issues a
+// write() when it is full or at the end, instead of once per line.
+class BatchOutput : public streambuf {
+private:
+    int fd;
+    vector<char> buffer;
+    bool writeAll(const char* data, size_t size){
+        while(size>0){
+            ssize_t written=::write(fd, data, size);
+            if(written<0){
+                if(errno==EINTR) continue;
+                return false;
+            }
+            data+=written;
+            size-=written;
+        }
+        return true;
+    }
+    int flushBuffer(){
+        bool ok=writeAll(pbase(), pptr()-pbase());
+        setp(buffer.data(), buffer.data()+buffer.size());
+        return ok ? 0 : -1;
+    }
+protected:
+    int overflow(int c) override {
+        if(flushBuffer()<0) return traits_type::eof();
+        if(c!=traits_type::eof()){
+            *pptr()=c;
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+    streamsize xsputn(const char* data, streamsize size) override {
+        if(size>epptr()-pptr()){
+            if(flushBuffer()<0) return 0;
+            if(size>=(streamsize)buffer.size()) return writeAll(data, size) ? size : 0;//too big to buffer
+        }
+        memcpy(pptr(), data, size);
+        pbump(size);
+        return size;
+    }
+    int sync() override {
+        return flushBuffer();
+    }
+public:
+    BatchOutput(int fd, size_t size = 1<<20) : fd(fd), buffer(size) {
+        setp(buffer.data(), buffer.data()+buffer.size());
+    }
+    ~BatchOutput(){
+        flushBuffer();
+    }
+};
+
+static Server* serving=nullptr;
+static void stopServing(int){
+    if(serving) serving->stop();
+}
+
+// Runs every line of a command file (or stdin for "-") without prompts. Regular files
+// are memory-mapped and scanned in place. Returns the number of commands executed.
+size_t runBatch(FileSystem& fs, const char* path) {
+    size_t commands=0;
+    string line;
+    auto run=[&](string_view command){
+        if(command.empty()) return true;
+        if(command.compare(0, 4, "EXIT")==0) return false;
+        fs.processCommand(command);
+        commands++;
+        return true;
+    };
+    if(strcmp(path, "-")==0){
+        while(getline(cin, line)){
+            if(!line.empty() && line.back()=='\r') line.pop_back();
+            if(!run(line)) break;
+        }
+        return commands;
+    }
+    int fd=open(path, O_RDONLY);
+    struct stat info;
+    if(fd<0 || fstat(fd, &info)<0){
+        cerr<<"Error: Cannot open batch file '"<<path<<"'."<<'\n';
+        if(fd>=0) close(fd);
+        return 0;
+    }
+    size_t size=info.st_size;
+    if(size>0){
+        void* mapped=mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped==MAP_FAILED){
+            cerr<<"Error: Cannot map batch file '"<<path<<"'."<<'\n';
+            close(fd);
+            return 0;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        const char* data=static_cast<const char*>(mapped);
+        const char* end=data+size;
+        while(data<end){
+            const char* newline=static_cast<const char*>(memchr(data, '\n', end-data));
+            const char* line_end=newline ? newline : end;
+            size_t length=line_end-data;
+            if(length>0 && data[length-1]=='\r') length--;
+            if(!run(string_view(data, length))) break;
+            data=line_end+1;
+        }
+        munmap(mapped, size);
+    }
+    close(fd);
+    return commands;
+}
+
+int main(int argc, char** argv) {
+    FileSystem fs;
+    string line;
+
+    //Options: [--repo <repository>] [--wal <log> [--wal-sync]] [--cold-after <seconds>] [--stats-every <seconds>]
+    //         [--batch <command-file>|- | --serve <port>|<socket path> [--workers <n>]]
+    const char* repo_path=nullptr;
+    const char* wal_path=nullptr;
+    const char* batch_path=nullptr;
+    const char* serve_address=nullptr;
+    int workers=max(1u, thread::hardware_concurrency());
+    int cold_after=0;
+    int stats_every=0;
+    for(int i=1; i<argc; i++){
+        if(strcmp(argv[i], "--repo")==0 && i+1<argc){
+            repo_path=argv[++i];
+        } else if(strcmp(argv[i], "--wal")==0 && i+1<argc){
+            wal_path=argv[++i];
+        } else if(strcmp(argv[i], "--wal-sync")==0){
+            fs.wal_sync=true;
+        } else if(strcmp(argv[i], "--cold-after")==0 && i+1<argc && parseNumber(argv[i+1], cold_after) && cold_after>0){
+            i++;
+        } else if(strcmp(argv[i], "--stats-every")==0 && i+1<argc && parseNumber(argv[i+1], stats_every) && stats_every>0){
+            i++;
+        } else if(strcmp(argv[i], "--batch")==0 && i+1<argc){
+            batch_path=argv[++i];
+        } else if(strcmp(argv[i], "--serve")==0 && i+1<argc){
+            serve_address=argv[++i];
+        } else if(strcmp(argv[i], "--workers")==0 && i+1<argc && parseNumber(argv[i+1], workers) && workers>0){
+            i++;
+        } else {
+            cerr<<"Usage: "<<argv[0]<<" [--repo <repository>] [--wal <log> [--wal-sync]] [--cold-after <seconds>] [--stats-every <seconds>]"
+                <<" [--batch <command-file>|- | --serve <port>|<socket path> [--workers <n>]]"<<'\n';
+            return 1;
+        }
+    }
+    string error;
+    if(repo_path){
+        auto start=chrono::steady_clock::now();
+        if(!fs.load(repo_path, error)){
+            cerr<<"Error: "<<error<<'\n';
+            return 1;
+        }
+        chrono::duration<double, milli> elapsed=chrono::steady_clock::now()-start;
+        cerr<<"Loaded "<<fs.fileCount()<<" files in "<<elapsed.count()<<" ms"<<'\n';
+    }
+    if(wal_path){//the log holds whatever happened after the repository was saved
+        auto start=chrono::steady_clock::now();
+        size_t replayed=0;
+        if(!fs.openLog(wal_path, replayed, error)){
+            cerr<<"Error: "<<error<<'\n';
+            return 1;
+        }
+        chrono::duration<double, milli> elapsed=chrono::steady_clock::now()-start;
+        if(replayed>0) cerr<<"Recovered "<<replayed<<" logged commands in "<<elapsed.count()<<" ms"<<'\n';
+    }
+    if(cold_after>0) fs.cold_tier=new ColdTier(chrono::seconds(cold_after));
+    if(stats_every>0) fs.stats_dumper=new StatsDumper(chrono::seconds(stats_every), [&fs]{ return fs.statsReport(); });
+
+    if(serve_address){
+        Server server(fs, workers);
+        if(!server.listen(serve_address, error)){
+            cerr<<"Error: "<<error<<'\n';
+            return 1;
+        }
+        serving=&server;
+        signal(SIGINT, stopServing);
+        signal(SIGTERM, stopServing);
+        signal(SIGPIPE, SIG_IGN);//a client that hangs up shows as a failed write instead
+        cerr<<"Serving on "<<serve_address<<" with "<<workers<<" workers"<<'\n';
+        server.run();
+        serving=nullptr;
+        return 0;
+    }
+
+    if(batch_path){
+        BatchOutput out(STDOUT_FILENO), err(STDERR_FILENO);
+        streambuf* saved_out=cout.rdbuf(&out);
+        streambuf* saved_err=cerr.rdbuf(&err);
+        cerr.tie(nullptr);//otherwise every error line would flush cout
+        auto start=chrono::steady_clock::now();
+        size_t commands=runBatch(fs, batch_path);
+        chrono::duration<double> elapsed=chrono::steady_clock::now()-start;
+        cout.flush();
+        cerr<<"Executed "<<commands<<" commands in "<<elapsed.count()<<" s ("
+            <<(elapsed.count()>0 ? commands/elapsed.count() : 0)<<" commands/sec)"<<'\n';
+        cerr.flush();
+        cout.rdbuf(saved_out);
+        cerr.rdbuf(saved_err);
+        return 0;
+    }
+
+    showUsage();
+    cout << "\n> ";
+
+    while(true){
+        if(!getline(cin, line)) break;
+        if(line.empty()){
+            cout<<"> ";
+            continue;
+        }
+        if(line.substr(0, 4)=="EXIT"){
+            break;
+        }
+        fs.processCommand(line);
+        cout<<"\n> "<<flush;//Prompt for next command
+    }
+
+    return 0;
+}
@@ -0,0 +1,270 @@
+#include "FileSystem.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sys/resource.h>
+#include <thread>
+
+using namespace std;
+
+// Synthetic workload driver: builds a file system of --files files with --depth
+// snapshots each, then runs --ops commands per thread drawn from a command mix, with
+// files picked under a Zipfian skew. Reports throughput, per-command latency
+// percentiles and peak RSS, as a table or (--json) as one JSON object.
+// Build: g++ -std=c++17 -O2 -pthread workload.cpp DataStructures.cpp FileSystem.cpp Persistence.cpp Diff.cpp Compression.cpp Stats.cpp -o workload
+
+enum Kind { READ, READ_VERSION, INSERT, UPDATE, SNAPSHOT, ROLLBACK, HISTORY, ANALYTICS, KINDS };
+static const char* KIND_NAMES[KINDS]={"read", "read_version", "insert", "update", "snapshot", "rollback", "history", "analytics"};
+
+struct WorkloadConfig {
+    int files=1000;
+    int depth=20;//snapshots made on every file before the measured run
+    int content_size=256;//bytes written by each UPDATE, and the initial content
+    int insert_size=32;//bytes appended by each INSERT
+    int ops=200000;//per thread
+    int threads=1;
+    double zipf=0.99;//skew of file popularity, 0 for uniform
+    unsigned seed=1;
+    bool json=false;
+    int mix[KINDS]={40, 20, 15, 5, 10, 5, 3, 2};//relative weights
+};
+
+struct Command {
+    Kind kind;
+    string text;
+};
+
+// Swallows output, so the run measures the commands rather than the terminal.
+class NullOutput : public streambuf {
+protected:
+    int overflow(int c) override { return traits_type::not_eof(c); }
+    streamsize xsputn(const char*, streamsize size) override { return size; }
+};
+
+// Draws ranks 0..n-1 with P(k) proportional to 1/(k+1)^theta, by binary search over
+// the cumulative distribution, O(log n) per draw.
+class ZipfGenerator {
+private:
+    vector<double> cdf;
+public:
+    ZipfGenerator(size_t n, double theta) : cdf(n) {
+        double sum=0;
+        for(size_t k=0; k<n; k++){
+            sum+=1.0/pow(k+1, theta);
+            cdf[k]=sum;
+        }
+        for(double& c : cdf) c/=sum;
+    }
+    size_t next(mt19937_64& rng){
+        double u=uniform_real_distribution<double>(0, 1)(rng);
+        return min(cdf.size()-1, (size_t)(lower_bound(cdf.begin(), cdf.end(), u)-cdf.begin()));
+    }
+};
+
+static string randomText(mt19937_64& rng, int size){
+    static const char letters[]="abcdefghijklmnopqrstuvwxyz     ";
+    string text(size, ' ');
+    for(char& c : text) c=letters[rng()%(sizeof(letters)-1)];
+    return text;
+}
+
+static string fileName(int i){
+    return "file_"+to_string(i);
+}
+
+// Commands are generated up front so the measured loop does nothing but run them.
+// Popularity ranks are mapped to files through a shuffle, so the hot files are not
+// simply the first ones created.
+static vector<Command> generate(const WorkloadConfig& config, const vector<int>& file_of_rank, unsigned seed){
+    mt19937_64 rng(seed);
+    ZipfGenerator popularity(config.files, config.zipf);
+    discrete_distribution<int> pick_kind(config.mix, config.mix+KINDS);
+    vector<Command> commands;
+    commands.reserve(config.ops);
+    for(int i=0; i<config.ops; i++){
+        Kind kind=(Kind)pick_kind(rng);
+        string name=fileName(file_of_rank[popularity.next(rng)]);
+        string version=to_string(1+rng()%config.depth);//made by every file's setup
+        string text;
+        switch(kind){
+        case READ: text="READ "+name; break;
+        case READ_VERSION: text="READ "+name+" "+version; break;
+        case INSERT: text="INSERT "+name+" "+randomText(rng, config.insert_size); break;
+        case UPDATE: text="UPDATE "+name+" "+randomText(rng, config.content_size); break;
+        case SNAPSHOT: text="SNAPSHOT "+name+" workload"; break;
+        case ROLLBACK: text="ROLLBACK "+name+" "+version; break;
+        case HISTORY: text="HISTORY "+name+" 0 10"; break;
+        default: text=rng()%2 ? "RECENT_FILES 10" : "BIGGEST_TREES 10"; break;
+        }
+        commands.push_back({kind, std::move(text)});
+    }
+    return commands;
+}
+
+static double percentile(const vector<uint32_t>& sorted, double p){
+    if(sorted.empty()) return 0;
+    size_t index=min(sorted.size()-1, (size_t)(p*sorted.size()));
+    return sorted[index]/1000.0;
+}
+
+static long peakRssKb(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;//kilobytes on Linux
+}
+
+static bool parseMix(const char* text, int mix[KINDS]){
+    int parsed[KINDS]={};
+    string_view rest(text);
+    while(!rest.empty()){
+        size_t comma=rest.find(',');
+        string_view item=rest.substr(0, comma);
+        rest=comma==string_view::npos ? string_view() : rest.substr(comma+1);
+        size_t equals=item.find('=');
+        if(equals==string_view::npos) return false;
+        int kind=find(KIND_NAMES, KIND_NAMES+KINDS, item.substr(0, equals))-KIND_NAMES;
+        if(kind==KINDS || !parseNumber(item.substr(equals+1), parsed[kind])) return false;
+    }
+    if(all_of(parsed, parsed+KINDS, [](int weight){ return weight==0; })) return false;
+    copy(parsed, parsed+KINDS, mix);
+    return true;
+}
+
+static bool parseArguments(int argc, char** argv, WorkloadConfig& config){
+    for(int i=1; i<argc; i++){
+        auto number=[&](int& value){ return i+1<argc && parseNumber(argv[++i], value); };
+        if(strcmp(argv[i], "--files")==0){
+            if(!number(config.files) || config.files<1) return false;
+        } else if(strcmp(argv[i], "--depth")==0){
+            if(!number(config.depth) || config.depth<1) return false;
+        } else if(strcmp(argv[i], "--size")==0){
+            if(!number(config.content_size)) return false;
+        } else if(strcmp(argv[i], "--insert-size")==0){
+            if(!number(config.insert_size)) return false;
+        } else if(strcmp(argv[i], "--ops")==0){
+            if(!number(config.ops)) return false;
+        } else if(strcmp(argv[i], "--threads")==0){
+            if(!number(config.threads) || config.threads<1) return false;
+        } else if(strcmp(argv[i], "--seed")==0){
+            int seed=0;
+            if(!number(seed)) return false;
+            config.seed=seed;
+        } else if(strcmp(argv[i], "--zipf")==0 && i+1<argc){
+            char* end;
+            config.zipf=strtod(argv[++i], &end);
+            if(*end || config.zipf<0) return false;
+        } else if(strcmp(argv[i], "--mix")==0 && i+1<argc){
+            if(!parseMix(argv[++i], config.mix)) return false;
+        } else if(strcmp(argv[i], "--json")==0){
+            config.json=true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv){
+    WorkloadConfig config;
+    if(!parseArguments(argc, argv, config)){
+        cerr<<"Usage: "<<argv[0]<<" [--files N] [--depth N] [--size bytes] [--insert-size bytes] [--ops N]"
+            <<" [--threads N] [--zipf theta] [--seed N] [--mix kind=weight,...] [--json]"<<'\n'
+            <<"Kinds: read read_version insert update snapshot rollback history analytics"<<'\n';
+        return 1;
+    }
+    FileSystem fs;
+    NullOutput null_output;
+    streambuf* saved_out=cout.rdbuf(&null_output);
+    streambuf* saved_err=cerr.rdbuf(&null_output);
+
+    auto start=chrono::steady_clock::now();
+    {
+        mt19937_64 rng(config.seed);
+        for(int f=0; f<config.files; f++){
+            string name=fileName(f);
+            fs.processCommand("CREATE "+name);
+            for(int d=0; d<config.depth; d++){
+                fs.processCommand("UPDATE "+name+" "+randomText(rng, config.content_size));
+                fs.processCommand("SNAPSHOT "+name+" setup");
+            }
+        }
+    }
+    chrono::duration<double> setup=chrono::steady_clock::now()-start;
+
+    vector<int> file_of_rank(config.files);
+    for(int f=0; f<config.files; f++) file_of_rank[f]=f;
+    mt19937_64 shuffle_rng(config.seed);
+    shuffle(file_of_rank.begin(), file_of_rank.end(), shuffle_rng);
+    vector<vector<Command>> commands(config.threads);
+    for(int t=0; t<config.threads; t++) commands[t]=generate(config, file_of_rank, config.seed+1+t);
+
+    vector<vector<uint32_t>> latencies(config.threads*KINDS);//nanoseconds, by thread then kind
+    int weights=accumulate(config.mix, config.mix+KINDS, 0);
+    start=chrono::steady_clock::now();
+    vector<thread> workers;
+    for(int t=0; t<config.threads; t++){
+        workers.emplace_back([&, t]{
+            vector<uint32_t>* mine=&latencies[t*KINDS];
+            for(int k=0; k<KINDS; k++) mine[k].reserve((long long)config.ops*config.mix[k]/weights*2);
+            for(const Command& command : commands[t]){
+                auto begin=chrono::steady_clock::now();
+                fs.processCommand(command.text);
+                long long ns=chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-begin).count();
+                mine[command.kind].push_back((uint32_t)min(ns, (long long)UINT32_MAX));
+            }
+        });
+    }
+    for(thread& worker : workers) worker.join();
+    chrono::duration<double> elapsed=chrono::steady_clock::now()-start;
+    cout.rdbuf(saved_out);
+    cerr.rdbuf(saved_err);
+
+    vector<uint32_t> merged[KINDS];
+    for(int k=0; k<KINDS; k++){
+        for(int t=0; t<config.threads; t++){
+            merged[k].insert(merged[k].end(), latencies[t*KINDS+k].begin(), latencies[t*KINDS+k].end());
+        }
+        sort(merged[k].begin(), merged[k].end());
+    }
+    size_t total=(size_t)config.ops*config.threads;
+    double throughput=total/elapsed.count();
+    long rss=peakRssKb();
+
+    if(config.json){
+        printf("{\"config\": {\"files\": %d, \"depth\": %d, \"size\": %d, \"insert_size\": %d, \"ops\": %d, "
+               "\"threads\": %d, \"zipf\": %g, \"seed\": %u, \"mix\": {",
+               config.files, config.depth, config.content_size, config.insert_size, config.ops,
+               config.threads, config.zipf, config.seed);
+        for(int k=0; k<KINDS; k++) printf("%s\"%s\": %d", k ? ", " : "", KIND_NAMES[k], config.mix[k]);
+        printf("}},\n \"setup_seconds\": %.3f, \"seconds\": %.3f, \"commands\": %zu, \"commands_per_second\": %.0f, "
+               "\"peak_rss_kb\": %ld,\n \"latency_us\": {", setup.count(), elapsed.count(), total, throughput, rss);
+        bool first=true;
+        for(int k=0; k<KINDS; k++){
+            if(merged[k].empty()) continue;
+            printf("%s\n  \"%s\": {\"count\": %zu, \"p50\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}",
+                   first ? "" : ",", KIND_NAMES[k], merged[k].size(), percentile(merged[k], 0.5),
+                   percentile(merged[k], 0.99), percentile(merged[k], 0.999), merged[k].back()/1000.0);
+            first=false;
+        }
+        printf("\n }}\n");
+        return 0;
+    }
+    printf("Setup: %d files x %d snapshots of %d bytes in %.2f s\n",
+           config.files, config.depth, config.content_size, setup.count());
+    printf("Run:   %zu commands on %d thread(s), zipf %.2f, in %.2f s: %.0f commands/sec\n",
+           total, config.threads, config.zipf, elapsed.count(), throughput);
+    printf("Peak RSS: %.1f MB\n", rss/1024.0);
+    printf("  %-13s %9s %10s %10s %10s %10s\n", "command", "count", "p50 us", "p99 us", "p999 us", "max us");
+    for(int k=0; k<KINDS; k++){
+        if(merged[k].empty()) continue;
+        printf("  %-13s %9zu %10.2f %10.2f %10.2f %10.2f\n", KIND_NAMES[k], merged[k].size(),
+               percentile(merged[k], 0.5), percentile(merged[k], 0.99), percentile(merged[k], 0.999),
+               merged[k].back()/1000.0);
+    }
+    return 0;
+}